@@ -0,0 +1,150 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+
+#include "rtweekend.h"
+// Axis-aligned bounding box, one interval per axis
+    // every hittable reports one so acceleration structures can skip whole groups of objects with a slab test
+    // unbounded objects (infinite planes and cylinders) report infinite intervals on the axes they extend along
+
+class aabb {
+public:
+    interval x, y, z;
+
+    aabb() = default; // empty box (every interval empty)
+
+    aabb(const interval& x_in, const interval& y_in, const interval& z_in)
+        : x(x_in), y(y_in), z(z_in)
+    {
+        pad_to_minimums();
+    }
+
+    // Box with a and b as opposite corners (in any order)
+    aabb(const point3& a, const point3& b)
+    {
+        x = (a[0] <= b[0]) ? interval(a[0], b[0]) : interval(b[0], a[0]);
+        y = (a[1] <= b[1]) ? interval(a[1], b[1]) : interval(b[1], a[1]);
+        z = (a[2] <= b[2]) ? interval(a[2], b[2]) : interval(b[2], a[2]);
+
+        pad_to_minimums();
+    }
+
+    // Tightest box enclosing both
+    aabb(const aabb& box0, const aabb& box1)
+        : x(box0.x, box1.x), y(box0.y, box1.y), z(box0.z, box1.z) {}
+
+    const interval& axis_interval(int n) const
+    {
+        if (n == 1) return y;
+        if (n == 2) return z;
+        return x;
+    }
+
+    bool is_empty() const { return x.min > x.max || y.min > y.max || z.min > z.max; }
+
+    // True if the box reaches infinity on any axis
+    bool is_unbounded() const
+    {
+        return std::isinf(x.min) || std::isinf(x.max)
+            || std::isinf(y.min) || std::isinf(y.max)
+            || std::isinf(z.min) || std::isinf(z.max);
+    }
+
+    // Index of the axis with the largest extent
+    int longest_axis() const
+    {
+        if (x.size() > y.size()) return x.size() > z.size() ? 0 : 2;
+        return y.size() > z.size() ? 1 : 2;
+    }
+
+    // Surface area for the SAH, infinite for unbounded boxes and 0 for empty ones
+    double surface_area() const
+    {
+        if (is_empty()) return 0.0;
+        if (is_unbounded()) return std::numeric_limits<double>::infinity();
+
+        double dx = x.size();
+        double dy = y.size();
+        double dz = z.size();
+        return 2.0 * (dx * dy + dy * dz + dz * dx);
+    }
+
+    // Center of the box, unbounded axes use their finite end (or 0 if both are infinite)
+    point3 centroid() const
+    {
+        return point3(axis_center(x), axis_center(y), axis_center(z));
+    }
+
+    // Slab test, true if the ray passes through the box somewhere inside ray_t
+    bool hit(const ray& r, interval ray_t) const
+    {
+        return clip(r, ray_t);
+    }
+
+    // Slab test that narrows ray_t to the part of the ray inside the box, false if none of it is
+    bool clip(const ray& r, interval& ray_t) const
+    {
+        const vec3 inv_dir(1.0 / r.dir[0], 1.0 / r.dir[1], 1.0 / r.dir[2]);
+        return clip(r.orig, inv_dir, ray_t);
+    }
+
+    // Slab tests with the reciprocal direction computed by the caller, once per ray for accelerators that test many boxes
+    bool hit(const point3& orig, const vec3& inv_dir, interval ray_t) const
+    {
+        return clip(orig, inv_dir, ray_t);
+    }
+
+    bool clip(const point3& orig, const vec3& inv_dir, interval& ray_t) const
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const interval& ax = axis_interval(axis);
+
+            real t0 = (ax.min - orig[axis]) * inv_dir[axis];
+            real t1 = (ax.max - orig[axis]) * inv_dir[axis];
+
+            if (t0 > t1) std::swap(t0, t1);
+            t1 *= tolerance<real>::slab_scale;
+
+            // NaN (ray in the slab plane of an infinite side) leaves the interval unchanged
+            if (t0 > ray_t.min) ray_t.min = t0;
+            if (t1 < ray_t.max) ray_t.max = t1;
+
+            if (ray_t.max <= ray_t.min) return false;
+        }
+        return true;
+    }
+
+    // Overlap of two boxes (empty when they don't overlap)
+    static aabb overlap(const aabb& a, const aabb& b)
+    {
+        return aabb(interval(std::max(a.x.min, b.x.min), std::min(a.x.max, b.x.max)),
+            interval(std::max(a.y.min, b.y.min), std::min(a.y.max, b.y.max)),
+            interval(std::max(a.z.min, b.z.min), std::min(a.z.max, b.z.max)));
+    }
+
+    static const aabb empty, universe;
+
+private:
+    // Flat boxes (axis aligned quads) get a little thickness so the slab test can't miss them
+    void pad_to_minimums()
+    {
+        const real delta = tolerance<real>::box_padding;
+        if (x.size() < delta) x = x.expand(delta);
+        if (y.size() < delta) y = y.expand(delta);
+        if (z.size() < delta) z = z.expand(delta);
+    }
+
+    static double axis_center(const interval& ax)
+    {
+        const bool lo_inf = std::isinf(ax.min);
+        const bool hi_inf = std::isinf(ax.max);
+        if (lo_inf && hi_inf) return 0.0;
+        if (lo_inf) return ax.max;
+        if (hi_inf) return ax.min;
+        return 0.5 * (ax.min + ax.max);
+    }
+};
+
+inline const aabb aabb::empty = aabb(interval::empty, interval::empty, interval::empty);
+inline const aabb aabb::universe = aabb(interval::universe, interval::universe, interval::universe);
@@ -0,0 +1,168 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "rtweekend.h"
+#include "hittable_list.h"
+#include "scene_accelerator.h"
+#include "scenes.h"
+// Accelerator benchmark (main.cpp --bench-accel)
+    // every scene in all_scenes is traced through the default BVH, both grids and the compiled scene with the same rays
+    // rays are camera rays through random pixels plus one diffuse bounce from each camera ray hit, so both coherent and incoherent rays count
+    // each accelerator reports its build time, the best of a few timed passes and how many rays found a different closest hit than the BVH
+    // the same rays then go through occluded(), which must agree with whether hit() found anything
+    // scenes where every object is unbounded (test_inf_cylinder) build no tree with any accelerator and are skipped
+    // (shapes that return a different hit for a different ray interval, e.g. a ray starting inside a capsule, can differ by the order objects are tested in)
+
+// Camera rays for a scene entry, 16:9 like the default render settings
+inline std::vector<ray> benchmark_camera_rays(const scene_entry& scene, size_t count)
+{
+    const vec3 w = unit_vector(scene.lookfrom - scene.lookat);
+    const vec3 u = unit_vector(cross(vec3(0.0, 1.0, 0.0), w));
+    const vec3 v = cross(w, u);
+    const double half_height = std::tan(degrees_to_radians(scene.vfov) / 2.0);
+    const double half_width = half_height * 16.0 / 9.0;
+
+    std::vector<ray> rays;
+    rays.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        const vec3 dir = -w + random_double(-half_width, half_width) * u + random_double(-half_height, half_height) * v;
+        rays.emplace_back(scene.lookfrom, unit_vector(dir));
+    }
+    return rays;
+}
+
+// Build, time and check every accelerator on every scene
+inline void benchmark_accelerators(size_t camera_rays)
+{
+    const accelerator kinds[] = { default_accelerator, accelerator::grid, accelerator::grid2, accelerator::compiled };
+    const interval ray_t(0.001, std::numeric_limits<double>::infinity());
+    constexpr int passes = 3;
+
+    std::cerr << "========== Accelerator Benchmark =========\n";
+    std::cerr << "Rays per scene: " << camera_rays << " camera rays plus one bounce per hit, best of " << passes << " passes\n";
+
+    for (const scene_entry& scene : all_scenes)
+    {
+        const hittable_list world = scene.build(accelerator::none);
+
+        // Bounces come from the BVH's hits so every accelerator traces the same rays
+        std::vector<ray> rays = benchmark_camera_rays(scene, camera_rays);
+        bool has_tree = false;
+        {
+            const scene_accelerator reference(world.objects, default_accelerator);
+            has_tree = reference.info().name != "None";
+            hit_record rec;
+            for (size_t i = 0; i < camera_rays; ++i)
+            {
+                if (reference.hit(rays[i], ray_t, rec)) rays.emplace_back(rec.p, rec.normal + random_unit_vector());
+            }
+        }
+
+        std::cerr << "\n" << scene.name << " (" << world.objects.size() << " objects, " << rays.size() << " rays)\n";
+        if (!has_tree)
+        {
+            std::cerr << "  Nothing to accelerate, every object is unbounded\n";
+            continue;
+        }
+
+        std::vector<double> reference_t(rays.size());
+        std::vector<int> reference_id(rays.size());
+        double best_ns = 0.0;
+        std::string best_name;
+
+        for (accelerator kind : kinds)
+        {
+            const scene_accelerator accel(world.objects, kind);
+            const bool is_reference = (kind == kinds[0]);
+
+            double ns_per_ray = 0.0;
+            size_t hits = 0;
+            size_t differ = 0;
+            for (int pass = 0; pass < passes; ++pass)
+            {
+                hits = 0;
+                differ = 0;
+                hit_record rec;
+                const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+                for (size_t i = 0; i < rays.size(); ++i)
+                {
+                    const bool hit = accel.hit(rays[i], ray_t, rec);
+                    const double t = hit ? rec.t : -1.0;
+                    const int id = hit ? rec.object_id : -1;
+                    hits += hit ? 1 : 0;
+
+                    if (is_reference)
+                    {
+                        reference_t[i] = t;
+                        reference_id[i] = id;
+                    }
+                    else if (t != reference_t[i] || id != reference_id[i])
+                    {
+                        ++differ;
+                    }
+                }
+
+                const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / static_cast<double>(rays.size());
+                ns_per_ray = (pass == 0) ? ns : std::min(ns_per_ray, ns);
+            }
+
+            // Any-hit pass over the same rays
+            double any_ns_per_ray = 0.0;
+            size_t disagree = 0;
+            std::vector<char> hit_any(rays.size());
+            {
+                hit_record rec;
+                for (size_t i = 0; i < rays.size(); ++i)
+                {
+                    hit_any[i] = accel.hit(rays[i], ray_t, rec) ? 1 : 0;
+                }
+            }
+            for (int pass = 0; pass < passes; ++pass)
+            {
+                disagree = 0;
+                const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+                for (size_t i = 0; i < rays.size(); ++i)
+                {
+                    if (accel.occluded(rays[i], ray_t) != (hit_any[i] != 0)) ++disagree;
+                }
+
+                const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / static_cast<double>(rays.size());
+                any_ns_per_ray = (pass == 0) ? ns : std::min(any_ns_per_ray, ns);
+            }
+
+            const accelerator_info& info = accel.info();
+            std::cerr << "  " << std::left << std::setw(20) << info.name << std::right << std::fixed << std::setprecision(2)
+                << " build " << std::setw(8) << info.stats.build_ms << " ms | " << std::setprecision(1) << std::setw(7) << ns_per_ray << " ns/ray | "
+                << hits << " hits";
+            if (!is_reference) std::cerr << " | " << differ << " differ";
+            std::cerr << " | any-hit " << std::setw(6) << any_ns_per_ray << " ns/ray";
+            if (disagree > 0) std::cerr << " (" << disagree << " disagree with hit)";
+            if (info.has_grid_stats && info.grid.cells > 0)
+            {
+                std::cerr << " | " << info.grid.resolution[0] << "x" << info.grid.resolution[1] << "x" << info.grid.resolution[2];
+                if (info.grid.subgrids > 0) std::cerr << " + " << info.grid.subgrids << " subgrids";
+            }
+            std::cerr << "\n";
+
+            if (best_name.empty() || ns_per_ray < best_ns)
+            {
+                best_ns = ns_per_ray;
+                best_name = info.name;
+            }
+        }
+
+        std::cerr << "  Fastest: " << best_name << "\n";
+        std::cerr.unsetf(std::ios::floatfield);
+        std::cerr << std::setprecision(6);
+    }
+}
@@ -0,0 +1,168 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "rtweekend.h"
+// Arbitrary output variables (AOVs) the camera can write in a single render pass
+    // beauty is the path traced image, the others come from the first hit of every camera sample
+    // the set of outputs is a compile time mask so unused outputs cost nothing in the integrator
+
+enum aov_flags : unsigned {
+    aov_beauty    = 1u << 0,
+    aov_normal    = 1u << 1,
+    aov_depth     = 1u << 2,
+    aov_albedo    = 1u << 3,
+    aov_object_id = 1u << 4,
+
+    aov_all = aov_beauty | aov_normal | aov_depth | aov_albedo | aov_object_id,
+
+    // Sample count heatmap, written by adaptive renders (not part of the integrator mask)
+    aov_heatmap   = 1u << 5
+};
+
+// Sums over samples stay double in a float build too, a float sum stops taking small samples after a few thousand
+using color_sum = vec3_t<double>;
+
+// Rec. 709 luminance of a linear color
+template <typename T>
+inline double luminance(const vec3_t<T>& c)
+{
+    return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
+
+// Accumulated (summed over samples) values for one pixel
+struct aov_pixel {
+    color_sum beauty;
+    color_sum normal;
+    double depth = 0.0;
+    color_sum albedo;
+    int object_id = -1; // first sample's object, -1 for background
+
+    // Sample count plus running mean/variance of the beauty luminance (Welford) for adaptive sampling
+    int samples = 0;
+    double lum_mean = 0.0;
+    double lum_m2 = 0.0;
+
+    void add_sample(double lum)
+    {
+        ++samples;
+        double delta = lum - lum_mean;
+        lum_mean += delta / static_cast<double>(samples);
+        lum_m2 += delta * (lum - lum_mean);
+    }
+
+    // Half-width of the 95% confidence interval of the mean luminance
+    double confidence_interval() const
+    {
+        if (samples < 2) return std::numeric_limits<double>::infinity();
+
+        double variance = lum_m2 / static_cast<double>(samples - 1);
+        return 1.96 * std::sqrt(variance / static_cast<double>(samples));
+    }
+
+    // Confidence interval relative to the mean, the 0.01 floor keeps near black pixels from sampling forever
+    double relative_error() const
+    {
+        return confidence_interval() / std::max(lum_mean, 0.01);
+    }
+};
+
+// Full image buffers, only the requested outputs are allocated
+struct aov_buffers {
+    std::vector<color_sum> beauty;
+    std::vector<color_sum> normal;
+    std::vector<double> depth;
+    std::vector<color_sum> albedo;
+    std::vector<int> object_id;
+    std::vector<int> sample_count; // always allocated, every output is averaged by its pixel's own count
+    std::vector<double> lum_mean;  // Welford state, kept so adaptive/progressive passes can continue a pixel
+    std::vector<double> lum_m2;
+
+    aov_buffers(unsigned aovs, size_t pixel_count)
+    {
+        sample_count.assign(pixel_count, 0);
+        lum_mean.assign(pixel_count, 0.0);
+        lum_m2.assign(pixel_count, 0.0);
+        if (aovs & aov_beauty) beauty.assign(pixel_count, color_sum(0.0, 0.0, 0.0));
+        if (aovs & aov_normal) normal.assign(pixel_count, color_sum(0.0, 0.0, 0.0));
+        if (aovs & aov_depth) depth.assign(pixel_count, 0.0);
+        if (aovs & aov_albedo) albedo.assign(pixel_count, color_sum(0.0, 0.0, 0.0));
+        if (aovs & aov_object_id) object_id.assign(pixel_count, -1);
+    }
+
+    template <unsigned Aovs>
+    aov_pixel load(size_t index) const
+    {
+        aov_pixel px;
+        px.samples = sample_count[index];
+        px.lum_mean = lum_mean[index];
+        px.lum_m2 = lum_m2[index];
+        if constexpr ((Aovs & aov_beauty) != 0) px.beauty = beauty[index];
+        if constexpr ((Aovs & aov_normal) != 0) px.normal = normal[index];
+        if constexpr ((Aovs & aov_depth) != 0) px.depth = depth[index];
+        if constexpr ((Aovs & aov_albedo) != 0) px.albedo = albedo[index];
+        if constexpr ((Aovs & aov_object_id) != 0) px.object_id = object_id[index];
+        return px;
+    }
+
+    template <unsigned Aovs>
+    void store(size_t index, const aov_pixel& px)
+    {
+        sample_count[index] = px.samples;
+        lum_mean[index] = px.lum_mean;
+        lum_m2[index] = px.lum_m2;
+        if constexpr ((Aovs & aov_beauty) != 0) beauty[index] = px.beauty;
+        if constexpr ((Aovs & aov_normal) != 0) normal[index] = px.normal;
+        if constexpr ((Aovs & aov_depth) != 0) depth[index] = px.depth;
+        if constexpr ((Aovs & aov_albedo) != 0) albedo[index] = px.albedo;
+        if constexpr ((Aovs & aov_object_id) != 0) object_id[index] = px.object_id;
+    }
+};
+
+// File name suffix for each output ("" for beauty so plain renders keep their old names)
+inline const char* aov_suffix(unsigned aov)
+{
+    switch (aov)
+    {
+    case aov_normal:    return "_normal";
+    case aov_depth:     return "_depth";
+    case aov_albedo:    return "_albedo";
+    case aov_object_id: return "_id";
+    case aov_heatmap:   return "_spp";
+    default:            return "";
+    }
+}
+
+// Blue (few samples) to red (many samples) ramp for the adaptive sampling heatmap, t in [0, 1]
+inline color aov_heatmap_color(double t)
+{
+    t = (t < 0.0) ? 0.0 : (t > 1.0 ? 1.0 : t);
+
+    if (t < 0.5) {
+        double k = t / 0.5;
+        return color(0.0, k, 1.0 - k);
+    }
+
+    double k = (t - 0.5) / 0.5;
+    return color(k, 1.0 - k, 0.0);
+}
+
+// Stable pseudo-random color per object id so neighbouring ids are easy to tell apart
+inline color aov_id_color(int object_id)
+{
+    if (object_id < 0) return color(0.0, 0.0, 0.0);
+
+    uint32_t h = static_cast<uint32_t>(object_id) * 2654435761u;
+    h ^= h >> 16;
+    h *= 0x45d9f3bu;
+    h ^= h >> 16;
+
+    return color(
+        static_cast<double>((h >> 0) & 0xFF) / 255.0,
+        static_cast<double>((h >> 8) & 0xFF) / 255.0,
+        static_cast<double>((h >> 16) & 0xFF) / 255.0
+    );
+}
@@ -10,12 +10,12 @@ class box : public hittable {
 public:
     box() = default;
 
-    box(const point3& pmin, const point3& pmax, shared_ptr<material> mat, bool include_front_face = true)
+    box(const point3& pmin, const point3& pmax, material_id mat, bool include_front_face = true)
         : box_min(pmin), box_max(pmax)
     {
-        const double dx = box_max.x() - box_min.x();
-        const double dy = box_max.y() - box_min.y();
-        const double dz = box_max.z() - box_min.z();
+        const real dx = box_max.x() - box_min.x();
+        const real dy = box_max.y() - box_min.y();
+        const real dz = box_max.z() - box_min.z();
 
         // Sanity: degenerate box => no sides
         if (dx <= 0 || dy <= 0 || dz <= 0) return;
@@ -65,8 +65,20 @@ public:
         }
     }
 
-    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-        return sides.hit(r, ray_t, rec);
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        return sides.intersect(r, ray_t, rec);
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        return sides.occluded(r, ray_t);
+    }
+
+    const std::vector<shared_ptr<hittable>>* parts() const override {
+        return &sides.objects;
+    }
+
+    aabb bounding_box() const override {
+        return aabb(box_min, box_max);
     }
 
 private:
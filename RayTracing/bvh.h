@@ -0,0 +1,97 @@
+#pragma once
+#include <vector>
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "hittable.h"
+#include "bvh_build.h"
+// Pointer based bounding volume hierarchy over a set of hittables (see linear_bvh.h for the compiled form)
+    // binary tree of bounding boxes, a ray only visits the children whose box it passes through
+    // split positions are picked with the surface area heuristic (SAH)
+    // leaves are the original objects, each remembers its index in the source list for the object ID output
+
+class bvh_node : public hittable {
+public:
+    // Build over every object, object IDs are the objects' indices in this vector
+    explicit bvh_node(const std::vector<shared_ptr<hittable>>& objects)
+    {
+        if (objects.empty()) return;
+
+        std::vector<bvh_build::item> items = bvh_build::make_items(objects);
+        build(items, 0, items.size());
+    }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        if (!left || !bbox.hit(r, ray_t)) return false;
+
+        bool hit_left = hit_child(left, left_id, r, ray_t, rec);
+        if (right == left) return hit_left;
+
+        bool hit_right = hit_child(right, right_id, r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+        return hit_left || hit_right;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override
+    {
+        if (!left || !bbox.hit(r, ray_t)) return false;
+        return left->occluded(r, ray_t) || (right != left && right->occluded(r, ray_t));
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+private:
+    shared_ptr<hittable> left;
+    shared_ptr<hittable> right;
+    int left_id = -1;  // object ID when the child is a leaf, -1 for inner nodes
+    int right_id = -1;
+    aabb bbox = aabb::empty;
+
+    bvh_node() = default;
+
+    // Leaves may write to the record even when they miss, so they hit into a temporary like hittable_list does
+    static bool hit_child(const shared_ptr<hittable>& child, int id, const ray& r, interval ray_t, hit_record& rec)
+    {
+        if (id < 0) return child->intersect(r, ray_t, rec);
+
+        hit_record temp_rec;
+        if (!child->intersect(r, ray_t, temp_rec)) return false;
+
+        rec = temp_rec;
+        rec.object_id = id;
+        return true;
+    }
+
+    // Build the subtree over items [begin, end)
+    void build(std::vector<bvh_build::item>& items, size_t begin, size_t end)
+    {
+        const size_t count = end - begin;
+        bbox = bvh_build::range_bounds(items, begin, end);
+
+        if (count == 1)
+        {
+            left = right = items[begin].object;
+            left_id = right_id = items[begin].id;
+            return;
+        }
+
+        if (count == 2)
+        {
+            left = items[begin].object;
+            left_id = items[begin].id;
+            right = items[begin + 1].object;
+            right_id = items[begin + 1].id;
+            return;
+        }
+
+        const size_t mid = bvh_build::sah_split(items, begin, end);
+
+        shared_ptr<bvh_node> left_node(new bvh_node());
+        shared_ptr<bvh_node> right_node(new bvh_node());
+        left_node->build(items, begin, mid);
+        right_node->build(items, mid, end);
+
+        left = left_node;
+        right = right_node;
+    }
+};
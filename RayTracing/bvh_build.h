@@ -0,0 +1,479 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "hittable.h"
+#include "thread_pool.h"
+// Shared pieces of the BVH builders (bvh_node, linear_bvh and wide_bvh)
+    // objects are wrapped in build items with their box, centroid and object ID
+    // sah_split partitions a range of items with the surface area heuristic (full sweep)
+    // build_tree makes the binary tree linear_bvh and wide_bvh compile, with binned SAH splits and subtrees built in parallel
+
+namespace bvh_build {
+
+    struct item {
+        shared_ptr<hittable> object;
+        int id = -1;
+        aabb box;
+        point3 centroid;
+    };
+
+    // One item per object, IDs are the objects' indices
+    inline std::vector<item> make_items(const std::vector<shared_ptr<hittable>>& objects)
+    {
+        std::vector<item> items(objects.size());
+        for (size_t i = 0; i < objects.size(); ++i)
+        {
+            items[i].object = objects[i];
+            items[i].id = static_cast<int>(i);
+            items[i].box = objects[i]->bounding_box();
+            items[i].centroid = items[i].box.centroid();
+        }
+        return items;
+    }
+
+    inline aabb range_bounds(const std::vector<item>& items, size_t begin, size_t end)
+    {
+        aabb box = aabb::empty;
+        for (size_t i = begin; i < end; ++i)
+        {
+            box = aabb(box, items[i].box);
+        }
+        return box;
+    }
+
+    inline void sort_axis(std::vector<item>& items, size_t begin, size_t end, int axis)
+    {
+        std::sort(items.begin() + static_cast<std::ptrdiff_t>(begin), items.begin() + static_cast<std::ptrdiff_t>(end),
+            [axis](const item& a, const item& b) { return a.centroid[axis] < b.centroid[axis]; });
+    }
+
+    // Move the unbounded items of [begin, end) to its front (keeping their order), returns how many there are
+    inline size_t partition_unbounded(std::vector<item>& items, size_t begin, size_t end)
+    {
+        auto unbounded = [](const item& it) { return it.box.is_unbounded(); };
+        const std::vector<item>::iterator first = items.begin() + static_cast<std::ptrdiff_t>(begin);
+        const std::vector<item>::iterator last = items.begin() + static_cast<std::ptrdiff_t>(end);
+
+        if (std::none_of(first, last, unbounded)) return 0;
+        return static_cast<size_t>(std::stable_partition(first, last, unbounded) - first);
+    }
+
+    // Partition items [begin, end) (at least 2) at the split position with the lowest SAH cost and return it
+        // cost(k) = area(left k items) * k + area(right n - k items) * (n - k), the parent's area is a common factor
+        // unbounded items (infinite area) are split off on their own first so the bounded ones still get a real SAH split
+        // if every cost is still infinite the node falls back to a median split on the longest centroid axis
+        // cost (optional) receives the best split cost, infinity for the unbounded and median cases
+    inline size_t sah_split(std::vector<item>& items, size_t begin, size_t end, double* cost = nullptr)
+    {
+        const size_t count = end - begin;
+        double best_cost = std::numeric_limits<double>::infinity();
+        if (cost) *cost = best_cost;
+
+        const size_t unbounded = partition_unbounded(items, begin, end);
+        if (unbounded > 0 && unbounded < count) return begin + unbounded;
+
+        int best_axis = -1;
+        size_t best_split = 0;
+
+        std::vector<double> right_area(count);
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            sort_axis(items, begin, end, axis);
+
+            // Sweep from the right to get the area of every suffix
+            aabb acc = aabb::empty;
+            for (size_t k = count; k-- > 1;)
+            {
+                acc = aabb(acc, items[begin + k].box);
+                right_area[k] = acc.surface_area();
+            }
+
+            // Sweep from the left and evaluate every split
+            acc = aabb::empty;
+            for (size_t k = 1; k < count; ++k)
+            {
+                acc = aabb(acc, items[begin + k - 1].box);
+                double c = acc.surface_area() * static_cast<double>(k)
+                    + right_area[k] * static_cast<double>(count - k);
+
+                if (c < best_cost)
+                {
+                    best_cost = c;
+                    best_axis = axis;
+                    best_split = k;
+                }
+            }
+        }
+
+        if (best_axis < 0)
+        {
+            aabb centroids = aabb::empty;
+            for (size_t i = begin; i < end; ++i)
+            {
+                centroids = aabb(centroids, aabb(items[i].centroid, items[i].centroid));
+            }
+            best_axis = centroids.longest_axis();
+            best_split = count / 2;
+        }
+        else if (cost)
+        {
+            *cost = best_cost;
+        }
+
+        sort_axis(items, begin, end, best_axis);
+        return begin + best_split;
+    }
+
+    // Split items [begin, end) (at least 2) at the median centroid of the longest centroid axis, both halves get count / 2 or more
+    inline size_t median_split(std::vector<item>& items, size_t begin, size_t end)
+    {
+        aabb centroids = aabb::empty;
+        for (size_t i = begin; i < end; ++i)
+        {
+            centroids = aabb(centroids, aabb(items[i].centroid, items[i].centroid));
+        }
+        const int axis = centroids.longest_axis();
+        const size_t mid = begin + (end - begin) / 2;
+        std::nth_element(items.begin() + static_cast<std::ptrdiff_t>(begin), items.begin() + static_cast<std::ptrdiff_t>(mid),
+            items.begin() + static_cast<std::ptrdiff_t>(end),
+            [axis](const item& a, const item& b) { return a.centroid[axis] < b.centroid[axis]; });
+        return mid;
+    }
+
+    // Levels of median splits needed to cut count items down to leaves of at most max_leaf_size
+    inline int median_levels(size_t count, size_t max_leaf_size)
+    {
+        int levels = 0;
+        for (; count > max_leaf_size; count -= count / 2) ++levels;
+        return levels;
+    }
+
+    // Nearest floats at or below / at or above v, compiled trees store their bounds rounded outward with these
+    inline float float_below(double v)
+    {
+        float f = static_cast<float>(v);
+        return (static_cast<double>(f) > v) ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+    }
+
+    inline float float_above(double v)
+    {
+        float f = static_cast<float>(v);
+        return (static_cast<double>(f) < v) ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+    }
+
+    // Leaf test of the compiled trees: a small range stays a leaf unless splitting lowers its SAH cost
+        // traversal is cheap next to a primitive test (1/8 of one in SAH units)
+        // split_cost is the value sah_split reported, infinite costs always split
+    inline bool prefer_leaf(size_t count, double area, double split_cost, size_t max_leaf_size)
+    {
+        if (count <= 1) return true;
+        if (count > max_leaf_size || !std::isfinite(split_cost)) return false;
+        return static_cast<double>(count) * area <= 0.125 * area + split_cost;
+    }
+
+    // Axis along which the second child of a compiled node lies furthest above the first, picks the near child during traversal
+    inline int split_axis(const aabb& first, const aabb& second)
+    {
+        const vec3 gap = second.centroid() - first.centroid();
+        int best = 0;
+        for (int axis = 1; axis < 3; ++axis)
+        {
+            if (gap[axis] > gap[best]) best = axis;
+        }
+        return best;
+    }
+
+    // Deepest binary tree any builder makes, the compiled trees size their traversal stacks from it
+    constexpr int max_depth = 64;
+
+    // Binned SAH split of items [begin, end) (at least 2), same contract as sah_split
+        // centroids go into 32 bins per axis in one pass, the split is chosen between bins
+        // bins keep their bounds as plain min/max arrays so the growing loop vectorizes
+        // small ranges, where binning loses quality and saves nothing, use the full sweep
+    inline size_t binned_split(std::vector<item>& items, size_t begin, size_t end, double* cost = nullptr)
+    {
+        constexpr int bin_count = 32;
+        constexpr size_t sweep_limit = 16;
+
+        const size_t count = end - begin;
+        if (count <= sweep_limit) return sah_split(items, begin, end, cost);
+
+        double best_cost = std::numeric_limits<double>::infinity();
+        if (cost) *cost = best_cost;
+
+        const size_t unbounded = partition_unbounded(items, begin, end);
+        if (unbounded > 0 && unbounded < count) return begin + unbounded;
+
+        double c_lo[3], c_hi[3], scale[3];
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            c_lo[axis] = std::numeric_limits<double>::infinity();
+            c_hi[axis] = -std::numeric_limits<double>::infinity();
+        }
+        for (size_t i = begin; i < end; ++i)
+        {
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                c_lo[axis] = std::min<double>(c_lo[axis], items[i].centroid[axis]);
+                c_hi[axis] = std::max<double>(c_hi[axis], items[i].centroid[axis]);
+            }
+        }
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const double extent = c_hi[axis] - c_lo[axis];
+            scale[axis] = (extent > 0.0) ? bin_count / extent : 0.0;
+        }
+
+        struct bin {
+            double lo[3];
+            double hi[3];
+            size_t count;
+        };
+        bin bins[3][bin_count];
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            for (bin& b : bins[axis])
+            {
+                for (int k = 0; k < 3; ++k)
+                {
+                    b.lo[k] = std::numeric_limits<double>::infinity();
+                    b.hi[k] = -std::numeric_limits<double>::infinity();
+                }
+                b.count = 0;
+            }
+        }
+
+        auto bin_index = [&](const item& it, int axis)
+        {
+            const int b = static_cast<int>((it.centroid[axis] - c_lo[axis]) * scale[axis]);
+            return std::min(std::max(b, 0), bin_count - 1);
+        };
+
+        for (size_t i = begin; i < end; ++i)
+        {
+            const item& it = items[i];
+            const double lo[3] = { it.box.x.min, it.box.y.min, it.box.z.min };
+            const double hi[3] = { it.box.x.max, it.box.y.max, it.box.z.max };
+
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                bin& b = bins[axis][bin_index(it, axis)];
+                for (int k = 0; k < 3; ++k)
+                {
+                    b.lo[k] = std::min(b.lo[k], lo[k]);
+                    b.hi[k] = std::max(b.hi[k], hi[k]);
+                }
+                ++b.count;
+            }
+        }
+
+        auto area = [](const double* lo, const double* hi)
+        {
+            if (lo[0] > hi[0]) return 0.0;
+            const double dx = hi[0] - lo[0], dy = hi[1] - lo[1], dz = hi[2] - lo[2];
+            return 2.0 * (dx * dy + dy * dz + dz * dx);
+        };
+
+        int best_axis = -1;
+        int best_bin = 0;
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            if (scale[axis] == 0.0) continue;
+
+            // Suffix sweep for the right side of every bin boundary, then prefix sweep evaluating each one
+            double right_area[bin_count];
+            size_t right_count[bin_count];
+            double lo[3] = { std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity() };
+            double hi[3] = { -std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity() };
+            size_t n = 0;
+            for (int b = bin_count - 1; b > 0; --b)
+            {
+                for (int k = 0; k < 3; ++k)
+                {
+                    lo[k] = std::min(lo[k], bins[axis][b].lo[k]);
+                    hi[k] = std::max(hi[k], bins[axis][b].hi[k]);
+                }
+                n += bins[axis][b].count;
+                right_area[b] = area(lo, hi);
+                right_count[b] = n;
+            }
+
+            for (int k = 0; k < 3; ++k)
+            {
+                lo[k] = std::numeric_limits<double>::infinity();
+                hi[k] = -std::numeric_limits<double>::infinity();
+            }
+            n = 0;
+            for (int b = 1; b < bin_count; ++b)
+            {
+                for (int k = 0; k < 3; ++k)
+                {
+                    lo[k] = std::min(lo[k], bins[axis][b - 1].lo[k]);
+                    hi[k] = std::max(hi[k], bins[axis][b - 1].hi[k]);
+                }
+                n += bins[axis][b - 1].count;
+                if (n == 0 || right_count[b] == 0) continue;
+
+                const double c = area(lo, hi) * static_cast<double>(n) + right_area[b] * static_cast<double>(right_count[b]);
+                if (c < best_cost)
+                {
+                    best_cost = c;
+                    best_axis = axis;
+                    best_bin = b;
+                }
+            }
+        }
+
+        // Every centroid in one bin (or infinite costs): median split on the longest centroid axis
+        if (best_axis < 0) return median_split(items, begin, end);
+
+        if (cost) *cost = best_cost;
+
+        std::vector<item>::iterator split = std::partition(
+            items.begin() + static_cast<std::ptrdiff_t>(begin), items.begin() + static_cast<std::ptrdiff_t>(end),
+            [&](const item& it) { return bin_index(it, best_axis) < best_bin; });
+        return static_cast<size_t>(split - items.begin());
+    }
+
+    // Binary tree over a range of build items, the compiled trees flatten or collapse it
+    struct tree_node {
+        aabb box;
+        size_t begin = 0;
+        size_t end = 0;
+        std::unique_ptr<tree_node> child[2]; // both empty for leaves
+
+        bool is_leaf() const { return !child[0]; }
+    };
+
+    // Build the SAH tree over all items (reordering them), leaves hold at most max_leaf_size items
+        // subtrees with at least parallel_grain items are handed to a thread_pool, the calling thread keeps the other half
+        // threads receives the number of threads that took part
+    inline std::unique_ptr<tree_node> build_tree(std::vector<item>& items, size_t max_leaf_size, unsigned* threads = nullptr)
+    {
+        constexpr size_t parallel_grain = 4096;
+
+        std::unique_ptr<tree_node> root = std::make_unique<tree_node>();
+        if (threads) *threads = 1;
+        if (items.empty()) return root;
+
+        std::unique_ptr<thread_pool> pool;
+        const unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+        if (hw > 1 && items.size() >= 2 * parallel_grain)
+        {
+            pool = std::make_unique<thread_pool>(hw - 1);
+            if (threads) *threads = hw;
+        }
+
+        struct builder {
+            std::vector<item>& items;
+            size_t max_leaf_size;
+            thread_pool* pool;
+
+            void build(tree_node& node, size_t begin, size_t end, int depth, unsigned worker)
+            {
+                node.begin = begin;
+                node.end = end;
+                node.box = range_bounds(items, begin, end);
+
+                const size_t count = end - begin;
+                if (count <= 1 || depth >= max_depth) return;
+
+                // SAH splits can peel a single item off per level, so once median splits would only just reach
+                // max_leaf_size by max_depth the range is median split instead (the flattened trees store leaf sizes in 16 bits)
+                size_t mid = 0;
+                if (depth + median_levels(count, max_leaf_size) >= max_depth)
+                {
+                    if (count <= max_leaf_size) return;
+                    mid = median_split(items, begin, end);
+                }
+                else
+                {
+                    double split_cost = 0.0;
+                    mid = binned_split(items, begin, end, &split_cost);
+                    if (prefer_leaf(count, node.box.surface_area(), split_cost, max_leaf_size)) return;
+                }
+
+                node.child[0] = std::make_unique<tree_node>();
+                node.child[1] = std::make_unique<tree_node>();
+
+                tree_node* right = node.child[1].get();
+                if (pool && end - mid >= parallel_grain)
+                {
+                    pool->submit([this, right, mid, end, depth](unsigned w) { build(*right, mid, end, depth + 1, w); }, worker);
+                }
+                else
+                {
+                    build(*right, mid, end, depth + 1, worker);
+                }
+                build(*node.child[0], begin, mid, depth + 1, worker);
+            }
+        };
+
+        builder b{ items, max_leaf_size, pool.get() };
+        b.build(*root, 0, items.size(), 1, 0);
+        if (pool) pool->wait();
+
+        return root;
+    }
+
+    // Size and quality of a compiled tree, shown in the render settings
+        // sah_cost is the expected cost of a random ray through the tree, in primitive tests
+        // (each node visit counts 1/8, like the leaf heuristic), over the bounded part of the scene
+        // leaf_sizes[n] is the number of leaves holding n primitives
+    struct tree_stats {
+        double build_ms = 0.0;
+        unsigned threads = 1;
+        double sah_cost = 0.0;
+        int depth = 0;
+        size_t nodes = 0;
+        std::vector<size_t> leaf_sizes;
+
+        void add_node(const aabb& box, int node_depth)
+        {
+            ++nodes;
+            depth = std::max(depth, node_depth);
+            weighted_area(0.125, box);
+        }
+
+        void add_leaf(const aabb& box, size_t count)
+        {
+            if (leaf_sizes.size() <= count) leaf_sizes.resize(count + 1, 0);
+            ++leaf_sizes[count];
+            weighted_area(static_cast<double>(count), box);
+        }
+
+        // Divide by the area of the bounded scene once every node is in
+        void finish(const aabb& bounded_scene)
+        {
+            const double area = bounded_scene.surface_area();
+            sah_cost = (area > 0.0 && std::isfinite(area)) ? sah_cost / area : 0.0;
+        }
+
+    private:
+        void weighted_area(double weight, const aabb& box)
+        {
+            const double area = box.surface_area();
+            if (std::isfinite(area)) sah_cost += weight * area;
+        }
+    };
+
+    // Union of the bounded items, what tree_stats::finish normalizes by
+    inline aabb bounded_bounds(const std::vector<item>& items)
+    {
+        aabb box = aabb::empty;
+        for (const item& it : items)
+        {
+            if (!it.box.is_unbounded()) box = aabb(box, it.box);
+        }
+        return box;
+    }
+}
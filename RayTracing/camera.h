@@ -1,8 +1,15 @@
 #pragma once
 #include "rtweekend.h"
 #include "hittable.h"
+#include "hittable_list.h"
 #include "material.h"
+#include "tile_scheduler.h"
+#include "thread_pool.h"
+#include "aov.h"
+#include "image_writer.h"
+#include "checkpoint.h"
 
+#include <algorithm>
 #include <thread>
 #include <vector>
 #include <atomic>
@@ -11,19 +18,85 @@
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <sstream>
 #include <string>
-#include <functional>
+#include <utility>
 // Generates camera rays, performs path tracing, and writes the final image to PPM
     // also handles multithreaded rendering, progress display, and timing output
 
-// Settomgs/Config struct to be passed before rendering (not in use atm)
+// Part of a frame rendered by one process, parts are combined with camera::merge_shards
+    // rows renders image rows [begin, end) with every sample
+    // samples renders sample indices [begin, end) of every pixel, each sample seeded from its pixel and index
+    // so the parts add up to the same samples a single process would take
+struct render_shard {
+    enum class kind { none, rows, samples };
+
+    kind mode = kind::none;
+    int begin = 0;
+    int end = 0;
+};
+
+// Parse "rows:B:E" or "samples:B:E" into a shard, returns false on anything else
+inline bool parse_shard(const std::string& spec, render_shard& shard)
+{
+    std::istringstream in(spec);
+    std::string mode;
+    char sep = 0;
+
+    if (!std::getline(in, mode, ':')) return false;
+    if (!(in >> shard.begin >> sep >> shard.end) || sep != ':' || shard.end <= shard.begin || shard.begin < 0) return false;
+
+    // Nothing may follow the range ("rows:1:2:3" or "rows:0:10abc" would otherwise render [1, 2) or [0, 10))
+    in >> std::ws;
+    if (!in.eof()) return false;
+
+    if (mode == "rows") shard.mode = render_shard::kind::rows;
+    else if (mode == "samples") shard.mode = render_shard::kind::samples;
+    else return false;
+
+    return true;
+}
+
+// Settings/Config struct passed to camera::render
+    // image settings are copied onto the camera before rendering
+    // thread_count of 0 means one thread per hardware thread
+    // benchmark_both renders single threaded then multithreaded and reports the scaling between them
+    // tag prefixes the output file name
+    // adaptive sampling turns samples_per_pixel into a per-pixel maximum
+    // progressive renders in passes until a time budget or noise target is hit (0 disables either)
+    // output_format picks P6 (8 or 16-bit) or the original text P3
+    // stream_output writes finished rows to disk during the render instead of after it (single pass renders only)
+    // checkpoint_path (empty = off) saves the accumulation every checkpoint_interval_seconds and at the end,
+    // resume loads it first so the render adds samples on top (samples_per_pixel is the new per-pixel total)
+    // shard renders part of the frame into a raw partial file instead of images (see render_shard)
+    // every sample is seeded from its pixel and index, so the image never depends on threads, tiles or shards
 struct RenderConfig {
     int image_width = 500;
     double aspect_ratio = 16.0 / 9.0;
     int samples_per_pixel = 50;
     int max_depth = 10;
 
+    bool adaptive_sampling = false;
+    int min_samples_per_pixel = 16;
+    double adaptive_threshold = 0.01;
+
+    bool progressive = false;
+    int progressive_pass_spp = 4;
+    double time_budget_seconds = 0.0;
+    double target_noise = 0.0;
+
+    image_format output_format = image_format::ppm_binary;
+    bool stream_output = true;
+
+    std::string checkpoint_path;
+    double checkpoint_interval_seconds = 60.0;
+    bool resume = false;
+
+    render_shard shard;
+
     bool multithreaded = true;
     unsigned thread_count = 0;
 
@@ -32,6 +105,18 @@ struct RenderConfig {
    
 };
 
+// Timing and throughput of one render pass
+struct render_stats {
+    unsigned threads = 0;
+    double render_seconds = 0.0;
+    unsigned long long rays = 0;
+
+    double mrays_per_sec() const
+    {
+        return (render_seconds > 0.0) ? static_cast<double>(rays) / render_seconds / 1e6 : 0.0;
+    }
+};
+
 class camera {
 public:
     // Image/render settings
@@ -40,6 +125,57 @@ public:
     int samples_per_pixel = 50;
     int max_depth = 10;
 
+    // Adaptive sampling
+        // a pixel stops once the 95% confidence interval of its mean luminance is under
+        // adaptive_threshold relative to that mean (with a small floor so black pixels can finish)
+        // every pixel takes at least min_samples_per_pixel and at most samples_per_pixel
+    bool adaptive_sampling = false;
+    int min_samples_per_pixel = 16;
+    double adaptive_threshold = 0.01;
+
+    // Progressive rendering
+        // renders the whole image in passes of progressive_pass_spp and rewrites the outputs after every pass
+        // stops at samples_per_pixel, after time_budget_seconds, or once the image noise is under target_noise
+        // image noise is the mean relative confidence interval over all pixels (same measure as adaptive sampling),
+        // checked once pixels have min_samples_per_pixel samples
+    bool progressive = false;
+    int progressive_pass_spp = 4;
+    double time_budget_seconds = 0.0;
+    double target_noise = 0.0;
+
+    // Output file encoding
+        // stream_output encodes and writes bands of rows as their tiles finish so the write overlaps the render
+        // progressive renders rewrite whole images between passes and always write after the pass
+    image_format output_format = image_format::ppm_binary;
+    bool stream_output = true;
+
+    // Checkpoints
+        // the accumulated framebuffers, sample counts, camera and settings are saved to checkpoint_path
+        // every checkpoint_interval_seconds during the render and once when it finishes (empty path = off)
+        // with resume set a matching checkpoint is loaded first and samples_per_pixel becomes the new per-pixel total
+    std::string checkpoint_path;
+    double checkpoint_interval_seconds = 60.0;
+    bool resume = false;
+
+    // Sharding
+        // a shard writes its accumulation (checkpoint format, only its rows) to checkpoint_path,
+        // or Outputs/<name>_rows<B>-<E>.part / _samples<B>-<E>.part, and no images
+        // sample shards take samples_per_pixel = E - B and seed each sample with sample_seed(pixel, index) like every render
+    render_shard shard;
+
+    // Work scheduling (render splits the image into tile_size x tile_size blocks)
+    int tile_size = 16;
+    tile_order tiles_order = tile_order::morton;
+
+    // Packet tracing of camera rays
+        // 8 traces 4 x 2 pixel blocks and 16 traces 4 x 4 blocks as one packet per sample, anything else traces every ray alone
+        // packets are only built when the traced scene has a packet walk (hittable::traces_packets, today accelerator::compiled
+        // on AVX2 double builds), every other scene traces its camera rays alone whatever packet_size says
+        // only the first hit goes through the scene as a packet, the paths continue ray by ray
+        // the image is the same either way, except where a camera ray starts inside a shape whose hit depends on the ray interval
+        // (see compiled_scene::intersect_packet)
+    int packet_size = 8;
+
     // Camera transform/view settings
     double vfov = 20.0;
     point3 lookfrom = point3(13.0, 2.0, 3.0);
@@ -50,600 +186,1003 @@ public:
     double defocus_angle = 0.0;
     double focus_dist = 10.0;
 
-    // Render the entire image
-        // initialize camera geometry
-        // multithreaded render into framebuffer
-        // write framebuffer to PPM
+    // Render the entire image with the camera's image settings on every hardware thread
     void render(const hittable& world)
     {
-        initialize();
+        render(world, current_config());
+    }
 
-        namespace fs = std::filesystem;
+    // Render the entire image with explicit settings
+    void render(const hittable& world, const RenderConfig& config)
+    {
+        render_aovs<aov_beauty>(world, config);
+    }
 
-        // Output folder
-        fs::path outDir = fs::current_path() / "Outputs";
-        fs::create_directories(outDir);
+    // First-hit surface normals only (no path tracing)
+    void render_normals(const hittable& world)
+    {
+        render_aovs<aov_normal>(world, current_config());
+    }
 
-        // Number of worker threads (equal to number of threads on CPU)
-        const unsigned hw = std::max(1u, std::thread::hardware_concurrency());
-        const unsigned thread_count = hw;
+    // First-hit distance only (no path tracing)
+    void render_depth(const hittable& world)
+    {
+        render_aovs<aov_depth>(world, current_config());
+    }
 
-        // Filename "constructor"
-        std::ostringstream name;
-        name << "out_"
-            << image_width << "x" << image_height
-            << "_spp" << samples_per_pixel
-            << "_fd" << focus_dist
-            << "_thr" << hw
-            << ".ppm";
+    // Sum of ray_color over rays, the path tracing core without the tile loop and outputs around it (main.cpp --bench-ray-color)
+        // the scene is traced through the same accelerator a render would use
+    color_sum trace_paths(const hittable& world, const std::vector<ray>& rays, int depth)
+    {
+        accelerator_info info;
+        const hittable& traced = traced_world(world, info);
 
-        fs::path outPath = outDir / name.str();
+        color_sum sum(0.0, 0.0, 0.0);
+        for (const ray& r : rays) sum += color_sum(ray_color(r, depth, traced));
+        return sum;
+    }
 
-        // Render and write timer combined
-        std::chrono::steady_clock::time_point t_start = std::chrono::steady_clock::now();
+    // Render any combination of outputs (aov_flags) in a single pass over the scene
+        // copies the image settings from config onto the camera
+        // runs once on the configured thread count, or twice (1 thread vs N threads) when benchmarking
+    template <unsigned Aovs>
+    void render_aovs(const hittable& world, const RenderConfig& config)
+    {
+        static_assert(Aovs != 0 && (Aovs & ~static_cast<unsigned>(aov_all)) == 0, "render_aovs needs a non-empty set of aov_flags");
+
+        aspect_ratio = config.aspect_ratio;
+        image_width = config.image_width;
+        samples_per_pixel = config.samples_per_pixel;
+        max_depth = config.max_depth;
+        adaptive_sampling = config.adaptive_sampling;
+        min_samples_per_pixel = config.min_samples_per_pixel;
+        adaptive_threshold = config.adaptive_threshold;
+        progressive = config.progressive;
+        progressive_pass_spp = config.progressive_pass_spp;
+        time_budget_seconds = config.time_budget_seconds;
+        target_noise = config.target_noise;
+        output_format = config.output_format;
+        stream_output = config.stream_output;
+        checkpoint_path = config.checkpoint_path;
+        checkpoint_interval_seconds = config.checkpoint_interval_seconds;
+        resume = config.resume;
+        shard = config.shard;
+
+        // A sample shard takes exactly its own range of samples, adaptive stopping would make the parts depend on each other
+        if (shard.mode == render_shard::kind::samples)
+        {
+            samples_per_pixel = shard.end - shard.begin;
+            if (adaptive_sampling) {
+                std::cerr << "WARNING: Adaptive sampling is disabled for sample shards\n";
+            }
+            adaptive_sampling = false;
+        }
 
-        std::cerr << "========== Render Settings =========\n";
-        std::cerr << "Output: " << outPath.string() << "\n";
-        std::cerr << "Resolution: " << image_width << " x " << image_height << "\n";
-        std::cerr << "Samples/Pixel: " << samples_per_pixel << "\n";
-        std::cerr << "Threads: " << hw << "\n";
+        const unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+        const unsigned parallel_threads = (config.thread_count > 0) ? config.thread_count : hw;
+
+        if (!config.benchmark_both)
+        {
+            render_pass<Aovs>(world, config.tag, config.multithreaded ? parallel_threads : 1u);
+            return;
+        }
+
+        render_stats single = render_pass<Aovs>(world, config.tag, 1u);
+        render_stats multi = render_pass<Aovs>(world, config.tag, parallel_threads);
+
+        // Speedup is relative to the single threaded run, efficiency is speedup per thread
+        double speedup = (multi.render_seconds > 0.0) ? single.render_seconds / multi.render_seconds : 0.0;
+        double efficiency = speedup / static_cast<double>(multi.threads);
+
+        std::cerr << "============ Benchmark =============\n";
+        std::cerr << "Tag: " << config.tag << "\n";
+        std::cerr << std::fixed << std::setprecision(3);
+        std::cerr << "1 thread:   " << single.render_seconds << "s | "
+            << single.mrays_per_sec() << " Mrays/s\n";
+        std::cerr << multi.threads << " threads: " << multi.render_seconds << "s | "
+            << multi.mrays_per_sec() << " Mrays/s\n";
+        std::cerr << std::setprecision(2);
+        std::cerr << "Speedup:    " << speedup << "x\n";
+        std::cerr << "Efficiency: " << (100.0 * efficiency) << "%\n";
         std::cerr << "====================================\n";
+    }
 
-        // Framebuffer stores the accumulated linear color result for each pixel
-        // We write to file later in one pass through a single thread
-        std::vector<color> framebuffer(
-            static_cast<size_t>(image_width * image_height),
-            color(0.0, 0.0, 0.0)
-        );
+    // Combine shard partials (or checkpoints) of one frame into its final images
+        // every part must come from the same camera and settings, and no two parts may hold the same samples of a pixel
+        // images are named <tag>_<W>x<H>_spp<N>_merged with N the most samples any pixel received
+        // uses config.tag and config.output_format, returns false if a part is missing or doesn't fit
+    bool merge_shards(const std::vector<std::string>& parts, const RenderConfig& config)
+    {
+        namespace fs = std::filesystem;
 
-        std::atomic<int> next_row{ 0 }; // row index workers claim
-        std::atomic<int> rows_done{ 0 }; // progress display
+        if (parts.empty())
+        {
+            std::cerr << "ERROR: Nothing to merge\n";
+            return false;
+        }
 
-        std::chrono::steady_clock::time_point t_render_start = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point t_start = std::chrono::steady_clock::now();
 
-        // Each thread repeatedly claims one row and renders all pixels in that row in an attempt to balance uneven scenes
-        std::function<void()> worker = [&]() 
+        // Check every header before reading any pixels
+        std::vector<std::pair<checkpoint_header, fs::path>> headers;
+        for (const std::string& part : parts)
+        {
+            std::ifstream in(part, std::ios::in | std::ios::binary);
+            checkpoint_header header;
+            if (!in || !load_checkpoint_header(in, header))
             {
-                while (true)
+                std::cerr << "ERROR: " << part << " is not a render shard\n";
+                return false;
+            }
+
+            for (const std::pair<checkpoint_header, fs::path>& other : headers)
+            {
+                if (!checkpoint_same_frame(header, other.first))
                 {
-                    int j = next_row.fetch_add(1);
-                    if (j >= image_height) {
-                        break;
-                    }
+                    std::cerr << "ERROR: " << part << " and " << other.second.string() << " are from different frames\n";
+                    return false;
+                }
+                if (checkpoint_parts_overlap(header, other.first))
+                {
+                    std::cerr << "ERROR: " << part << " and " << other.second.string() << " overlap\n";
+                    return false;
+                }
+            }
 
-                    for (int i = 0; i < image_width; ++i)
-                    {
-                        color pixel_color(0.0, 0.0, 0.0);
+            headers.emplace_back(header, part);
+        }
 
-                        // Monte Carlo sampling per pixel
-                            // random repeated sampling to estimate values that are too expensive to calculate exactly
-                        for (int s = 0; s < samples_per_pixel; ++s)
-                        {
-                            ray r = get_ray(i, j);
-                            pixel_color += ray_color(r, max_depth, world);
-                        }
+        // Parts are added in sample order so the object id comes from each pixel's first sample
+        std::stable_sort(headers.begin(), headers.end(),
+            [](const std::pair<checkpoint_header, fs::path>& a, const std::pair<checkpoint_header, fs::path>& b)
+            {
+                return a.first.sample_begin < b.first.sample_begin;
+            });
 
-                        framebuffer[static_cast<size_t>(j * image_width + i)] = pixel_color;
-                    }
+        const checkpoint_header& frame = headers.front().first;
+        aov_buffers merged(frame.aovs, frame.pixel_count());
 
-                    rows_done.fetch_add(1);
-                }
-            };
+        std::cerr << "=============== Merge ==============\n";
+        for (const std::pair<checkpoint_header, fs::path>& part : headers)
+        {
+            checkpoint_header header;
+            aov_buffers buffers(0, 0);
+            if (!read_checkpoint(part.second, header, buffers))
+            {
+                std::cerr << "ERROR: Failed to read " << part.second.string() << "\n";
+                return false;
+            }
 
-        // Launch worker threads
-        std::vector<std::thread> threads;
-        threads.reserve(thread_count);
+            merge_checkpoint(merged, buffers, header);
+            std::cerr << "Part: " << part.second.string() << " | rows " << header.row_begin << " - " << header.row_end
+                << " | samples " << header.sample_begin << " - " << header.sample_end << "\n";
+        }
 
-        for (unsigned t = 0; t < thread_count; ++t)
+        int max_count = 0;
+        size_t empty_pixels = 0;
+        for (int n : merged.sample_count)
         {
-            threads.emplace_back(worker);
+            max_count = std::max(max_count, n);
+            if (n == 0) ++empty_pixels;
+        }
+        if (empty_pixels > 0) {
+            std::cerr << "WARNING: " << empty_pixels << " pixels have no samples, the parts don't cover the whole frame\n";
         }
 
-        // Progress printing state
-        std::chrono::steady_clock::time_point last_print = std::chrono::steady_clock::now();
+        // Write with the frame's own settings
+        image_width = frame.image_width;
+        image_height = frame.image_height;
+        samples_per_pixel = std::max(1, max_count);
+        output_format = config.output_format;
 
-        // ETA smoothing
-        double ema_rows_per_sec = 0.0;
-        bool ema_initialized = false;
+        fs::path outDir = fs::current_path() / "Outputs";
+        fs::create_directories(outDir);
 
-        const int ETA_MIN_ROWS = 25; // wait until enough work is done to start displaying ETA
-        const double ETA_MIN_SECS = 2.0; // enough time has elapsed to start displaying ETA
-        const double EMA_ALPHA = 0.15; // smoothing factor
+        std::ostringstream name;
+        name << config.tag << "_" << image_width << "x" << image_height << "_spp" << max_count << "_merged";
 
-        // Main thread monitors progress while workers render
-        while (rows_done.load() < image_height)
+        std::vector<std::pair<unsigned, fs::path>> outputs;
+        for (unsigned aov = aov_beauty; aov <= aov_object_id; aov <<= 1)
         {
-            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if (frame.aovs & aov) {
+                outputs.emplace_back(aov, outDir / (name.str() + aov_suffix(aov) + ".ppm"));
+            }
+        }
+        if (frame.adaptive_sampling) {
+            outputs.emplace_back(aov_heatmap, outDir / (name.str() + aov_suffix(aov_heatmap) + ".ppm"));
+        }
 
-            if (now - last_print >= std::chrono::milliseconds(150))
-            {
-                last_print = now;
+        write_outputs<aov_all>(outputs, merged);
 
-                int done = rows_done.load();
-                double pct = 100.0 * static_cast<double>(done) / static_cast<double>(image_height);
+        long long total_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t_start).count();
+        std::cerr << "Total:  " << format_time_ms(total_ms) << "\n";
+        std::cerr << "====================================\n";
+        for (const std::pair<unsigned, fs::path>& output : outputs)
+        {
+            std::cerr << "Done. Wrote: " << output.second.string() << "\n";
+        }
 
-                double elapsed =
-                    std::chrono::duration_cast<std::chrono::milliseconds>(now - t_render_start).count() / 1000.0;
+        return true;
+    }
 
-                double inst_rows_per_sec = (elapsed > 0.0)
-                    ? (static_cast<double>(done) / elapsed)
-                    : 0.0;
+private:
+    int image_height{};
 
-                if (!ema_initialized)
-                {
-                    ema_rows_per_sec = inst_rows_per_sec;
-                    ema_initialized = true;
-                }
-                else
-                {
-                    ema_rows_per_sec = EMA_ALPHA * inst_rows_per_sec
-                        + (1.0 - EMA_ALPHA) * ema_rows_per_sec;
-                }
+    // Worker threads live as long as the camera and are reused by every render call
+    std::shared_ptr<thread_pool> pool;
 
-                bool show_eta = (done >= ETA_MIN_ROWS)
-                    && (elapsed >= ETA_MIN_SECS)
-                    && (ema_rows_per_sec > 0.0);
+    // Materials of the scene being rendered (the hittable_list's table, nullptr for any other hittable)
+    const material_table* scene_materials = nullptr;
 
-                std::cerr << "\rRender: "
-                    << std::fixed << std::setprecision(1)
-                    << pct << "% (" << done << "/" << image_height << " rows) |";
+    // Accelerator built for a hittable_list that arrived without one
+    std::shared_ptr<hittable> scene_accel;
+    accelerator_info scene_accel_info;
+    const hittable* scene_accel_source = nullptr;
+    size_t scene_accel_objects = 0;
 
-                if (show_eta)
-                {
-                    int remaining_rows = image_height - done;
-                    double eta_sec = static_cast<double>(remaining_rows) / ema_rows_per_sec;
+    // Part of the frame the current render covers (set up by render_pass from shard)
+    int row_begin = 0;
+    int row_end = 0;
+    int sample_offset = 0;        // global index of each pixel's first sample
+    bool packets = false;         // packet_size asks for packets and the traced scene has a packet walk
+    point3 center;
+    point3 pixel00_loc;
 
-                    std::cerr << " Estimated Time Remaining: "
-                        << format_time_seconds(eta_sec) << " ";
-                }
-                else
-                {
-                    std::cerr << " Estimated Time Remaining: -- ";
-                }
+    vec3 pixel_delta_u;
+    vec3 pixel_delta_v;
 
-                std::cerr << "| Elapsed: " << format_time_seconds(elapsed);
-                std::cerr << "   " << std::flush;
-            }
+    vec3 u, v, w;
 
-            // Quick sleep to reduce amount we write to console
-            std::this_thread::sleep_for(std::chrono::milliseconds(25));
-        }
+    vec3 defocus_disk_u;
+    vec3 defocus_disk_v;
+
+    // Config matching the camera's own image settings, used by the overloads that don't take one
+    RenderConfig current_config() const
+    {
+        RenderConfig config;
+        config.image_width = image_width;
+        config.aspect_ratio = aspect_ratio;
+        config.samples_per_pixel = samples_per_pixel;
+        config.max_depth = max_depth;
+        config.adaptive_sampling = adaptive_sampling;
+        config.min_samples_per_pixel = min_samples_per_pixel;
+        config.adaptive_threshold = adaptive_threshold;
+        config.progressive = progressive;
+        config.progressive_pass_spp = progressive_pass_spp;
+        config.time_budget_seconds = time_budget_seconds;
+        config.target_noise = target_noise;
+        config.output_format = output_format;
+        config.stream_output = stream_output;
+        config.checkpoint_path = checkpoint_path;
+        config.checkpoint_interval_seconds = checkpoint_interval_seconds;
+        config.resume = resume;
+        config.shard = shard;
+        config.tag = "out";
+        return config;
+    }
 
-        // Wait for all worker threads to finish before writing output
-        for (std::thread& th : threads)
+    // Scene the render actually traces
+        // a hittable_list without an acceleration structure gets the default one (kept until the list changes)
+        // lists that built their own accelerator, and every other hittable, are traced as they are
+        // info receives what the render goes through, for the render settings
+        // also points scene_materials at the list's material table
+    const hittable& traced_world(const hittable& world, accelerator_info& info)
+    {
+        const hittable_list* list = dynamic_cast<const hittable_list*>(&world);
+        scene_materials = list ? &list->materials : nullptr;
+        if (!list)
         {
-            th.join();
+            info = accelerator_info();
+            return world;
         }
 
-        std::chrono::steady_clock::time_point t_render_end = std::chrono::steady_clock::now();
-
-        std::cerr << "\rRender: 100.0% (" << image_height << "/" << image_height
-            << " rows) | Estimated Time Remaining: 0m 0s   \n";
+        if (list->has_bvh() || list->objects.size() < 2)
+        {
+            info = list->accelerator_details();
+            return world;
+        }
 
-        // Open output file after rendering
-        std::ofstream out(outPath, std::ios::out | std::ios::trunc);
-        if (!out)
+        if (!scene_accel || scene_accel_source != list || scene_accel_objects != list->objects.size())
         {
-            std::cerr << "ERROR: Failed to open output file: " << outPath.string() << "\n";
-            return;
+            shared_ptr<scene_accelerator> built = make_shared<scene_accelerator>(list->objects, default_accelerator);
+            scene_accel_info = built->info();
+            scene_accel_info.name += " (built by camera)";
+            scene_accel = built;
+            scene_accel_source = list;
+            scene_accel_objects = list->objects.size();
         }
 
-        std::cerr << "Writing file...\n";
-        std::chrono::steady_clock::time_point t_write_start = std::chrono::steady_clock::now();
+        info = scene_accel_info;
+        return *scene_accel;
+    }
 
-        // PPM header stuff
-        out << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+    // Accelerator lines of the render settings: name, unbounded objects, build time and tree (or grid) quality
+    static void print_accelerator(const accelerator_info& info)
+    {
+        std::cerr << "Accelerator: " << info.name << "\n";
+        if (info.unbounded > 0) {
+            std::cerr << "Unbounded: " << info.unbounded << (info.clipped ? " clipped to the scene bounds\n" : " tested on every ray\n");
+        }
+        if (info.name == "None") return;
 
-        // Write framebuffer row by row
-        for (int j = 0; j < image_height; ++j)
+        std::cerr << std::fixed << std::setprecision(1);
+        if (info.has_grid_stats)
         {
-            for (int i = 0; i < image_width; ++i)
+            const grid_stats& grid = info.grid;
+            const double filled = static_cast<double>(grid.cells - grid.empty_cells);
+            std::cerr << "Grid build: " << info.stats.build_ms << " ms | ";
+            if (grid.cells == 0)
             {
-                write_color(out, framebuffer[static_cast<size_t>(j * image_width + i)]);
+                std::cerr << "no cells";
             }
-
-            // Update write progress every so often
-            if ((j % 10) == 0 || j == image_height - 1)
+            else
             {
-                double pct = 100.0 * static_cast<double>(j + 1) / static_cast<double>(image_height);
-                std::cerr << "\rWrite:  "
-                    << std::fixed << std::setprecision(1)
-                    << pct << "% (" << (j + 1) << "/" << image_height << " rows)   "
-                    << std::flush;
+                std::cerr << grid.resolution[0] << "x" << grid.resolution[1] << "x" << grid.resolution[2] << " cells";
+                if (grid.subgrids > 0) std::cerr << " + " << grid.subgrids << " subgrids";
+                std::cerr << " | " << std::setprecision(0) << 100.0 * static_cast<double>(grid.empty_cells) / static_cast<double>(grid.cells)
+                    << "% empty | " << std::setprecision(1) << (filled > 0.0 ? static_cast<double>(grid.references) / filled : 0.0) << " objects per filled cell";
             }
+            if (grid.large > 0) std::cerr << " | " << grid.large << " large tested on every ray";
+            std::cerr << "\n";
+            std::cerr.unsetf(std::ios::floatfield);
+            std::cerr << std::setprecision(6);
+            return;
         }
 
-        std::chrono::steady_clock::time_point t_write_end = std::chrono::steady_clock::now();
-        out.close();
-
-        std::cerr << "\rWrite:  100.0% (" << image_height << "/" << image_height << " rows)   \n";
-
-        long long render_ms =
-            std::chrono::duration_cast<std::chrono::milliseconds>(t_render_end - t_render_start).count();
-
-        long long write_ms =
-            std::chrono::duration_cast<std::chrono::milliseconds>(t_write_end - t_write_start).count();
-
-        long long total_ms =
-            std::chrono::duration_cast<std::chrono::milliseconds>(t_write_end - t_start).count();
+        std::cerr << "BVH build: " << info.stats.build_ms << " ms";
+        if (info.has_tree_stats)
+        {
+            std::cerr << " on " << info.stats.threads << (info.stats.threads == 1 ? " thread" : " threads")
+                << " | " << info.stats.nodes << " nodes | depth " << info.stats.depth
+                << " | SAH cost " << std::setprecision(2) << info.stats.sah_cost;
+        }
+        std::cerr << "\n";
+        std::cerr.unsetf(std::ios::floatfield);
+        std::cerr << std::setprecision(6);
 
-        std::cerr << "============= Timing ===============\n";
-        std::cerr << "Render: " << format_time_ms(render_ms) << "\n";
-        std::cerr << "Write:  " << format_time_ms(write_ms) << "\n";
-        std::cerr << "Total:  " << format_time_ms(total_ms) << "\n";
-        std::cerr << "====================================\n";
-        std::cerr << "Done. Wrote: " << outPath.string() << "\n";
+        if (info.has_tree_stats)
+        {
+            std::cerr << "BVH leaves:";
+            for (size_t n = 1; n < info.stats.leaf_sizes.size(); ++n)
+            {
+                if (info.stats.leaf_sizes[n] > 0) std::cerr << " " << n << ":" << info.stats.leaf_sizes[n];
+            }
+            std::cerr << " (primitives:leaves)\n";
+        }
     }
 
-    void render_normals(const hittable& world)
+    // Render the entire image once on the given number of threads
+        // initialize camera geometry
+        // multithreaded render of every requested output into its framebuffer
+        // write each framebuffer to its own PPM (streamed during the render when possible)
+    template <unsigned Aovs>
+    render_stats render_pass(const hittable& world, const std::string& tag, unsigned thread_count)
     {
         initialize();
 
+        accelerator_info accel_info;
+        const hittable& scene = traced_world(world, accel_info);
+
+        // Shard bounds, the whole frame and samples [0, samples_per_pixel) when not sharded
+        const bool sharded = shard.mode != render_shard::kind::none;
+        row_begin = 0;
+        row_end = image_height;
+        sample_offset = 0;
+        if (shard.mode == render_shard::kind::rows)
+        {
+            row_begin = std::max(0, std::min(shard.begin, image_height));
+            row_end = std::max(row_begin, std::min(shard.end, image_height));
+        }
+        if (shard.mode == render_shard::kind::samples) {
+            sample_offset = shard.begin;
+        }
+        packets = (packet_size == 8 || packet_size == 16) && scene.traces_packets();
+
         namespace fs = std::filesystem;
 
+        // Output folder
         fs::path outDir = fs::current_path() / "Outputs";
         fs::create_directories(outDir);
 
-        const unsigned hw = std::max(1u, std::thread::hardware_concurrency());
-        const unsigned thread_count = hw;
+        // Pool is rebuilt only when the requested thread count changes
+        const unsigned hw = worker_pool(thread_count).size();
 
+        render_stats stats;
+        stats.threads = hw;
+
+        // Filename "constructor" (every output appends its own suffix)
         std::ostringstream name;
-        name << "out_"
+        name << tag << "_"
             << image_width << "x" << image_height
             << "_spp" << samples_per_pixel
             << "_fd" << focus_dist
-            << "_thr" << hw
-            << ".ppm";
+            << "_thr" << hw;
+
+        const std::string base_name = name.str();
+        std::vector<std::pair<unsigned, fs::path>> outputs;
+        if (!sharded)
+        {
+            for (unsigned aov = aov_beauty; aov <= aov_object_id; aov <<= 1)
+            {
+                if (Aovs & aov) {
+                    outputs.emplace_back(aov, outDir / (base_name + aov_suffix(aov) + ".ppm"));
+                }
+            }
+            if (adaptive_sampling) {
+                outputs.emplace_back(aov_heatmap, outDir / (base_name + aov_suffix(aov_heatmap) + ".ppm"));
+            }
+        }
 
-        fs::path outPath = outDir / name.str();
+        // Shards write their partial accumulation as a checkpoint instead of images
+        fs::path checkpoint_file = checkpoint_path;
+        if (sharded && checkpoint_file.empty())
+        {
+            std::ostringstream part;
+            part << tag << "_" << image_width << "x" << image_height
+                << (shard.mode == render_shard::kind::rows ? "_rows" : "_samples")
+                << shard.begin << "-" << shard.end << ".part";
+            checkpoint_file = outDir / part.str();
+        }
 
-        auto t_start = std::chrono::steady_clock::now();
+        // Tiles are issued in space filling curve order so each worker traces neighbouring rays
+        tile_scheduler scheduler(image_width, image_height, tile_size, tiles_order, row_begin, row_end);
+
+        // Progressive renders revisit every pixel, so only single pass renders can write finished rows early
+        const bool streaming = stream_output && !progressive && !sharded;
+        const bool checkpointing = !checkpoint_file.empty();
+
+        // Render and write timer combined
+        std::chrono::steady_clock::time_point t_start = std::chrono::steady_clock::now();
 
         std::cerr << "========== Render Settings =========\n";
-        std::cerr << "Output: " << outPath.string() << "\n";
+        for (const std::pair<unsigned, fs::path>& output : outputs)
+        {
+            std::cerr << "Output: " << output.second.string() << "\n";
+        }
         std::cerr << "Resolution: " << image_width << " x " << image_height << "\n";
-        std::cerr << "Samples/Pixel: " << samples_per_pixel << "\n";
+        if (shard.mode == render_shard::kind::rows) {
+            std::cerr << "Shard: rows " << row_begin << " - " << row_end << "\n";
+        }
+        if (shard.mode == render_shard::kind::samples) {
+            std::cerr << "Shard: samples " << shard.begin << " - " << shard.end << "\n";
+        }
+        if (adaptive_sampling)
+        {
+            std::cerr << "Samples/Pixel: " << min_spp() << " - " << samples_per_pixel
+                << " (adaptive, threshold " << adaptive_threshold << ")\n";
+        }
+        else
+        {
+            std::cerr << "Samples/Pixel: " << samples_per_pixel << "\n";
+        }
+        if (progressive)
+        {
+            std::cerr << "Progressive: " << pass_spp() << " spp/pass";
+            if (time_budget_seconds > 0.0) std::cerr << " | budget " << time_budget_seconds << "s";
+            if (target_noise > 0.0) std::cerr << " | target noise " << target_noise;
+            std::cerr << "\n";
+        }
         std::cerr << "Threads: " << hw << "\n";
+        std::cerr << "Precision: " << (RT_REAL_IS_DOUBLE ? "double" : "float") << "\n";
+        std::cerr << "Tiles: " << scheduler.tile_size() << " x " << scheduler.tile_size() << "\n";
+        if (packets) {
+            std::cerr << "Packets: " << packet_width() << " x " << packet_height() << " camera rays\n";
+        }
+        else if (packet_size == 8 || packet_size == 16) {
+            std::cerr << "Packets: off, the accelerator traces rays one at a time\n";
+        }
+        print_accelerator(accel_info);
+        if (streaming) {
+            std::cerr << "Streaming: " << scheduler.tile_size() << " row bands\n";
+        }
+        if (checkpointing) {
+            std::cerr << "Checkpoint: " << checkpoint_file.string() << " (every " << checkpoint_interval_seconds << "s)\n";
+        }
         std::cerr << "====================================\n";
 
-        std::vector<color> framebuffer(image_width * image_height, color(0, 0, 0));
+        // Framebuffers store the accumulated (summed) value of each output for each pixel
+        // Workers copy finished tiles in, then either stream them out by band or we encode and write each file after the render
+        aov_buffers buffers(Aovs, static_cast<size_t>(image_width * image_height));
+
+        // Resume adds samples on top of a matching checkpoint's accumulation
+        const checkpoint_header ckpt_state = checkpoint_state(Aovs);
+        const size_t region_begin = ckpt_state.region_begin();
+        const size_t region_end = region_begin + ckpt_state.region_count();
+        int resumed_spp = 0; // fewest samples any pixel already has
+        if (checkpointing && resume)
+        {
+            checkpoint_header saved;
+            if (load_checkpoint(checkpoint_file, ckpt_state, saved, buffers) && region_end > region_begin)
+            {
+                std::vector<int>::const_iterator first = buffers.sample_count.begin() + static_cast<std::ptrdiff_t>(region_begin);
+                std::vector<int>::const_iterator last = buffers.sample_count.begin() + static_cast<std::ptrdiff_t>(region_end);
+
+                long long total_samples = 0;
+                for (std::vector<int>::const_iterator it = first; it != last; ++it) total_samples += *it;
+                resumed_spp = std::min(samples_per_pixel, *std::min_element(first, last));
 
-        std::atomic<int> next_row{ 0 };
-        std::atomic<int> rows_done{ 0 };
+                std::cerr << "Resumed: " << checkpoint_file.string() << " | " << std::fixed << std::setprecision(1)
+                    << static_cast<double>(total_samples) / static_cast<double>(region_end - region_begin)
+                    << " avg spp (saved target " << saved.samples_per_pixel << ")\n";
+            }
+        }
 
-        auto t_render_start = std::chrono::steady_clock::now();
+        // Workers hold this shared while copying a tile into the framebuffers, checkpoints take it exclusively to snapshot them
+        std::shared_mutex store_mutex;
+        std::chrono::steady_clock::time_point last_checkpoint = std::chrono::steady_clock::now();
 
-        auto worker = [&]()
+        auto save_snapshot = [&]()
             {
-                while (true)
+                aov_buffers snapshot(0, 0);
                 {
-                    int j = next_row.fetch_add(1);
-                    if (j >= image_height) break;
+                    std::unique_lock<std::shared_mutex> lock(store_mutex);
+                    snapshot = buffers;
+                }
+                save_checkpoint(checkpoint_file, ckpt_state, snapshot);
+                last_checkpoint = std::chrono::steady_clock::now();
+            };
 
-                    for (int i = 0; i < image_width; ++i)
-                    {
-                        color pixel_color(0, 0, 0);
-                        ray r = get_ray(i, j);
+        auto checkpoint_due = [&]()
+            {
+                return checkpointing && checkpoint_interval_seconds > 0.0
+                    && std::chrono::duration<double>(std::chrono::steady_clock::now() - last_checkpoint).count() >= checkpoint_interval_seconds;
+            };
 
-                        for (int s = 0; s < samples_per_pixel; ++s)
-                        {
-                            pixel_color += ray_normal(r, max_depth, world);
-                        }
+        // One stream per output, bands are as tall as the tiles so every tile lands in exactly one band
+        std::vector<std::unique_ptr<image_stream_writer>> streams;
+        if (streaming)
+        {
+            for (const std::pair<unsigned, fs::path>& output : outputs)
+            {
+                streams.push_back(std::make_unique<image_stream_writer>(
+                    output.second, output_format, image_width, image_height, scheduler.tile_size(), output_pixel(output.first, buffers)));
+            }
+        }
 
-                        pixel_color = color(abs(pixel_color.x()), abs(pixel_color.y()), abs(pixel_color.z()));
-                        framebuffer[j * image_width + i] = pixel_color;
-                    }
+        std::chrono::steady_clock::time_point t_render_start = std::chrono::steady_clock::now();
 
-                    rows_done.fetch_add(1);
-                }
-            };
+        // Progressive renders must not outlive their time slot, a pass that hits the deadline leaves the remaining pixels as they were
+        const bool has_deadline = progressive && time_budget_seconds > 0.0;
+        const std::chrono::steady_clock::time_point deadline = t_render_start
+            + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(time_budget_seconds));
 
-        std::vector<std::thread> threads;
-        threads.reserve(thread_count);
-        for (unsigned t = 0; t < thread_count; ++t)
-            threads.emplace_back(worker);
+        // Monte Carlo sampling per pixel
+            // random repeated sampling to estimate values that are too expensive to calculate exactly
+            // every sample feeds all requested outputs from the same camera ray
+            // adaptive renders stop a pixel early once its estimate has converged
+            // non progressive renders are a single pass of samples_per_pixel
+        const int min_samples = min_spp();
+        const int samples_per_pass = progressive ? pass_spp() : samples_per_pixel;
 
-        auto last_print = std::chrono::steady_clock::now();
+        int pass = 0;
+        int pass_target = resumed_spp; // samples every unconverged pixel should have after this pass
 
-        double ema_rows_per_sec = 0.0;
-        bool ema_initialized = false;
+        while (true)
+        {
+            std::chrono::steady_clock::time_point t_pass_start = std::chrono::steady_clock::now();
+            pass_target = std::min(samples_per_pixel, pass_target + samples_per_pass);
 
-        const int ETA_MIN_ROWS = 25;
-        const double ETA_MIN_SECS = 2.0;
-        const double EMA_ALPHA = 0.15;
+            stats.rays += render_tiles<aov_pixel>(scheduler, store_mutex,
+                [&](const tile& block, aov_pixel* out, int stride)
+                {
+                    for (int j = block.y0; j < block.y1; ++j)
+                    {
+                        for (int i = block.x0; i < block.x1; ++i)
+                        {
+                            out[(j - block.y0) * stride + (i - block.x0)] = buffers.template load<Aovs>(static_cast<size_t>(j * image_width + i));
+                        }
+                    }
 
-        while (rows_done.load() < image_height) {
-            auto now = std::chrono::steady_clock::now();
-            if (now - last_print >= std::chrono::milliseconds(150))
-            {
-                last_print = now;
+                    // The first pass always finishes so every pixel has at least one pass of samples
+                    if (pass > 0 && has_deadline && std::chrono::steady_clock::now() >= deadline) {
+                        return;
+                    }
 
-                int done = rows_done.load();
-                double pct = 100.0 * (double)done / (double)image_height;
+                    auto wants_sample = [&](const aov_pixel& px)
+                        {
+                            return px.samples < pass_target && !(adaptive_sampling && px.samples >= min_samples && converged(px));
+                        };
 
-                double elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - t_render_start).count() / 1000.0;
+                    if (block.pixel_count() > 1)
+                    {
+                        trace_packets<Aovs>(block, out, stride, scene, wants_sample);
+                        return;
+                    }
 
-                double inst_rows_per_sec = (elapsed > 0.0) ? (done / elapsed) : 0.0;
+                    aov_pixel& px = out[0];
+                    const size_t index = static_cast<size_t>(block.y0 * image_width + block.x0);
+                    while (wants_sample(px))
+                    {
+                        seed_random(sample_seed(index, static_cast<uint64_t>(sample_offset + px.samples)));
 
-                if (!ema_initialized)
+                        ray r = get_ray(block.x0, block.y0);
+                        color c = trace_sample<Aovs>(r, scene, px);
+                        px.beauty += color_sum(c);
+                        px.add_sample(luminance(c));
+                    }
+                },
+                [&](size_t index, const aov_pixel& px)
                 {
-                    ema_rows_per_sec = inst_rows_per_sec;
-                    ema_initialized = true;
-                }
-                else
+                    buffers.template store<Aovs>(index, px);
+                },
+                [&](const tile& t)
                 {
-                    ema_rows_per_sec = EMA_ALPHA * inst_rows_per_sec + (1.0 - EMA_ALPHA) * ema_rows_per_sec;
-                }
+                    for (std::unique_ptr<image_stream_writer>& stream : streams) stream->tile_done(t);
+                },
+                [&]()
+                {
+                    for (std::unique_ptr<image_stream_writer>& stream : streams) stream->flush();
+                    if (checkpoint_due()) save_snapshot();
+                });
 
-                bool show_eta = (done >= ETA_MIN_ROWS) && (elapsed >= ETA_MIN_SECS) && (ema_rows_per_sec > 0.0);
+            ++pass;
+            if (!progressive) break;
 
-                std::cerr << "\rRender: " << std::fixed << std::setprecision(1)
-                    << pct << "% (" << done << "/" << image_height << " rows)";
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            double pass_seconds = std::chrono::duration<double>(now - t_pass_start).count();
+            double elapsed = std::chrono::duration<double>(now - t_render_start).count();
+            double noise = image_noise(buffers, region_begin, region_end);
 
-                if (show_eta)
-                {
-                    int remaining_rows = image_height - done;
-                    double eta_sec = remaining_rows / ema_rows_per_sec;
+            std::cerr << "Pass " << pass << ": " << pass_target << " spp | noise "
+                << std::fixed << std::setprecision(4) << noise
+                << " | Elapsed: " << format_time_seconds(elapsed) << "\n";
 
-                    int eta_int = (int)(eta_sec + 0.5);
-                    int eta_min = eta_int / 60;
-                    int eta_rem = eta_int % 60;
+            // Stop when out of samples, quiet enough, or the next pass would overrun the budget
+                // the noise estimate is only trusted once pixels have min_samples_per_pixel samples
+            bool done = pass_target >= samples_per_pixel
+                || (target_noise > 0.0 && pass_target >= min_samples && noise <= target_noise)
+                || (has_deadline && elapsed + pass_seconds > time_budget_seconds);
 
-                    std::cerr << "  ETA: " << format_time_seconds(eta_sec) << " ";
-                }
-                else
-                {
-                    std::cerr << "  ETA: -- ";
-                }
-                std::cerr << "Elapsed: " << format_time_seconds(elapsed);
-                std::cerr << "   " << std::flush;
-            }
+            if (done) break;
 
-            std::this_thread::sleep_for(std::chrono::milliseconds(25));
+            // Keep a valid image on disk between passes in case the job is cut off
+            write_outputs<Aovs>(outputs, buffers);
+            if (checkpoint_due()) save_snapshot();
         }
 
-        for (auto& th : threads) th.join();
+        std::chrono::steady_clock::time_point t_render_end = std::chrono::steady_clock::now();
+        stats.render_seconds = std::chrono::duration<double>(t_render_end - t_render_start).count();
 
-        auto t_render_end = std::chrono::steady_clock::now();
-        std::cerr << "\rRender: 100.0% (" << image_height << "/" << image_height
-            << " rows)  ETA: 0m 0s   \n";
+        std::cerr << "Writing file...\n";
+        std::chrono::steady_clock::time_point t_write_start = std::chrono::steady_clock::now();
 
-        std::ofstream out(outPath, std::ios::out | std::ios::trunc);
-        if (!out)
+        if (streaming)
         {
-            std::cerr << "ERROR: Failed to open output file: " << outPath.string() << "\n";
-            return;
+            // Most bands are already on disk, this only writes the tail
+            for (std::unique_ptr<image_stream_writer>& stream : streams) stream->finish();
         }
-
-        std::cerr << "Writing file...\n";
-        auto t_write_start = std::chrono::steady_clock::now();
-
-        out << "P3\n" << image_width << ' ' << image_height << "\n255\n";
-
-        for (int j = 0; j < image_height; ++j)
+        else
         {
-            for (int i = 0; i < image_width; ++i)
-            {
-                write_color(out, framebuffer[j * image_width + i]);
-            }
+            write_outputs<Aovs>(outputs, buffers);
+        }
 
-            if ((j % 10) == 0 || j == image_height - 1)
-            {
-                double pct = 100.0 * (double)(j + 1) / (double)image_height;
-                std::cerr << "\rWrite:  " << std::fixed << std::setprecision(1)
-                    << pct << "% (" << (j + 1) << "/" << image_height << " rows)   "
-                    << std::flush;
-            }
+        // Final checkpoint so the render can be refined later
+        if (checkpointing) {
+            save_checkpoint(checkpoint_file, ckpt_state, buffers);
         }
 
-        auto t_write_end = std::chrono::steady_clock::now();
-        out.close();
+        std::chrono::steady_clock::time_point t_write_end = std::chrono::steady_clock::now();
+
+        long long render_ms =
+            std::chrono::duration_cast<std::chrono::milliseconds>(t_render_end - t_render_start).count();
 
-        std::cerr << "\rWrite:  100.0% (" << image_height << "/" << image_height << " rows)   \n";
+        long long write_ms =
+            std::chrono::duration_cast<std::chrono::milliseconds>(t_write_end - t_write_start).count();
 
-        auto render_ms = std::chrono::duration_cast<std::chrono::milliseconds>(t_render_end - t_render_start).count();
-        auto write_ms = std::chrono::duration_cast<std::chrono::milliseconds>(t_write_end - t_write_start).count();
-        auto total_ms = std::chrono::duration_cast<std::chrono::milliseconds>(t_write_end - t_start).count();
+        long long total_ms =
+            std::chrono::duration_cast<std::chrono::milliseconds>(t_write_end - t_start).count();
 
         std::cerr << "============= Timing ===============\n";
         std::cerr << "Render: " << format_time_ms(render_ms) << "\n";
         std::cerr << "Write:  " << format_time_ms(write_ms) << "\n";
         std::cerr << "Total:  " << format_time_ms(total_ms) << "\n";
+        if (adaptive_sampling || progressive)
+        {
+            long long total_samples = 0;
+            for (size_t k = region_begin; k < region_end; ++k) total_samples += buffers.sample_count[k];
+
+            std::cerr << "Average Samples/Pixel: " << std::fixed << std::setprecision(1)
+                << static_cast<double>(total_samples) / static_cast<double>(std::max<size_t>(1, region_end - region_begin)) << "\n";
+        }
         std::cerr << "====================================\n";
-        std::cerr << "Done. Wrote: " << outPath.string() << "\n";
+        for (const std::pair<unsigned, fs::path>& output : outputs)
+        {
+            std::cerr << "Done. Wrote: " << output.second.string() << "\n";
+        }
+        if (sharded) {
+            std::cerr << "Done. Wrote: " << checkpoint_file.string() << "\n";
+        }
+        else if (checkpointing) {
+            std::cerr << "Done. Checkpoint: " << checkpoint_file.string() << "\n";
+        }
+
+        return stats;
     }
 
-    void render_depth(const hittable& world)
+    // Write every requested output from the accumulated framebuffers
+    template <unsigned Aovs>
+    void write_outputs(const std::vector<std::pair<unsigned, std::filesystem::path>>& outputs, const aov_buffers& buffers)
     {
-        initialize();
+        for (const std::pair<unsigned, std::filesystem::path>& output : outputs)
+        {
+            write_image(output.second, output_pixel(output.first, buffers));
+        }
+    }
 
-        namespace fs = std::filesystem;
+    // Final linear color of pixel k for one output
+        // every output is averaged by its pixel's own sample count
+    image_stream_writer::pixel_fn output_pixel(unsigned aov, const aov_buffers& buffers) const
+    {
+        const aov_buffers* b = &buffers;
+        auto scale = [b](size_t k) { return 1.0 / static_cast<double>(std::max(1, b->sample_count[k])); };
 
-        fs::path outDir = fs::current_path() / "Outputs";
-        fs::create_directories(outDir);
+        switch (aov)
+        {
+        case aov_normal:
+            return [b, scale](size_t k)
+                {
+                    const color_sum& n = b->normal[k];
+                    return color(scale(k) * color_sum(std::fabs(n.x()), std::fabs(n.y()), std::fabs(n.z())));
+                };
+        case aov_depth:
+            return [b, scale](size_t k)
+                {
+                    double d = scale(k) * b->depth[k];
+                    return color(d, d, d);
+                };
+        case aov_albedo:
+            return [b, scale](size_t k) { return color(scale(k) * b->albedo[k]); };
+        case aov_object_id:
+            return [b](size_t k) { return aov_id_color(b->object_id[k]); };
+        case aov_heatmap:
+        {
+            // Heatmap is already in display space, square it so the writer's gamma leaves the ramp as is
+            const double max_spp = static_cast<double>(samples_per_pixel);
+            return [b, max_spp](size_t k)
+                {
+                    color c = aov_heatmap_color(static_cast<double>(b->sample_count[k]) / max_spp);
+                    return c * c;
+                };
+        }
+        default:
+            return [b, scale](size_t k) { return color(scale(k) * b->beauty[k]); };
+        }
+    }
 
-        const unsigned hw = std::max(1u, std::thread::hardware_concurrency());
-        const unsigned thread_count = hw;
+    // Camera and settings recorded in (and checked against) checkpoints
+    checkpoint_header checkpoint_state(unsigned aovs) const
+    {
+        checkpoint_header h;
+        h.aovs = aovs;
+        h.image_width = image_width;
+        h.image_height = image_height;
+        h.max_depth = max_depth;
+        h.samples_per_pixel = samples_per_pixel;
+
+        h.row_begin = row_begin;
+        h.row_end = row_end;
+        h.sample_begin = sample_offset;
+        h.sample_end = sample_offset + samples_per_pixel;
+        h.deterministic = 1;
+
+        h.vfov = vfov;
+        for (int k = 0; k < 3; ++k)
+        {
+            h.lookfrom[k] = lookfrom[k];
+            h.lookat[k] = lookat[k];
+            h.vup[k] = vup[k];
+        }
+        h.defocus_angle = defocus_angle;
+        h.focus_dist = focus_dist;
 
-        std::ostringstream name;
-        name << "out_"
-            << image_width << "x" << image_height
-            << "_spp" << samples_per_pixel
-            << "_fd" << focus_dist
-            << "_thr" << hw
-            << ".ppm";
+        h.adaptive_sampling = adaptive_sampling ? 1 : 0;
+        h.min_samples_per_pixel = min_samples_per_pixel;
+        h.adaptive_threshold = adaptive_threshold;
+        return h;
+    }
 
-        fs::path outPath = outDir / name.str();
+    // Samples per progressive pass, clamped to [1, samples_per_pixel]
+    int pass_spp() const
+    {
+        return std::max(1, std::min(progressive_pass_spp, samples_per_pixel));
+    }
 
-        auto t_start = std::chrono::steady_clock::now();
+    // Mean relative confidence interval over pixels [begin, end), lower is cleaner
+    double image_noise(const aov_buffers& buffers, size_t begin, size_t end) const
+    {
+        double total = 0.0;
+        for (size_t k = begin; k < end; ++k)
+        {
+            aov_pixel px;
+            px.samples = buffers.sample_count[k];
+            px.lum_mean = buffers.lum_mean[k];
+            px.lum_m2 = buffers.lum_m2[k];
 
-        std::cerr << "========== Render Settings =========\n";
-        std::cerr << "Output: " << outPath.string() << "\n";
-        std::cerr << "Resolution: " << image_width << " x " << image_height << "\n";
-        std::cerr << "Samples/Pixel: " << samples_per_pixel << "\n";
-        std::cerr << "Threads: " << hw << "\n";
-        std::cerr << "====================================\n";
+            double error = px.relative_error();
+            if (std::isinf(error)) return error;
 
-        std::vector<color> framebuffer(image_width * image_height, color(0, 0, 0));
+            total += error;
+        }
+        return total / static_cast<double>(std::max<size_t>(1, end - begin));
+    }
 
-        std::atomic<int> next_row{ 0 };
-        std::atomic<int> rows_done{ 0 };
+    // Adaptive sampling bounds, clamped to [1, samples_per_pixel]
+    int min_spp() const
+    {
+        return std::max(1, std::min(min_samples_per_pixel, samples_per_pixel));
+    }
 
-        auto t_render_start = std::chrono::steady_clock::now();
+    // Pixel has converged once the confidence interval of its mean luminance is under the relative threshold
+    bool converged(const aov_pixel& px) const
+    {
+        return px.relative_error() <= adaptive_threshold;
+    }
 
-        auto worker = [&]()
-            {
-                while (true)
-                {
-                    int j = next_row.fetch_add(1);
-                    if (j >= image_height) break;
+    // Write one image in the configured output format
+        // pixel(k) returns the final linear color of pixel k (already averaged)
+    template <typename PixelFn>
+    bool write_image(const std::filesystem::path& outPath, const PixelFn& pixel)
+    {
+        return write_image_file(outPath, output_format, image_width, image_height, pixel, &worker_pool());
+    }
 
-                    for (int i = 0; i < image_width; ++i)
-                    {
-                        color pixel_color(0, 0, 0);
-                        ray r = get_ray(i, j);
+    // Shared worker pool
+        // thread_count of 0 reuses the current pool (or creates one per hardware thread)
+        // any other count rebuilds the pool only if its size differs
+    thread_pool& worker_pool(unsigned thread_count = 0)
+    {
+        if (!pool || (thread_count > 0 && pool->size() != thread_count)) {
+            pool.reset();
+            pool = std::make_shared<thread_pool>(thread_count);
+        }
+        return *pool;
+    }
 
-                        for (int s = 0; s < samples_per_pixel; ++s)
-                        {
-                            pixel_color += ray_depth(r, max_depth, world);
-                        }
+    // Per-thread count of rays traced by ray_color, summed per tile for throughput stats
+    static unsigned long long& thread_ray_count()
+    {
+        static thread_local unsigned long long count = 0;
+        return count;
+    }
+
+    // Render every tile on the worker pool while this thread prints progress
+        // tiles are shaded in blocks of packet_width() x packet_height() pixels (single pixels without packets)
+        // shade(block, out, stride) fills the accumulated Pixel of every pixel in the block, pixel (i, j) at out[(j - y0) * stride + i - x0]
+        // each worker fills a local tile buffer, store(index, pixel) copies it into the framebuffers once the tile is finished
+        // store_mutex is held shared while a tile is copied into the framebuffers
+        // tile_done(tile) runs on the worker right after the tile is stored
+        // idle() runs on this thread between progress updates
+        // returns the number of rays traced
+    template <typename Pixel, typename ShadeFn, typename StoreFn, typename TileDoneFn, typename IdleFn>
+    unsigned long long render_tiles(const tile_scheduler& scheduler, std::shared_mutex& store_mutex, const ShadeFn& shade, const StoreFn& store,
+        const TileDoneFn& tile_done, const IdleFn& idle)
+    {
+        thread_pool& workers = worker_pool();
+        const int tile_count = scheduler.tile_count();
+        const int block_width = packet_width();
+        const int block_height = packet_height();
+
+        std::vector<std::vector<Pixel>> tile_accum(
+            workers.size(),
+            std::vector<Pixel>(static_cast<size_t>(scheduler.tile_size() * scheduler.tile_size()))
+        );
 
-                        //pixel_color = color(abs(pixel_color.x()), abs(pixel_color.y()), abs(pixel_color.z()));
-                        framebuffer[j * image_width + i] = pixel_color;
+        std::atomic<int> tiles_done{ 0 }; // progress display
+        std::atomic<unsigned long long> rays_traced{ 0 };
+
+        std::chrono::steady_clock::time_point t_render_start = std::chrono::steady_clock::now();
+
+        workers.submit_range(tile_count, [&](int index, unsigned worker)
+            {
+                const tile& t = scheduler[index];
+                std::vector<Pixel>& accum = tile_accum[worker];
+                const unsigned long long rays_before = thread_ray_count();
+
+                for (int y = t.y0; y < t.y1; y += block_height)
+                {
+                    for (int x = t.x0; x < t.x1; x += block_width)
+                    {
+                        const tile block{ x, y, std::min(x + block_width, t.x1), std::min(y + block_height, t.y1) };
+                        shade(block, &accum[static_cast<size_t>((y - t.y0) * t.width() + (x - t.x0))], t.width());
                     }
+                }
 
-                    rows_done.fetch_add(1);
+                std::shared_lock<std::shared_mutex> lock(store_mutex);
+                for (int j = t.y0; j < t.y1; ++j)
+                {
+                    for (int i = t.x0; i < t.x1; ++i)
+                    {
+                        store(static_cast<size_t>(j * image_width + i), accum[static_cast<size_t>((j - t.y0) * t.width() + (i - t.x0))]);
+                    }
                 }
-            };
 
-        std::vector<std::thread> threads;
-        threads.reserve(thread_count);
-        for (unsigned t = 0; t < thread_count; ++t)
-            threads.emplace_back(worker);
+                lock.unlock();
+                tile_done(t);
 
-        auto last_print = std::chrono::steady_clock::now();
+                rays_traced.fetch_add(thread_ray_count() - rays_before);
+                tiles_done.fetch_add(1);
+            });
+
+        // Progress printing state
+        std::chrono::steady_clock::time_point last_print = std::chrono::steady_clock::now();
 
-        double ema_rows_per_sec = 0.0;
+        // ETA smoothing
+        double ema_tiles_per_sec = 0.0;
         bool ema_initialized = false;
 
-        const int ETA_MIN_ROWS = 25;
-        const double ETA_MIN_SECS = 2.0;
-        const double EMA_ALPHA = 0.15;
+        const int ETA_MIN_TILES = 25; // wait until enough work is done to start displaying ETA
+        const double ETA_MIN_SECS = 2.0; // enough time has elapsed to start displaying ETA
+        const double EMA_ALPHA = 0.15; // smoothing factor
+
+        // Main thread monitors progress while workers render
+        while (tiles_done.load() < tile_count)
+        {
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
 
-        while (rows_done.load() < image_height) {
-            auto now = std::chrono::steady_clock::now();
             if (now - last_print >= std::chrono::milliseconds(150))
             {
                 last_print = now;
 
-                int done = rows_done.load();
-                double pct = 100.0 * (double)done / (double)image_height;
+                int done = tiles_done.load();
+                double pct = 100.0 * static_cast<double>(done) / static_cast<double>(tile_count);
 
-                double elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - t_render_start).count() / 1000.0;
+                double elapsed =
+                    std::chrono::duration_cast<std::chrono::milliseconds>(now - t_render_start).count() / 1000.0;
 
-                double inst_rows_per_sec = (elapsed > 0.0) ? (done / elapsed) : 0.0;
+                double inst_tiles_per_sec = (elapsed > 0.0)
+                    ? (static_cast<double>(done) / elapsed)
+                    : 0.0;
 
                 if (!ema_initialized)
                 {
-                    ema_rows_per_sec = inst_rows_per_sec;
+                    ema_tiles_per_sec = inst_tiles_per_sec;
                     ema_initialized = true;
                 }
                 else
                 {
-                    ema_rows_per_sec = EMA_ALPHA * inst_rows_per_sec + (1.0 - EMA_ALPHA) * ema_rows_per_sec;
+                    ema_tiles_per_sec = EMA_ALPHA * inst_tiles_per_sec
+                        + (1.0 - EMA_ALPHA) * ema_tiles_per_sec;
                 }
 
-                bool show_eta = (done >= ETA_MIN_ROWS) && (elapsed >= ETA_MIN_SECS) && (ema_rows_per_sec > 0.0);
+                bool show_eta = (done >= ETA_MIN_TILES)
+                    && (elapsed >= ETA_MIN_SECS)
+                    && (ema_tiles_per_sec > 0.0);
 
-                std::cerr << "\rRender: " << std::fixed << std::setprecision(1)
-                    << pct << "% (" << done << "/" << image_height << " rows)";
+                std::cerr << "\rRender: "
+                    << std::fixed << std::setprecision(1)
+                    << pct << "% (" << done << "/" << tile_count << " tiles) |";
 
                 if (show_eta)
                 {
-                    int remaining_rows = image_height - done;
-                    double eta_sec = remaining_rows / ema_rows_per_sec;
+                    int remaining_tiles = tile_count - done;
+                    double eta_sec = static_cast<double>(remaining_tiles) / ema_tiles_per_sec;
 
-                    int eta_int = (int)(eta_sec + 0.5);
-                    int eta_min = eta_int / 60;
-                    int eta_rem = eta_int % 60;
-
-                    std::cerr << "  ETA: " << format_time_seconds(eta_sec) << " ";
+                    std::cerr << " Estimated Time Remaining: "
+                        << format_time_seconds(eta_sec) << " ";
                 }
                 else
                 {
-                    std::cerr << "  ETA: -- ";
+                    std::cerr << " Estimated Time Remaining: -- ";
                 }
-                std::cerr << "Elapsed: " << format_time_seconds(elapsed);
+
+                std::cerr << "| Elapsed: " << format_time_seconds(elapsed);
                 std::cerr << "   " << std::flush;
             }
 
-            std::this_thread::sleep_for(std::chrono::milliseconds(25));
-        }
-
-        for (auto& th : threads) th.join();
-
-        auto t_render_end = std::chrono::steady_clock::now();
-        std::cerr << "\rRender: 100.0% (" << image_height << "/" << image_height
-            << " rows)  ETA: 0m 0s   \n";
-
-        std::ofstream out(outPath, std::ios::out | std::ios::trunc);
-        if (!out)
-        {
-            std::cerr << "ERROR: Failed to open output file: " << outPath.string() << "\n";
-            return;
-        }
-
-        std::cerr << "Writing file...\n";
-        auto t_write_start = std::chrono::steady_clock::now();
-
-        out << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+            idle();
 
-        for (int j = 0; j < image_height; ++j)
-        {
-            for (int i = 0; i < image_width; ++i)
-            {
-                write_color(out, framebuffer[j * image_width + i]);
-            }
-
-            if ((j % 10) == 0 || j == image_height - 1)
-            {
-                double pct = 100.0 * (double)(j + 1) / (double)image_height;
-                std::cerr << "\rWrite:  " << std::fixed << std::setprecision(1)
-                    << pct << "% (" << (j + 1) << "/" << image_height << " rows)   "
-                    << std::flush;
-            }
+            // Quick sleep to reduce amount we write to console
+            std::this_thread::sleep_for(std::chrono::milliseconds(25));
         }
 
-        auto t_write_end = std::chrono::steady_clock::now();
-        out.close();
+        workers.wait();
 
-        std::cerr << "\rWrite:  100.0% (" << image_height << "/" << image_height << " rows)   \n";
+        std::cerr << "\rRender: 100.0% (" << tile_count << "/" << tile_count
+            << " tiles) | Estimated Time Remaining: 0m 0s   \n";
 
-        auto render_ms = std::chrono::duration_cast<std::chrono::milliseconds>(t_render_end - t_render_start).count();
-        auto write_ms = std::chrono::duration_cast<std::chrono::milliseconds>(t_write_end - t_write_start).count();
-        auto total_ms = std::chrono::duration_cast<std::chrono::milliseconds>(t_write_end - t_start).count();
-
-        std::cerr << "============= Timing ===============\n";
-        std::cerr << "Render: " << format_time_ms(render_ms) << "\n";
-        std::cerr << "Write:  " << format_time_ms(write_ms) << "\n";
-        std::cerr << "Total:  " << format_time_ms(total_ms) << "\n";
-        std::cerr << "====================================\n";
-        std::cerr << "Done. Wrote: " << outPath.string() << "\n";
+        return rays_traced.load();
     }
 
-private:
-    int image_height{};
-    point3 center;
-    point3 pixel00_loc;
-
-    vec3 pixel_delta_u;
-    vec3 pixel_delta_v;
-
-    vec3 u, v, w;
-
-    vec3 defocus_disk_u;
-    vec3 defocus_disk_v;
-
     // Precompute camera geometry
         // image height, viewport size, pixel spacing, and camera basis
     void initialize()
@@ -718,93 +1257,157 @@ private:
         return center + (p.x() * defocus_disk_u) + (p.y() * defocus_disk_v);
     }
 
-    // Recursive path tracing:
-        // intersect scene
-        // add emitted light
-        // scatter and recurse
-        // return background if miss
-    color ray_color(const ray& r, int depth, const hittable& world) const
+    // Pixel blocks traced as one packet in the current render (1 x 1 when packets are off)
+    int packet_width() const { return packets ? 4 : 1; }
+    int packet_height() const { return packets ? packet_size / 4 : 1; }
+
+    // Camera samples of a block of pixels, one packet per round with a sample of every pixel that still wants one
+        // the packet only finds the first hits, every sample is then shaded on its own by first_hit
+        // each sample continues from the generator state it would have had traced alone
+    template <unsigned Aovs, typename WantsFn>
+    void trace_packets(const tile& block, aov_pixel* out, int stride, const hittable& world, const WantsFn& wants_sample) const
     {
-        if (depth <= 0) {
-            return color(0.0, 0.0, 0.0);
-        }
+        aov_pixel* lane_pixel[ray_packet::max_size];
+        pcg32 lane_random[ray_packet::max_size];
+        hit_record recs[ray_packet::max_size];
 
-        hit_record rec;
-        if (world.hit(r, interval(0.001, interval::universe.max), rec))
+        while (true)
         {
-            color emitted = rec.mat ? rec.mat->emitted() : color(0.0, 0.0, 0.0);
+            ray_packet rays;
+            for (int j = block.y0; j < block.y1; ++j)
+            {
+                for (int i = block.x0; i < block.x1; ++i)
+                {
+                    aov_pixel& px = out[(j - block.y0) * stride + (i - block.x0)];
+                    if (!wants_sample(px)) continue;
+
+                    seed_random(sample_seed(static_cast<size_t>(j * image_width + i), static_cast<uint64_t>(sample_offset + px.samples)));
+
+                    lane_pixel[rays.count] = &px;
+                    rays.add(get_ray(i, j));
+                    lane_random[rays.count - 1] = random_engine();
+                }
+            }
+            if (rays.count == 0) return;
 
-            ray scattered;
-            color attenuation;
+            const unsigned hits = (max_depth > 0) ? world.intersect_packet(rays, interval(tolerance<real>::ray_offset, interval::universe.max), recs) : 0u;
 
-            if (rec.mat && rec.mat->scatter(r, rec, attenuation, scattered))
+            for (int k = 0; k < rays.count; ++k)
             {
-                return emitted + attenuation * ray_color(scattered, depth - 1, world);
+                random_engine() = lane_random[k];
+
+                aov_pixel& px = *lane_pixel[k];
+                color c = (max_depth > 0) ? first_hit<Aovs>(rays.get(k), ((hits >> k) & 1u) != 0, recs[k], world, px) : color(0.0, 0.0, 0.0);
+                px.beauty += color_sum(c);
+                px.add_sample(luminance(c));
             }
+        }
+    }
 
-            // Non-scattering mat
-            return emitted;
+    // First bounce of one camera sample
+    template <unsigned Aovs>
+    color trace_sample(const ray& r, const hittable& world, aov_pixel& px) const
+    {
+        if (max_depth <= 0) {
+            return color(0.0, 0.0, 0.0);
         }
 
-        // Background/Skybox
-        vec3 unit_dir = unit_vector(r.direction());
-        double t = 0.5 * (unit_dir.y() + 1.0);
-        //checkpoint for development
-        return color(0, 0, 0);
-        /*return (1.0 - t) * color(1.0, 1.0, 1.0)
-            + t * color(0.5, 0.7, 1.0);*/
+        hit_record rec;
+        const bool hit = world.intersect(r, interval(tolerance<real>::ray_offset, interval::universe.max), rec);
+        return first_hit<Aovs>(r, hit, rec, world, px);
     }
 
-    color ray_normal(const ray& r, int depth, const hittable& world) const
+    // Camera sample whose first intersection is known (rec from intersect(), not finalized yet)
+        // records the requested first-hit outputs into px
+        // continues the path with ray_color and returns its radiance when beauty is requested
+    template <unsigned Aovs>
+    color first_hit(const ray& r, bool hit, hit_record& rec, const hittable& world, aov_pixel& px) const
     {
-        if (depth <= 0) return color(0, 0, 0);
+        ++thread_ray_count();
 
-        hit_record rec;
-        if (world.hit(r, interval(0.001, interval::universe.max), rec))
+        if (!hit)
         {
-            return rec.normal;
+            // Misses show up white in the normal and depth views
+            if constexpr ((Aovs & aov_normal) != 0) px.normal += color_sum(1.0, 1.0, 1.0);
+            if constexpr ((Aovs & aov_depth) != 0) px.depth += 1.0;
+            return background(r);
+        }
+
+        rec.surface->finalize(r, rec);
+
+        if constexpr ((Aovs & aov_normal) != 0) px.normal += color_sum(rec.normal);
+        if constexpr ((Aovs & aov_depth) != 0) px.depth += (rec.p - r.origin()).length() / static_cast<double>(max_depth);
+        if constexpr ((Aovs & aov_albedo) != 0) {
+            const material* mat = material_of(rec);
+            px.albedo += color_sum(mat ? mat->base_color(rec) : color(0.0, 0.0, 0.0));
+        }
+        if constexpr ((Aovs & aov_object_id) != 0) {
+            if (px.object_id < 0) px.object_id = rec.object_id;
+        }
+
+        if constexpr ((Aovs & aov_beauty) != 0) {
+            return shade_hit(r, rec, max_depth, world);
+        }
+        else {
+            return color(0.0, 0.0, 0.0);
         }
-        return vec3(1, 1, 1);
     }
 
-    color ray_depth(const ray& r, int depth, const hittable& world) const
+    // Recursive path tracing:
+        // intersect scene
+        // add emitted light
+        // scatter and recurse
+        // return background if miss
+    color ray_color(const ray& r, int depth, const hittable& world) const
     {
-        if (depth <= 0) return color(0, 0, 0);
+        if (depth <= 0) {
+            return color(0.0, 0.0, 0.0);
+        }
+
+        ++thread_ray_count();
 
         hit_record rec;
-        if (world.hit(r, interval(0.001, interval::universe.max), rec))
+        if (world.hit(r, interval(tolerance<real>::ray_offset, interval::universe.max), rec))
         {
-            double d = (rec.p - r.origin()).length();
-            return vec3(d / depth, d / depth, d / depth);
+            return shade_hit(r, rec, depth, world);
         }
-        return vec3(1, 1, 1);
-    }
 
-    // Clamp to stay within 0-255 range
-    static double clamp01(double x)
-    {
-        if (x < 0.0) return 0.0;
-        if (x > 0.999) return 0.999;
-        return x;
+        return background(r);
     }
 
-    // Convert color sample to 8-bit RGB
-        // average by spp
-        // gamma correct 
-        // clamp and write as integers
-    void write_color(std::ostream& out, const color& pixel_color) const
+    // Emitted light plus the scattered contribution at a surface hit
+    color shade_hit(const ray& r, const hit_record& rec, int depth, const hittable& world) const
     {
-        double scale = 1.0 / static_cast<double>(samples_per_pixel);
+        const material* mat = material_of(rec);
+        color emitted = mat ? mat->emitted() : color(0.0, 0.0, 0.0);
+
+        ray scattered;
+        color attenuation;
+
+        if (mat && mat->scatter(r, rec, attenuation, scattered))
+        {
+            return emitted + attenuation * ray_color(scattered, depth - 1, world);
+        }
 
-        double r = std::sqrt(pixel_color.x() * scale);
-        double g = std::sqrt(pixel_color.y() * scale);
-        double b = std::sqrt(pixel_color.z() * scale);
+        // Non-scattering mat
+        return emitted;
+    }
 
-        int ir = static_cast<int>(256.0 * clamp01(r));
-        int ig = static_cast<int>(256.0 * clamp01(g));
-        int ib = static_cast<int>(256.0 * clamp01(b));
+    // Material of a hit, looked up once the closest hit is known (nullptr if it has none)
+    const material* material_of(const hit_record& rec) const
+    {
+        return scene_materials ? scene_materials->get(rec.mat) : nullptr;
+    }
 
-        out << ir << ' ' << ig << ' ' << ib << '\n';
+    // Background/Skybox
+    color background(const ray& r) const
+    {
+        vec3 unit_dir = unit_vector(r.direction());
+        double t = 0.5 * (unit_dir.y() + 1.0);
+        //checkpoint for development
+        return color(0, 0, 0);
+        /*return (1.0 - t) * color(1.0, 1.0, 1.0)
+            + t * color(0.5, 0.7, 1.0);*/
     }
 
     // Format seconds
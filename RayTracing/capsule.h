@@ -8,37 +8,77 @@ class capsule : public hittable
 public:
 	point3 center;
 	vec3 dir;
-	double radius;
-	double length;
-	shared_ptr<material> mat;
+	real radius;
+	real length;
+	material_id mat;
 
-	capsule() : center(), dir(), radius(1), length(1), mat(nullptr) {}
-	capsule(point3 c, vec3 d, double r, double l, shared_ptr<material> m) :
-		center(c), dir(unit_vector(d)), radius(r), length(l), mat(std::move(m)) {
+	capsule() : center(), dir(), radius(1), length(1), mat(no_material) {}
+	capsule(point3 c, vec3 d, real r, real l, material_id m) :
+		center(c), dir(unit_vector(d)), radius(r), length(l), mat(m) {
 	}
 
-	bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+	bool intersect(const ray& r, interval ray_t, hit_record& rec) const override
 	{
-		infinite_cylinder ic(center, dir, radius, mat);
+		if (!nearest_part(center, dir, radius, length, r, ray_t, rec.t, rec.part)) return false;
+		rec.surface = this;
+		return true;
+	}
+
+	void finalize(const ray& r, hit_record& rec) const override
+	{
+		finalize_part(center, dir, radius, length, mat, rec.part, r, rec);
+	}
+
+	bool occluded(const ray& r, interval ray_t) const override
+	{
+		real t;
+		int part;
+		return nearest_part(center, dir, radius, length, r, ray_t, t, part);
+	}
+
+	// Side first, a hit past the ends falls back to the end spheres (part 0 side, 1 top end, 2 bottom end)
+		// static so compiled scenes can run it on their capsule arrays
+	static bool nearest_part(const point3& center, const vec3& dir, real radius, real length, const ray& r, const interval& ray_t,
+		real& t, int& part)
+	{
+		if (!infinite_cylinder::nearest_t(center, dir, radius, r, ray_t, t)) return false;
+
+		part = 0;
+		if (project(r.at(t) - center, dir).length() <= length) return true;
 
-		if (ic.hit(r, ray_t, rec))
+		part = 1;
+		if (end_hit(r, ray_t, center + dir * length, radius, t)) return true;
+
+		part = 2;
+		return end_hit(r, ray_t, center - dir * length, radius, t);
+	}
+
+	// Surface interaction of a hit nearest_part() found
+	static void finalize_part(const point3& center, const vec3& dir, real radius, real length, material_id mat, int part,
+		const ray& r, hit_record& rec)
+	{
+		if (part == 0)
 		{
-			if (project(rec.p - center, dir).length() <= length)
-				return true;
-
-			point3 tempPoint = center + dir * length;
-			sphere s(tempPoint, radius, mat);
-			bool result = s.hit(r, ray_t, rec);
-			if (result && rec.front_face)
-				return true;
-
-			tempPoint = center - dir * length;
-			s = sphere(tempPoint, radius, mat);
-			result = s.hit(r, ray_t, rec);
-			if (result && rec.front_face)
-				return true;
+			infinite_cylinder::finalize_side(center, dir, radius, mat, r, rec);
+			return;
 		}
 
-		return false;
+		sphere::finalize_hit(part == 1 ? center + dir * length : center - dir * length, radius, mat, r, rec);
+	}
+
+	// Segment between the end sphere centers grown by the radius
+	aabb bounding_box() const override
+	{
+		const real pad = 2.0 * std::fabs(radius);
+		aabb axis(center - dir * length, center + dir * length);
+		return aabb(axis.x.expand(pad), axis.y.expand(pad), axis.z.expand(pad));
+	}
+
+private:
+	// Outside of the end sphere at end_center
+	static bool end_hit(const ray& r, const interval& ray_t, const point3& end_center, real radius, real& t)
+	{
+		if (!sphere::nearest_root(end_center, radius, r, ray_t, t)) return false;
+		return dot(r.direction(), (r.at(t) - end_center) / radius) < 0;
 	}
 };
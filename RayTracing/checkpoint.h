@@ -0,0 +1,275 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <system_error>
+#include <vector>
+
+#include "rtweekend.h"
+#include "aov.h"
+// Binary render checkpoints
+    // stores the accumulated framebuffers and per-pixel sample state with the camera and config that produced them
+    // a later render with the same camera can load it and keep adding samples instead of starting over
+    // shard renders write the same format for their part of the frame, merge_checkpoint adds parts together
+    // layout: header, then sample_count, lum_mean, lum_m2, then every allocated output in aov_flags order,
+    // each array holding only the rows [row_begin, row_end)
+
+// Everything a render has to agree on before its samples can be mixed with a checkpoint's
+struct checkpoint_header {
+    char magic[8] = { 'R', 'T', 'C', 'K', 'P', 'T', '\0', '\0' };
+    uint32_t version = 3; // 3: samples drawn with the 32-bit random_double, older files hold other sample streams
+    uint32_t aovs = 0;
+
+    int32_t image_width = 0;
+    int32_t image_height = 0;
+    int32_t max_depth = 0;
+    int32_t samples_per_pixel = 0; // target of the render that saved it (informational)
+
+    // Part of the frame the file covers (the whole frame for ordinary checkpoints)
+    int32_t row_begin = 0;
+    int32_t row_end = 0;
+    int32_t sample_begin = 0;  // global index of every pixel's first sample
+    int32_t sample_end = 0;    // one past the last sample index the render was allowed to take
+    int32_t deterministic = 0; // samples seeded from sample_seed(pixel, sample index), every render since version 3
+
+    // Camera
+    double vfov = 0.0;
+    double lookfrom[3] = { 0.0, 0.0, 0.0 };
+    double lookat[3] = { 0.0, 0.0, 0.0 };
+    double vup[3] = { 0.0, 0.0, 0.0 };
+    double defocus_angle = 0.0;
+    double focus_dist = 0.0;
+
+    // Adaptive sampling settings (the Welford state in the file is only meaningful with these)
+    int32_t adaptive_sampling = 0;
+    int32_t min_samples_per_pixel = 0;
+    double adaptive_threshold = 0.0;
+
+    size_t pixel_count() const { return static_cast<size_t>(image_width) * static_cast<size_t>(image_height); }
+
+    // Pixels [region_begin, region_begin + region_count) are stored in the file
+    size_t region_begin() const { return static_cast<size_t>(row_begin) * static_cast<size_t>(image_width); }
+    size_t region_count() const { return static_cast<size_t>(row_end - row_begin) * static_cast<size_t>(image_width); }
+};
+
+// Same image, same camera and same light transport settings, so samples can be added together
+inline bool checkpoint_same_frame(const checkpoint_header& a, const checkpoint_header& b)
+{
+    auto same3 = [](const double* x, const double* y) { return x[0] == y[0] && x[1] == y[1] && x[2] == y[2]; };
+
+    return a.version == b.version
+        && a.aovs == b.aovs
+        && a.image_width == b.image_width
+        && a.image_height == b.image_height
+        && a.max_depth == b.max_depth
+        && a.vfov == b.vfov
+        && same3(a.lookfrom, b.lookfrom)
+        && same3(a.lookat, b.lookat)
+        && same3(a.vup, b.vup)
+        && a.defocus_angle == b.defocus_angle
+        && a.focus_dist == b.focus_dist;
+}
+
+// Same frame and same part of it, a render may continue from such a checkpoint
+    // sample counts, targets and adaptive thresholds may differ, that is what resuming is for
+inline bool checkpoint_compatible(const checkpoint_header& a, const checkpoint_header& b)
+{
+    return checkpoint_same_frame(a, b)
+        && a.row_begin == b.row_begin
+        && a.row_end == b.row_end
+        && a.sample_begin == b.sample_begin
+        && a.deterministic == b.deterministic;
+}
+
+// Two parts would count some pixel's sample twice when they share rows and sample indices
+inline bool checkpoint_parts_overlap(const checkpoint_header& a, const checkpoint_header& b)
+{
+    bool rows = a.row_begin < b.row_end && b.row_begin < a.row_end;
+    bool samples = a.sample_begin < b.sample_end && b.sample_begin < a.sample_end;
+    return rows && samples;
+}
+
+namespace checkpoint_io {
+    template <typename T>
+    void write_array(std::ofstream& out, const std::vector<T>& v, size_t begin, size_t count)
+    {
+        out.write(reinterpret_cast<const char*>(v.data() + begin), static_cast<std::streamsize>(count * sizeof(T)));
+    }
+
+    template <typename T>
+    bool read_array(std::ifstream& in, std::vector<T>& v, size_t begin, size_t count)
+    {
+        in.read(reinterpret_cast<char*>(v.data() + begin), static_cast<std::streamsize>(count * sizeof(T)));
+        return static_cast<bool>(in);
+    }
+
+    // Color sums are stored as 3 doubles, so padded (SIMD) and scalar vec3 builds read each other's files
+    inline void write_array(std::ofstream& out, const std::vector<color_sum>& v, size_t begin, size_t count)
+    {
+        std::vector<double> flat(count * 3);
+        for (size_t k = 0; k < count; ++k)
+        {
+            for (int c = 0; c < 3; ++c) flat[k * 3 + static_cast<size_t>(c)] = v[begin + k][c];
+        }
+        write_array(out, flat, 0, flat.size());
+    }
+
+    inline bool read_array(std::ifstream& in, std::vector<color_sum>& v, size_t begin, size_t count)
+    {
+        std::vector<double> flat(count * 3);
+        if (!read_array(in, flat, 0, flat.size())) return false;
+        for (size_t k = 0; k < count; ++k)
+        {
+            v[begin + k] = color_sum(flat[k * 3], flat[k * 3 + 1], flat[k * 3 + 2]);
+        }
+        return true;
+    }
+}
+
+// Write a checkpoint next to the target and rename it over the old one so a crash mid-write never loses the previous checkpoint
+    // buffers are full frame, only the header's rows are written
+inline bool save_checkpoint(const std::filesystem::path& path, const checkpoint_header& header, const aov_buffers& buffers)
+{
+    std::filesystem::path tmpPath = path;
+    tmpPath += ".tmp";
+
+    {
+        std::ofstream out(tmpPath, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!out)
+        {
+            std::cerr << "ERROR: Failed to open checkpoint file: " << tmpPath.string() << "\n";
+            return false;
+        }
+
+        const size_t b = header.region_begin();
+        const size_t n = header.region_count();
+
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        checkpoint_io::write_array(out, buffers.sample_count, b, n);
+        checkpoint_io::write_array(out, buffers.lum_mean, b, n);
+        checkpoint_io::write_array(out, buffers.lum_m2, b, n);
+        if (header.aovs & aov_beauty) checkpoint_io::write_array(out, buffers.beauty, b, n);
+        if (header.aovs & aov_normal) checkpoint_io::write_array(out, buffers.normal, b, n);
+        if (header.aovs & aov_depth) checkpoint_io::write_array(out, buffers.depth, b, n);
+        if (header.aovs & aov_albedo) checkpoint_io::write_array(out, buffers.albedo, b, n);
+        if (header.aovs & aov_object_id) checkpoint_io::write_array(out, buffers.object_id, b, n);
+
+        if (!out)
+        {
+            std::cerr << "ERROR: Failed to write checkpoint file: " << tmpPath.string() << "\n";
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmpPath, path, ec);
+    if (ec)
+    {
+        std::cerr << "ERROR: Failed to replace checkpoint file: " << path.string() << " (" << ec.message() << ")\n";
+        return false;
+    }
+
+    return true;
+}
+
+// Read a checkpoint header, returns false if the file is missing or not a checkpoint
+inline bool load_checkpoint_header(std::ifstream& in, checkpoint_header& header)
+{
+    const checkpoint_header expected;
+
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    return static_cast<bool>(in)
+        && std::memcmp(header.magic, expected.magic, sizeof(header.magic)) == 0
+        && header.version == expected.version
+        && header.image_width > 0 && header.image_height > 0
+        && header.row_begin >= 0 && header.row_begin <= header.row_end && header.row_end <= header.image_height;
+}
+
+// Read any checkpoint or shard into full frame buffers (pixels outside its rows stay empty)
+inline bool read_checkpoint(const std::filesystem::path& path, checkpoint_header& header, aov_buffers& buffers)
+{
+    std::ifstream in(path, std::ios::in | std::ios::binary);
+    if (!in) return false;
+
+    if (!load_checkpoint_header(in, header))
+    {
+        std::cerr << "WARNING: " << path.string() << " is not a render checkpoint\n";
+        return false;
+    }
+
+    aov_buffers loaded(header.aovs, header.pixel_count());
+    const size_t b = header.region_begin();
+    const size_t n = header.region_count();
+
+    bool ok = checkpoint_io::read_array(in, loaded.sample_count, b, n)
+        && checkpoint_io::read_array(in, loaded.lum_mean, b, n)
+        && checkpoint_io::read_array(in, loaded.lum_m2, b, n);
+    if (ok && (header.aovs & aov_beauty)) ok = checkpoint_io::read_array(in, loaded.beauty, b, n);
+    if (ok && (header.aovs & aov_normal)) ok = checkpoint_io::read_array(in, loaded.normal, b, n);
+    if (ok && (header.aovs & aov_depth)) ok = checkpoint_io::read_array(in, loaded.depth, b, n);
+    if (ok && (header.aovs & aov_albedo)) ok = checkpoint_io::read_array(in, loaded.albedo, b, n);
+    if (ok && (header.aovs & aov_object_id)) ok = checkpoint_io::read_array(in, loaded.object_id, b, n);
+
+    if (!ok)
+    {
+        std::cerr << "WARNING: Checkpoint " << path.string() << " is truncated\n";
+        return false;
+    }
+
+    buffers = std::move(loaded);
+    return true;
+}
+
+// Load the framebuffers of a checkpoint that matches expected (see checkpoint_compatible)
+    // on success buffers holds the saved accumulation and header the saved settings
+inline bool load_checkpoint(const std::filesystem::path& path, const checkpoint_header& expected, checkpoint_header& header, aov_buffers& buffers)
+{
+    if (!std::filesystem::exists(path)) return false;
+
+    aov_buffers loaded(0, 0);
+    if (!read_checkpoint(path, header, loaded))
+    {
+        std::cerr << "WARNING: Starting from scratch\n";
+        return false;
+    }
+
+    if (!checkpoint_compatible(header, expected))
+    {
+        std::cerr << "WARNING: Checkpoint " << path.string() << " was saved with a different camera, resolution, outputs or shard, starting from scratch\n";
+        return false;
+    }
+
+    buffers = std::move(loaded);
+    return true;
+}
+
+// Add the samples of src (a part of the frame described by header) into dst
+    // sums and counts add, the luminance statistics combine with Chan's parallel variance update
+    // the object id comes from the first part whose samples hit something, so add parts in sample order
+inline void merge_checkpoint(aov_buffers& dst, const aov_buffers& src, const checkpoint_header& header)
+{
+    const size_t end = header.region_begin() + header.region_count();
+
+    for (size_t k = header.region_begin(); k < end; ++k)
+    {
+        const int nb = src.sample_count[k];
+        if (nb == 0) continue;
+
+        const int na = dst.sample_count[k];
+        const double n = static_cast<double>(na + nb);
+        const double delta = src.lum_mean[k] - dst.lum_mean[k];
+
+        dst.lum_mean[k] += delta * static_cast<double>(nb) / n;
+        dst.lum_m2[k] += src.lum_m2[k] + delta * delta * static_cast<double>(na) * static_cast<double>(nb) / n;
+
+        if (header.aovs & aov_beauty) dst.beauty[k] += src.beauty[k];
+        if (header.aovs & aov_normal) dst.normal[k] += src.normal[k];
+        if (header.aovs & aov_depth) dst.depth[k] += src.depth[k];
+        if (header.aovs & aov_albedo) dst.albedo[k] += src.albedo[k];
+        if ((header.aovs & aov_object_id) && dst.object_id[k] < 0) dst.object_id[k] = src.object_id[k];
+
+        dst.sample_count[k] = na + nb;
+    }
+}
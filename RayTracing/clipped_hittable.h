@@ -0,0 +1,36 @@
+#pragma once
+#include "rtweekend.h"
+#include "aabb.h"
+#include "hittable.h"
+// Wraps an object (usually an unbounded one) and keeps only the part of it inside a box
+    // the ray interval is narrowed to the box before the object is tested, so a far hit inside the box is still found
+    // when a near one lies outside it
+    // bounding_box is the box (overlapped with the object's own box), which lets an acceleration structure cull it
+
+class clipped_hittable : public hittable {
+public:
+    clipped_hittable(shared_ptr<hittable> object, const aabb& clip_box)
+        : object(std::move(object)), clip_box(clip_box)
+    {
+        bbox = aabb::overlap(this->object->bounding_box(), clip_box);
+    }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        if (!clip_box.clip(r, ray_t)) return false;
+        return object->intersect(r, ray_t, rec);
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override
+    {
+        if (!clip_box.clip(r, ray_t)) return false;
+        return object->occluded(r, ray_t);
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+private:
+    shared_ptr<hittable> object;
+    aabb clip_box;
+    aabb bbox;
+};
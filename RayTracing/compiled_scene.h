@@ -0,0 +1,814 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <typeinfo>
+#include <vector>
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "hittable.h"
+#include "bvh_build.h"
+#include "linear_bvh.h"
+#include "sphere.h"
+#include "sphere_batch.h"
+#include "finite_plane.h"
+#include "infinite_plane.h"
+#include "infinite_cylinder.h"
+#include "cylinder.h"
+#include "capsule.h"
+// Scene compiled into per-type primitive arrays (accelerator::compiled)
+    // the objects (boxes flattened into their faces) are copied into one array per field and type:
+    // sphere centers and radii, quad origins, edges and normals, cylinder and capsule axes, ...
+    // a linear_bvh style tree sits on top, each leaf owns a contiguous range of every type's arrays
+    // so a leaf is a handful of type specialized loops calling the shapes' static tests, with no virtual call per primitive
+    // spheres are a sphere_batch, a leaf's spheres go through its SIMD kernel together
+    // types it doesn't know stay hittables (tested through their virtual functions in their own loop)
+    // intersect() only records t and which primitive, finalize() fills in the surface from the arrays
+    // intersect_packet() walks the tree once for a packet of rays, with SIMD box, sphere and quad tests over the rays
+
+class compiled_scene : public hittable {
+public:
+    static constexpr size_t max_leaf_size = 4;
+    static constexpr size_t sphere_leaf_size = 16;
+
+    // Primitive types, in the order a leaf tests them
+    enum kind : int { spheres, quads, planes, infinite_cylinders, cylinders, capsules, others, kind_count };
+
+    // Build over every object, object IDs are the objects' indices in this vector
+        // requested picks the sphere kernel (see sphere_batch)
+    explicit compiled_scene(const std::vector<shared_ptr<hittable>>& objects, simd_isa requested = detect_simd_isa())
+        : sphere_data(requested)
+    {
+        std::vector<bvh_build::item> items;
+        for (size_t i = 0; i < objects.size(); ++i)
+        {
+            gather(objects[i], static_cast<int>(i), items);
+        }
+        if (items.empty()) return;
+
+        // Items keep their object ID in source_ids while the tree carries their index
+        for (size_t i = 0; i < items.size(); ++i)
+        {
+            source_ids.push_back(items[i].id);
+            items[i].id = static_cast<int>(i);
+        }
+
+        std::unique_ptr<bvh_build::tree_node> root = bvh_build::build_tree(items, max_leaf_size, &tree_info.threads);
+        nodes.reserve(2 * items.size());
+        flatten(items, *root, 1);
+        leaf_first.push_back(type_sizes());
+
+        bbox = root->box;
+        tree_info.finish(bvh_build::bounded_bounds(items));
+        source_ids.clear();
+    }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        if (nodes.empty()) return false;
+
+        const real orig[3] = { r.orig[0], r.orig[1], r.orig[2] };
+        const real inv_dir[3] = { 1 / r.dir[0], 1 / r.dir[1], 1 / r.dir[2] };
+        const int dir_is_neg[3] = { inv_dir[0] < 0.0, inv_dir[1] < 0.0, inv_dir[2] < 0.0 };
+
+        int stack[bvh_build::max_depth];
+        int stack_size = 0;
+        int current = 0;
+
+        bool hit_anything = false;
+        real closest = ray_t.max;
+
+        while (true)
+        {
+            const linear_bvh_node& node = nodes[static_cast<size_t>(current)];
+
+            if (linear_bvh::box_hit(node, orig, inv_dir, dir_is_neg, ray_t.min, closest))
+            {
+                if (node.primitive_count > 0)
+                {
+                    if (intersect_leaf(static_cast<size_t>(node.offset), r, ray_t.min, closest, rec)) hit_anything = true;
+
+                    if (stack_size == 0) break;
+                    current = stack[--stack_size];
+                }
+                else if (dir_is_neg[node.axis])
+                {
+                    stack[stack_size++] = current + 1;
+                    current = node.offset;
+                }
+                else
+                {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                }
+            }
+            else
+            {
+                if (stack_size == 0) break;
+                current = stack[--stack_size];
+            }
+        }
+
+        return hit_anything;
+    }
+
+    // A node is entered by the rays of the mask it was pushed with that also hit its box, the walk ends when no ray is left
+        // leaves test their spheres and quads for all entering rays together, the other types ray by ray
+        // the near child is picked with the first entering ray's direction, so the other rays may visit the children in another order
+        // than they would alone: the closest hit is the same unless the shape's answer depends on the ray interval,
+        // e.g. a ray starting inside a capsule, or two hits share exactly the same t
+        // the box and quad tests need AVX2 and a double build, otherwise the rays are traced one at a time (faster than a scalar packet walk)
+    unsigned intersect_packet(const ray_packet& rays, interval ray_t, hit_record* recs) const override
+    {
+#if RT_X86 && RT_REAL_IS_DOUBLE
+        if (traces_packets()) return intersect_packet_avx2(rays, ray_t, recs);
+#endif
+        return hittable::intersect_packet(rays, ray_t, recs);
+    }
+
+    bool traces_packets() const override
+    {
+#if RT_X86 && RT_REAL_IS_DOUBLE
+        return !nodes.empty() && sphere_data.kernel() >= simd_isa::avx2;
+#else
+        return false;
+#endif
+    }
+
+    // rec.primitive holds the array index and type intersect() found
+    void finalize(const ray& r, hit_record& rec) const override
+    {
+        const size_t i = static_cast<size_t>(rec.primitive / kind_count);
+
+        switch (rec.primitive % kind_count)
+        {
+        case spheres:
+            sphere::finalize_hit(sphere_data.center(i), sphere_data.radius(i), sphere_data.material(i), r, rec);
+            break;
+        case quads:
+            rec.p = r.at(rec.t);
+            rec.mat = quad_data.mat[i];
+            rec.set_face_normal(r, quad_data.normal[i]);
+            break;
+        case planes:
+            rec.p = r.at(rec.t);
+            rec.mat = plane_data.mat[i];
+            rec.set_face_normal(r, plane_data.normal[i]);
+            break;
+        case infinite_cylinders:
+            infinite_cylinder::finalize_side(infinite_cylinder_data.center[i], infinite_cylinder_data.dir[i], infinite_cylinder_data.radius[i],
+                infinite_cylinder_data.mat[i], r, rec);
+            break;
+        case cylinders:
+            cylinder::finalize_part(cylinder_data.center[i], cylinder_data.dir[i], cylinder_data.radius[i], cylinder_data.mat[i],
+                rec.part, r, rec);
+            break;
+        case capsules:
+            capsule::finalize_part(capsule_data.center[i], capsule_data.dir[i], capsule_data.radius[i], capsule_data.length[i],
+                capsule_data.mat[i], rec.part, r, rec);
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Same walk as intersect() without a closest hit to shrink the interval, returns at the first primitive hit
+    bool occluded(const ray& r, interval ray_t) const override
+    {
+        if (nodes.empty()) return false;
+
+        const real orig[3] = { r.orig[0], r.orig[1], r.orig[2] };
+        const real inv_dir[3] = { 1 / r.dir[0], 1 / r.dir[1], 1 / r.dir[2] };
+        const int dir_is_neg[3] = { inv_dir[0] < 0.0, inv_dir[1] < 0.0, inv_dir[2] < 0.0 };
+
+        int stack[bvh_build::max_depth];
+        int stack_size = 0;
+        int current = 0;
+
+        while (true)
+        {
+            const linear_bvh_node& node = nodes[static_cast<size_t>(current)];
+
+            if (linear_bvh::box_hit(node, orig, inv_dir, dir_is_neg, ray_t.min, ray_t.max))
+            {
+                if (node.primitive_count > 0)
+                {
+                    if (occluded_leaf(static_cast<size_t>(node.offset), r, ray_t)) return true;
+
+                    if (stack_size == 0) break;
+                    current = stack[--stack_size];
+                }
+                else if (dir_is_neg[node.axis])
+                {
+                    stack[stack_size++] = current + 1;
+                    current = node.offset;
+                }
+                else
+                {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                }
+            }
+            else
+            {
+                if (stack_size == 0) break;
+                current = stack[--stack_size];
+            }
+        }
+
+        return false;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    // Primitives of one type after flattening
+    size_t count(kind k) const { return leaf_first.empty() ? 0 : leaf_first.back()[k]; }
+    const bvh_build::tree_stats& stats() const { return tree_info; }
+
+private:
+    // One array per field, index i of every array is the same primitive
+    struct quad_array {
+        std::vector<point3> origin;
+        std::vector<vec3> edge_u, edge_v, normal;
+        std::vector<real> uu, uv, vv, det;
+        std::vector<material_id> mat;
+        std::vector<int> id;
+    };
+
+    struct plane_array {
+        std::vector<point3> point;
+        std::vector<vec3> normal;
+        std::vector<material_id> mat;
+        std::vector<int> id;
+    };
+
+    // Cylinders and capsules (segment length 0 for infinite cylinders)
+    struct axis_array {
+        std::vector<point3> center;
+        std::vector<vec3> dir;
+        std::vector<real> radius, length;
+        std::vector<material_id> mat;
+        std::vector<int> id;
+    };
+
+    struct other_array {
+        std::vector<const hittable*> object;
+        std::vector<shared_ptr<hittable>> owner;
+        std::vector<int> id;
+    };
+
+    using type_offsets = std::array<uint32_t, kind_count>;
+
+    // Per ray values of a packet walk: reciprocal directions by axis and the closest hit so far
+    struct alignas(32) packet_state {
+        real inv_dir[3][ray_packet::max_size] = {};
+        real closest[ray_packet::max_size] = {};
+    };
+
+    std::vector<linear_bvh_node> nodes;
+    std::vector<type_offsets> leaf_first; // leaf L covers [leaf_first[L][k], leaf_first[L + 1][k]) of type k, plus one end entry
+    sphere_batch sphere_data;
+    std::vector<int> sphere_ids;
+    quad_array quad_data;
+    plane_array plane_data;
+    axis_array infinite_cylinder_data;
+    axis_array cylinder_data;
+    axis_array capsule_data;
+    other_array other_data;
+    std::vector<int> source_ids; // object ID of each build item, only during the build
+    aabb bbox = aabb::empty;
+    bvh_build::tree_stats tree_info;
+
+    // Closest hit so far, the array index and type go into rec.primitive for finalize()
+    void record(hit_record& rec, kind k, uint32_t i, real t, int id) const
+    {
+        rec.t = t;
+        rec.surface = this;
+        rec.primitive = static_cast<int>(i) * kind_count + k;
+        rec.object_id = id;
+    }
+
+    // Types before from are skipped (a packet leaf has already tested them)
+    bool intersect_leaf(size_t leaf, const ray& r, real t_min, real& closest, hit_record& rec, kind from = spheres) const
+    {
+        const type_offsets& first = leaf_first[leaf];
+        const type_offsets& end = leaf_first[leaf + 1];
+        bool found = false;
+        real t;
+
+        uint32_t sphere;
+        if (from == spheres && first[spheres] < end[spheres] && sphere_data.nearest(r, first[spheres], end[spheres], t_min, closest, sphere))
+        {
+            record(rec, spheres, sphere, closest, sphere_ids[sphere]);
+            found = true;
+        }
+
+        for (uint32_t i = (from <= quads) ? first[quads] : end[quads]; i < end[quads]; ++i)
+        {
+            real a, b;
+            if (finite_plane::rectangle_hit(quad_data.origin[i], quad_data.edge_u[i], quad_data.edge_v[i], quad_data.normal[i],
+                quad_data.uu[i], quad_data.uv[i], quad_data.vv[i], quad_data.det[i], r, interval(t_min, closest), t, a, b))
+            {
+                closest = t;
+                record(rec, quads, i, t, quad_data.id[i]);
+                rec.u = a;
+                rec.v = b;
+                found = true;
+            }
+        }
+
+        for (uint32_t i = first[planes]; i < end[planes]; ++i)
+        {
+            if (infinite_plane::crossing(plane_data.point[i], plane_data.normal[i], r, interval(t_min, closest), t))
+            {
+                closest = t;
+                record(rec, planes, i, t, plane_data.id[i]);
+                found = true;
+            }
+        }
+
+        for (uint32_t i = first[infinite_cylinders]; i < end[infinite_cylinders]; ++i)
+        {
+            if (infinite_cylinder::nearest_t(infinite_cylinder_data.center[i], infinite_cylinder_data.dir[i], infinite_cylinder_data.radius[i],
+                r, interval(t_min, closest), t))
+            {
+                closest = t;
+                record(rec, infinite_cylinders, i, t, infinite_cylinder_data.id[i]);
+                found = true;
+            }
+        }
+
+        for (uint32_t i = first[cylinders]; i < end[cylinders]; ++i)
+        {
+            int part;
+            if (cylinder::nearest_part(cylinder_data.center[i], cylinder_data.dir[i], cylinder_data.radius[i], cylinder_data.length[i],
+                r, interval(t_min, closest), t, part))
+            {
+                closest = t;
+                record(rec, cylinders, i, t, cylinder_data.id[i]);
+                rec.part = part;
+                found = true;
+            }
+        }
+
+        for (uint32_t i = first[capsules]; i < end[capsules]; ++i)
+        {
+            int part;
+            if (capsule::nearest_part(capsule_data.center[i], capsule_data.dir[i], capsule_data.radius[i], capsule_data.length[i],
+                r, interval(t_min, closest), t, part))
+            {
+                closest = t;
+                record(rec, capsules, i, t, capsule_data.id[i]);
+                rec.part = part;
+                found = true;
+            }
+        }
+
+        if (first[others] < end[others])
+        {
+            hit_record temp_rec;
+            for (uint32_t i = first[others]; i < end[others]; ++i)
+            {
+                if (other_data.object[i]->intersect(r, interval(t_min, closest), temp_rec))
+                {
+                    closest = temp_rec.t;
+                    rec = temp_rec;
+                    rec.object_id = other_data.id[i];
+                    found = true;
+                }
+            }
+        }
+
+        return found;
+    }
+
+#if RT_X86 && RT_REAL_IS_DOUBLE
+    // The walk behind intersect_packet(), each stack entry keeps the rays its node is entered with
+    RT_TARGET_AVX2_EXACT unsigned intersect_packet_avx2(const ray_packet& rays, interval ray_t, hit_record* recs) const
+    {
+        packet_state state;
+        for (int k = 0; k < rays.count; ++k)
+        {
+            state.inv_dir[0][k] = 1.0 / rays.dx[k];
+            state.inv_dir[1][k] = 1.0 / rays.dy[k];
+            state.inv_dir[2][k] = 1.0 / rays.dz[k];
+            state.closest[k] = ray_t.max;
+        }
+
+        int stack[bvh_build::max_depth];
+        unsigned stack_mask[bvh_build::max_depth];
+        int stack_size = 0;
+        int current = 0;
+        unsigned mask = rays.lanes();
+        unsigned hits = 0;
+
+        while (true)
+        {
+            const linear_bvh_node& node = nodes[static_cast<size_t>(current)];
+            mask = box_hit_packet_avx2(node, rays, state, ray_t.min, mask);
+
+            if (mask && node.primitive_count > 0)
+            {
+                hits |= intersect_leaf_packet(static_cast<size_t>(node.offset), rays, mask, ray_t.min, state.closest, recs);
+            }
+            else if (mask)
+            {
+                int first = 0;
+                while (!((mask >> first) & 1u)) ++first;
+
+                stack_mask[stack_size] = mask;
+                if (state.inv_dir[node.axis][first] < 0.0)
+                {
+                    stack[stack_size++] = current + 1;
+                    current = node.offset;
+                }
+                else
+                {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+
+            if (stack_size == 0) break;
+            --stack_size;
+            current = stack[stack_size];
+            mask = stack_mask[stack_size];
+        }
+
+        return hits;
+    }
+
+    // intersect_leaf() for the rays in mask, returns the rays whose closest hit is now in this leaf
+    unsigned intersect_leaf_packet(size_t leaf, const ray_packet& rays, unsigned mask, real t_min, real* closest, hit_record* recs) const
+    {
+        const type_offsets& first = leaf_first[leaf];
+        const type_offsets& end = leaf_first[leaf + 1];
+        unsigned found = 0;
+        uint32_t index[ray_packet::max_size];
+
+        if (first[spheres] < end[spheres])
+        {
+            const unsigned lanes = sphere_data.nearest_packet(rays, mask, first[spheres], end[spheres], t_min, closest, index);
+            for (int k = 0; k < rays.count; ++k)
+            {
+                if ((lanes >> k) & 1u) record(recs[k], spheres, index[k], closest[k], sphere_ids[index[k]]);
+            }
+            found |= lanes;
+        }
+
+        if (first[quads] < end[quads])
+        {
+            real a[ray_packet::max_size], b[ray_packet::max_size];
+            const unsigned lanes = nearest_quads_packet_avx2(rays, mask, first[quads], end[quads], t_min, closest, index, a, b);
+            for (int k = 0; k < rays.count; ++k)
+            {
+                if (!((lanes >> k) & 1u)) continue;
+                record(recs[k], quads, index[k], closest[k], quad_data.id[index[k]]);
+                recs[k].u = a[k];
+                recs[k].v = b[k];
+            }
+            found |= lanes;
+        }
+
+        bool rest = false;
+        for (int k = planes; k < kind_count; ++k) rest = rest || first[k] < end[k];
+        if (rest)
+        {
+            for (int k = 0; k < rays.count; ++k)
+            {
+                if (((mask >> k) & 1u) && intersect_leaf(leaf, rays.get(k), t_min, closest[k], recs[k], planes)) found |= 1u << k;
+            }
+        }
+
+        return found;
+    }
+
+    // Slab test of every ray in mask against a node, four rays per vector with the same arithmetic as linear_bvh::box_hit
+        // NaN slabs fail the comparisons and leave the interval unchanged like the scalar test
+    RT_TARGET_AVX2_EXACT static unsigned box_hit_packet_avx2(const linear_bvh_node& node, const ray_packet& rays, const packet_state& state,
+        real t_min, unsigned mask)
+    {
+        const real* orig[3] = { rays.ox, rays.oy, rays.oz };
+        unsigned result = 0;
+
+        for (int g = 0; g < rays.count; g += 4)
+        {
+            const unsigned group = (mask >> g) & 0xFu;
+            if (!group) continue;
+
+            __m256d tn = _mm256_set1_pd(t_min);
+            __m256d tf = _mm256_loadu_pd(state.closest + g);
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                const __m256d lo = _mm256_set1_pd(node.bounds_min[axis]);
+                const __m256d hi = _mm256_set1_pd(node.bounds_max[axis]);
+                const __m256d o = _mm256_loadu_pd(orig[axis] + g);
+                const __m256d inv = _mm256_loadu_pd(state.inv_dir[axis] + g);
+                const __m256d neg = _mm256_cmp_pd(inv, _mm256_setzero_pd(), _CMP_LT_OQ);
+
+                const __m256d t0 = _mm256_mul_pd(_mm256_sub_pd(_mm256_blendv_pd(lo, hi, neg), o), inv);
+                const __m256d t1 = _mm256_mul_pd(_mm256_sub_pd(_mm256_blendv_pd(hi, lo, neg), o), inv);
+                tn = _mm256_blendv_pd(tn, t0, _mm256_cmp_pd(t0, tn, _CMP_GT_OQ));
+                tf = _mm256_blendv_pd(tf, t1, _mm256_cmp_pd(t1, tf, _CMP_LT_OQ));
+            }
+
+            const unsigned miss = static_cast<unsigned>(_mm256_movemask_pd(_mm256_cmp_pd(tf, tn, _CMP_LT_OQ)));
+            result |= (group & ~miss) << g;
+        }
+        return result;
+    }
+
+    // Closest quad of [begin, end) for every ray in mask (finite_plane::rectangle_hit), index, a and b receive the quad and its coordinates
+    RT_TARGET_AVX2_EXACT unsigned nearest_quads_packet_avx2(const ray_packet& rays, unsigned mask, uint32_t begin, uint32_t end, real t_min,
+        real* closest, uint32_t* index, real* a, real* b) const
+    {
+        const __m256d lo = _mm256_set1_pd(t_min);
+        const __m256d zero = _mm256_setzero_pd();
+        const __m256d one = _mm256_set1_pd(1.0);
+        const __m256d parallel = _mm256_set1_pd(tolerance<double>::parallel);
+        const __m256d sign = _mm256_set1_pd(-0.0);
+        const __m256i lane_bit = _mm256_set_epi64x(8, 4, 2, 1);
+        unsigned found = 0;
+
+        for (int g = 0; g < rays.count; g += 4)
+        {
+            const unsigned group = (mask >> g) & 0xFu;
+            if (!group) continue;
+
+            const __m256d active = _mm256_castsi256_pd(_mm256_cmpeq_epi64(
+                _mm256_and_si256(_mm256_set1_epi64x(static_cast<long long>(group)), lane_bit), lane_bit));
+            const __m256d ox = _mm256_loadu_pd(rays.ox + g), oy = _mm256_loadu_pd(rays.oy + g), oz = _mm256_loadu_pd(rays.oz + g);
+            const __m256d dx = _mm256_loadu_pd(rays.dx + g), dy = _mm256_loadu_pd(rays.dy + g), dz = _mm256_loadu_pd(rays.dz + g);
+
+            __m256d hi = _mm256_loadu_pd(closest + g);
+            __m256d best_a = zero, best_b = zero;
+            __m256i best = _mm256_setzero_si256();
+            __m256d updated = zero;
+
+            for (uint32_t i = begin; i < end; ++i)
+            {
+                if (std::fabs(quad_data.det[i]) < tolerance<double>::degenerate) continue;
+
+                const point3& p0 = quad_data.origin[i];
+                const vec3& n = quad_data.normal[i];
+                const vec3& u = quad_data.edge_u[i];
+                const vec3& v = quad_data.edge_v[i];
+                const __m256d p0x = _mm256_set1_pd(p0[0]), p0y = _mm256_set1_pd(p0[1]), p0z = _mm256_set1_pd(p0[2]);
+                const __m256d nx = _mm256_set1_pd(n[0]), ny = _mm256_set1_pd(n[1]), nz = _mm256_set1_pd(n[2]);
+
+                const __m256d denom = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(nx, dx), _mm256_mul_pd(ny, dy)), _mm256_mul_pd(nz, dz));
+                __m256d ok = _mm256_and_pd(_mm256_cmp_pd(_mm256_andnot_pd(sign, denom), parallel, _CMP_NLT_UQ), active);
+
+                const __m256d t = _mm256_div_pd(_mm256_add_pd(_mm256_add_pd(
+                    _mm256_mul_pd(_mm256_sub_pd(p0x, ox), nx), _mm256_mul_pd(_mm256_sub_pd(p0y, oy), ny)), _mm256_mul_pd(_mm256_sub_pd(p0z, oz), nz)), denom);
+                ok = _mm256_and_pd(ok, _mm256_and_pd(_mm256_cmp_pd(lo, t, _CMP_LE_OQ), _mm256_cmp_pd(t, hi, _CMP_LE_OQ)));
+                if (!_mm256_movemask_pd(ok)) continue;
+
+                const __m256d wx = _mm256_sub_pd(_mm256_add_pd(ox, _mm256_mul_pd(t, dx)), p0x);
+                const __m256d wy = _mm256_sub_pd(_mm256_add_pd(oy, _mm256_mul_pd(t, dy)), p0y);
+                const __m256d wz = _mm256_sub_pd(_mm256_add_pd(oz, _mm256_mul_pd(t, dz)), p0z);
+                const __m256d wu = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(wx, _mm256_set1_pd(u[0])), _mm256_mul_pd(wy, _mm256_set1_pd(u[1]))),
+                    _mm256_mul_pd(wz, _mm256_set1_pd(u[2])));
+                const __m256d wv = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(wx, _mm256_set1_pd(v[0])), _mm256_mul_pd(wy, _mm256_set1_pd(v[1]))),
+                    _mm256_mul_pd(wz, _mm256_set1_pd(v[2])));
+
+                const __m256d uu = _mm256_set1_pd(quad_data.uu[i]), uv = _mm256_set1_pd(quad_data.uv[i]), vv = _mm256_set1_pd(quad_data.vv[i]);
+                const __m256d det = _mm256_set1_pd(quad_data.det[i]);
+                const __m256d qa = _mm256_div_pd(_mm256_sub_pd(_mm256_mul_pd(wu, vv), _mm256_mul_pd(wv, uv)), det);
+                const __m256d qb = _mm256_div_pd(_mm256_sub_pd(_mm256_mul_pd(wv, uu), _mm256_mul_pd(wu, uv)), det);
+
+                // Outside unless every comparison fails, as in rectangle_hit
+                const __m256d outside = _mm256_or_pd(
+                    _mm256_or_pd(_mm256_cmp_pd(qa, zero, _CMP_LT_OQ), _mm256_cmp_pd(qa, one, _CMP_GT_OQ)),
+                    _mm256_or_pd(_mm256_cmp_pd(qb, zero, _CMP_LT_OQ), _mm256_cmp_pd(qb, one, _CMP_GT_OQ)));
+                const __m256d hit = _mm256_andnot_pd(outside, ok);
+
+                hi = _mm256_blendv_pd(hi, t, hit);
+                best_a = _mm256_blendv_pd(best_a, qa, hit);
+                best_b = _mm256_blendv_pd(best_b, qb, hit);
+                best = _mm256_castpd_si256(_mm256_blendv_pd(_mm256_castsi256_pd(best),
+                    _mm256_castsi256_pd(_mm256_set1_epi64x(static_cast<long long>(i))), hit));
+                updated = _mm256_or_pd(updated, hit);
+            }
+
+            const unsigned lanes = static_cast<unsigned>(_mm256_movemask_pd(updated));
+            if (!lanes) continue;
+
+            alignas(32) real ts[4], as[4], bs[4];
+            alignas(32) long long quads_hit[4];
+            _mm256_store_pd(ts, hi);
+            _mm256_store_pd(as, best_a);
+            _mm256_store_pd(bs, best_b);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(quads_hit), best);
+            for (int k = 0; k < 4; ++k)
+            {
+                if (!((lanes >> k) & 1u)) continue;
+                closest[g + k] = ts[k];
+                index[g + k] = static_cast<uint32_t>(quads_hit[k]);
+                a[g + k] = as[k];
+                b[g + k] = bs[k];
+            }
+            found |= lanes << g;
+        }
+        return found;
+    }
+#endif
+
+    bool occluded_leaf(size_t leaf, const ray& r, const interval& ray_t) const
+    {
+        const type_offsets& first = leaf_first[leaf];
+        const type_offsets& end = leaf_first[leaf + 1];
+        real t;
+        int part;
+
+        if (first[spheres] < end[spheres] && sphere_data.any(r, first[spheres], end[spheres], ray_t)) return true;
+
+        for (uint32_t i = first[quads]; i < end[quads]; ++i)
+        {
+            real a, b;
+            if (finite_plane::rectangle_hit(quad_data.origin[i], quad_data.edge_u[i], quad_data.edge_v[i], quad_data.normal[i],
+                quad_data.uu[i], quad_data.uv[i], quad_data.vv[i], quad_data.det[i], r, ray_t, t, a, b)) return true;
+        }
+
+        for (uint32_t i = first[planes]; i < end[planes]; ++i)
+        {
+            if (infinite_plane::crossing(plane_data.point[i], plane_data.normal[i], r, ray_t, t)) return true;
+        }
+
+        for (uint32_t i = first[infinite_cylinders]; i < end[infinite_cylinders]; ++i)
+        {
+            if (infinite_cylinder::nearest_t(infinite_cylinder_data.center[i], infinite_cylinder_data.dir[i], infinite_cylinder_data.radius[i],
+                r, ray_t, t)) return true;
+        }
+
+        for (uint32_t i = first[cylinders]; i < end[cylinders]; ++i)
+        {
+            if (cylinder::nearest_part(cylinder_data.center[i], cylinder_data.dir[i], cylinder_data.radius[i], cylinder_data.length[i],
+                r, ray_t, t, part)) return true;
+        }
+
+        for (uint32_t i = first[capsules]; i < end[capsules]; ++i)
+        {
+            if (capsule::nearest_part(capsule_data.center[i], capsule_data.dir[i], capsule_data.radius[i], capsule_data.length[i],
+                r, ray_t, t, part)) return true;
+        }
+
+        for (uint32_t i = first[others]; i < end[others]; ++i)
+        {
+            if (other_data.object[i]->occluded(r, ray_t)) return true;
+        }
+
+        return false;
+    }
+
+    // One build item per primitive, objects made of parts (boxes) are replaced by their parts under the same object ID
+    static void gather(const shared_ptr<hittable>& object, int id, std::vector<bvh_build::item>& items)
+    {
+        if (const std::vector<shared_ptr<hittable>>* parts = object->parts())
+        {
+            for (const shared_ptr<hittable>& part : *parts) gather(part, id, items);
+            return;
+        }
+
+        bvh_build::item it;
+        it.object = object;
+        it.id = id;
+        it.box = object->bounding_box();
+        it.centroid = it.box.centroid();
+        items.push_back(std::move(it));
+    }
+
+    type_offsets type_sizes() const
+    {
+        type_offsets sizes{};
+        sizes[spheres] = static_cast<uint32_t>(sphere_data.size());
+        sizes[quads] = static_cast<uint32_t>(quad_data.det.size());
+        sizes[planes] = static_cast<uint32_t>(plane_data.mat.size());
+        sizes[infinite_cylinders] = static_cast<uint32_t>(infinite_cylinder_data.radius.size());
+        sizes[cylinders] = static_cast<uint32_t>(cylinder_data.radius.size());
+        sizes[capsules] = static_cast<uint32_t>(capsule_data.radius.size());
+        sizes[others] = static_cast<uint32_t>(other_data.object.size());
+        return sizes;
+    }
+
+    static void add_axis(axis_array& data, const point3& center, const vec3& dir, real radius, real length, material_id mat, int id)
+    {
+        data.center.push_back(center);
+        data.dir.push_back(dir);
+        data.radius.push_back(radius);
+        data.length.push_back(length);
+        data.mat.push_back(mat);
+        data.id.push_back(id);
+    }
+
+    // Copy one primitive into its type's arrays (exact types only, a subclass may override the tests)
+    void add_primitive(const shared_ptr<hittable>& object, int id)
+    {
+        const hittable& h = *object;
+        const std::type_info& type = typeid(h);
+
+        if (type == typeid(sphere))
+        {
+            const sphere& s = static_cast<const sphere&>(h);
+            sphere_data.add(s.center, s.radius, s.mat);
+            sphere_ids.push_back(id);
+        }
+        else if (type == typeid(finite_plane))
+        {
+            const finite_plane& q = static_cast<const finite_plane&>(h);
+            quad_data.origin.push_back(q.p0);
+            quad_data.edge_u.push_back(q.u);
+            quad_data.edge_v.push_back(q.v);
+            quad_data.normal.push_back(q.n);
+            quad_data.uu.push_back(q.uu);
+            quad_data.uv.push_back(q.uv);
+            quad_data.vv.push_back(q.vv);
+            quad_data.det.push_back(q.det);
+            quad_data.mat.push_back(q.mat_);
+            quad_data.id.push_back(id);
+        }
+        else if (type == typeid(infinite_plane))
+        {
+            const infinite_plane& p = static_cast<const infinite_plane&>(h);
+            plane_data.point.push_back(p.p);
+            plane_data.normal.push_back(p.n);
+            plane_data.mat.push_back(p.mat_);
+            plane_data.id.push_back(id);
+        }
+        else if (type == typeid(infinite_cylinder))
+        {
+            const infinite_cylinder& c = static_cast<const infinite_cylinder&>(h);
+            add_axis(infinite_cylinder_data, c.center, c.dir, c.radius, 0.0, c.mat, id);
+        }
+        else if (type == typeid(cylinder))
+        {
+            const cylinder& c = static_cast<const cylinder&>(h);
+            add_axis(cylinder_data, c.center, c.dir, c.radius, c.length, c.mat, id);
+        }
+        else if (type == typeid(capsule))
+        {
+            const capsule& c = static_cast<const capsule&>(h);
+            add_axis(capsule_data, c.center, c.dir, c.radius, c.length, c.mat, id);
+        }
+        else
+        {
+            other_data.object.push_back(object.get());
+            other_data.owner.push_back(object);
+            other_data.id.push_back(id);
+        }
+    }
+
+    // Emit the subtree below node depth first like linear_bvh, a leaf's primitives go to the end of their type's arrays
+    int flatten(const std::vector<bvh_build::item>& items, const bvh_build::tree_node& tree, int depth)
+    {
+        const int index = static_cast<int>(nodes.size());
+        nodes.push_back(linear_bvh_node{});
+        tree_info.add_node(tree.box, depth);
+
+        {
+            linear_bvh_node& node = nodes.back();
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                node.bounds_min[axis] = bvh_build::float_below(tree.box.axis_interval(axis).min);
+                node.bounds_max[axis] = bvh_build::float_above(tree.box.axis_interval(axis).max);
+            }
+        }
+
+        if (tree.is_leaf() || sphere_run(items, tree))
+        {
+            linear_bvh_node& node = nodes[static_cast<size_t>(index)];
+            node.offset = static_cast<int32_t>(leaf_first.size());
+            node.primitive_count = static_cast<uint16_t>(tree.end - tree.begin);
+            tree_info.add_leaf(tree.box, tree.end - tree.begin);
+
+            leaf_first.push_back(type_sizes());
+            for (size_t i = tree.begin; i < tree.end; ++i)
+            {
+                add_primitive(items[i].object, source_ids[static_cast<size_t>(items[i].id)]);
+            }
+            return index;
+        }
+
+        flatten(items, *tree.child[0], depth + 1);
+        const int second = flatten(items, *tree.child[1], depth + 1);
+
+        linear_bvh_node& node = nodes[static_cast<size_t>(index)];
+        node.offset = second;
+        node.primitive_count = 0;
+        node.axis = static_cast<uint8_t>(bvh_build::split_axis(tree.child[0]->box, tree.child[1]->box));
+        return index;
+    }
+
+    // A subtree of at most sphere_leaf_size spheres, which the sphere kernel tests faster in one leaf than the tree can cull them
+    static bool sphere_run(const std::vector<bvh_build::item>& items, const bvh_build::tree_node& tree)
+    {
+        if (tree.end - tree.begin > sphere_leaf_size) return false;
+        for (size_t i = tree.begin; i < tree.end; ++i)
+        {
+            if (typeid(*items[i].object) != typeid(sphere)) return false;
+        }
+        return true;
+    }
+};
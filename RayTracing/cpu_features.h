@@ -0,0 +1,121 @@
+#pragma once
+// Runtime CPU feature detection for the SIMD code paths
+    // RT_X86 is set on x86/x64 builds, other targets only get the scalar paths
+    // RT_TARGET_AVX2 marks a function that may use AVX2/FMA intrinsics without building the whole program with /arch:AVX2 or -mavx2
+    // RT_FORCE_INLINE pulls a generic helper into such a function so the intrinsics inline into it as well
+    // RT_TARGET_AVX2_EXACT and RT_TARGET_AVX512_EXACT mark kernels that must round like the scalar code:
+    // they never fuse a multiply and an add into an FMA, so their results match the double precision scalar path bit for bit
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RT_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#else
+#define RT_X86 0
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define RT_TARGET_AVX2
+#define RT_TARGET_AVX2_EXACT
+#define RT_TARGET_AVX512_EXACT
+#define RT_FORCE_INLINE __forceinline
+#elif defined(__clang__)
+#define RT_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define RT_TARGET_AVX2_EXACT __attribute__((target("avx2")))
+#define RT_TARGET_AVX512_EXACT __attribute__((target("avx512f")))
+#define RT_FORCE_INLINE inline __attribute__((always_inline))
+#else
+// GCC fuses across statements (-ffp-contract=fast) once FMA instructions are available, AVX-512F always has them
+#define RT_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define RT_TARGET_AVX2_EXACT __attribute__((target("avx2")))
+#define RT_TARGET_AVX512_EXACT __attribute__((target("avx512f"), optimize("fp-contract=off")))
+#define RT_FORCE_INLINE inline __attribute__((always_inline))
+#endif
+
+enum class simd_isa {
+    scalar,
+    sse,    // SSE2, always present on x64
+    avx2,   // AVX2 and FMA
+    avx512  // AVX-512F (and everything avx2 has), later entries include the earlier ones
+};
+
+inline const char* simd_isa_name(simd_isa isa)
+{
+    switch (isa)
+    {
+    case simd_isa::sse: return "SSE";
+    case simd_isa::avx2: return "AVX2";
+    case simd_isa::avx512: return "AVX-512";
+    default: return "scalar";
+    }
+}
+
+// Widest instruction set both the CPU and the OS (saved YMM state) support, detected once
+inline simd_isa detect_simd_isa()
+{
+    static const simd_isa isa = []()
+    {
+#if RT_X86
+#if defined(_MSC_VER)
+        int info[4] = {};
+        __cpuid(info, 0);
+        const int max_leaf = info[0];
+
+        __cpuid(info, 1);
+        const bool sse2 = (info[3] & (1 << 26)) != 0;
+        const bool fma = (info[2] & (1 << 12)) != 0;
+        const bool osxsave = (info[2] & (1 << 27)) != 0;
+        const bool avx = (info[2] & (1 << 28)) != 0;
+
+        bool avx2 = false;
+        bool avx512f = false;
+        if (max_leaf >= 7)
+        {
+            __cpuidex(info, 7, 0);
+            avx2 = (info[1] & (1 << 5)) != 0;
+            avx512f = (info[1] & (1 << 16)) != 0;
+        }
+        const unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+        const bool ymm_state = (xcr0 & 0x6) == 0x6;
+        const bool zmm_state = (xcr0 & 0xE6) == 0xE6;
+#else
+        unsigned a = 0, b = 0, c = 0, d = 0;
+        const unsigned max_leaf = __get_cpuid_max(0, nullptr);
+
+        __cpuid(1, a, b, c, d);
+        const bool sse2 = (d & (1u << 26)) != 0;
+        const bool fma = (c & (1u << 12)) != 0;
+        const bool osxsave = (c & (1u << 27)) != 0;
+        const bool avx = (c & (1u << 28)) != 0;
+
+        bool avx2 = false;
+        bool avx512f = false;
+        if (max_leaf >= 7)
+        {
+            __cpuid_count(7, 0, a, b, c, d);
+            avx2 = (b & (1u << 5)) != 0;
+            avx512f = (b & (1u << 16)) != 0;
+        }
+
+        bool ymm_state = false;
+        bool zmm_state = false;
+        if (osxsave)
+        {
+            unsigned lo = 0, hi = 0;
+            __asm__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+            ymm_state = (lo & 0x6) == 0x6;
+            zmm_state = (lo & 0xE6) == 0xE6; // opmask and both halves of the ZMM registers saved as well
+        }
+#endif
+        if (avx && avx2 && fma && ymm_state && avx512f && zmm_state) return simd_isa::avx512;
+        if (avx && avx2 && fma && ymm_state) return simd_isa::avx2;
+        if (sse2) return simd_isa::sse;
+#endif
+        return simd_isa::scalar;
+    }();
+    return isa;
+}
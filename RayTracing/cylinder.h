@@ -1,48 +1,90 @@
 #pragma once
 #include "hittable.h"
 #include "infinite_cylinder.h"
-#include "infinite_plane.h"
 
 class cylinder : public hittable
 {
 public:
 	point3 center;
 	vec3 dir;
-	double radius;
-	double length;
-	shared_ptr<material> mat;
+	real radius;
+	real length;
+	material_id mat;
 
-	cylinder() : center(), dir(), radius(1), length(1), mat(nullptr) {}
-	cylinder(point3 c, vec3 d, double r, double l, shared_ptr<material> m) :
-		center(c), dir(unit_vector(d)), radius(r), length(l), mat(std::move(m)) {
+	cylinder() : center(), dir(), radius(1), length(1), mat(no_material) {}
+	cylinder(point3 c, vec3 d, real r, real l, material_id m) :
+		center(c), dir(unit_vector(d)), radius(r), length(l), mat(m) {
 	}
 
-	bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+	bool intersect(const ray& r, interval ray_t, hit_record& rec) const override
 	{
-		// check for infinite by checking for colision on the plane then checking 
-		// where it is along the infinite cylindar
-		// if its on the end treat it like a plane if not treat it like a sphere
+		if (!nearest_part(center, dir, radius, length, r, ray_t, rec.t, rec.part)) return false;
+		rec.surface = this;
+		return true;
+	}
+
+	void finalize(const ray& r, hit_record& rec) const override
+	{
+		finalize_part(center, dir, radius, mat, rec.part, r, rec);
+	}
+
+	bool occluded(const ray& r, interval ray_t) const override
+	{
+		real t;
+		int part;
+		return nearest_part(center, dir, radius, length, r, ray_t, t, part);
+	}
+
+	// Side first, a hit past the ends falls back to the caps it faces (part 0 side, 1 top cap, 2 bottom cap)
+		// static so compiled scenes can run it on their cylinder arrays
+	static bool nearest_part(const point3& center, const vec3& dir, real radius, real length, const ray& r, const interval& ray_t,
+		real& t, int& part)
+	{
+		if (!infinite_cylinder::nearest_t(center, dir, radius, r, ray_t, t)) return false;
+
+		part = 0;
+		if (project(r.at(t) - center, dir).length() <= length) return true;
 
-		infinite_cylinder ic(center, dir, radius, mat);
+		part = 1;
+		if (cap_hit(r, ray_t, center + dir * length, dir, radius, t)) return true;
 
-		if (ic.hit(r, ray_t, rec))
+		part = 2;
+		return cap_hit(r, ray_t, center - dir * length, -dir, radius, t);
+	}
+
+	// Surface interaction of a hit nearest_part() found
+	static void finalize_part(const point3& center, const vec3& dir, real radius, material_id mat, int part,
+		const ray& r, hit_record& rec)
+	{
+		if (part == 0)
 		{
-			if(project(rec.p - center, dir).length() <= length)
-				return true;
-
-			point3 tempPoint = center + dir * length;
-			infinite_plane plane(tempPoint, dir, mat);
-			bool result = plane.hit(r, ray_t, rec);
-			if (result && rec.front_face && (rec.p - tempPoint).length() <= radius)
-				return true;
-
-			tempPoint = center - dir * length;
-			plane = infinite_plane(tempPoint, -dir, mat);
-			result = plane.hit(r, ray_t, rec);
-			if (result && rec.front_face && (rec.p - tempPoint).length() <= radius)
-				return true;
+			infinite_cylinder::finalize_side(center, dir, radius, mat, r, rec);
+			return;
 		}
 
-		return false;
+		rec.p = r.at(rec.t);
+		rec.u = rec.v = 0.0;
+		rec.mat = mat;
+		rec.set_face_normal(r, unit_vector(part == 1 ? dir : -dir));
+	}
+
+	// Segment between the cap centers grown by the radius
+	aabb bounding_box() const override
+	{
+		const real pad = 2.0 * std::fabs(radius);
+		aabb axis(center - dir * length, center + dir * length);
+		return aabb(axis.x.expand(pad), axis.y.expand(pad), axis.z.expand(pad));
+	}
+
+private:
+	// Front side of the cap disk at cap_center facing along normal
+	static bool cap_hit(const ray& r, const interval& ray_t, const point3& cap_center, const vec3& normal, real radius, real& t)
+	{
+		const vec3 n = unit_vector(normal);
+		const real denom = dot(n, r.direction());
+		if (std::fabs(denom) < tolerance<real>::parallel || denom >= 0) return false;
+
+		t = dot(cap_center - r.origin(), n) / denom;
+		return ray_t.contains(t) && (r.at(t) - cap_center).length() <= radius;
 	}
 };
@@ -10,8 +10,8 @@ public:
     finite_plane(const point3& p0_in,
         const vec3& u_in,
         const vec3& v_in,
-        shared_ptr<material> mat_in)
-        : p0(p0_in), u(u_in), v(v_in), mat_(std::move(mat_in))
+        material_id mat_in)
+        : p0(p0_in), u(u_in), v(v_in), mat_(mat_in)
     {
         n = unit_vector(cross(u, v));
         uu = dot(u, u);
@@ -20,41 +20,70 @@ public:
         det = uu * vv - uv * uv;
     }
 
-    bool hit(const ray& r, interval ray_t, hit_record& rec) const override 
+    // Keeps the rectangle coordinates of the hit in u/v
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override 
     {
-        const double denom = dot(n, r.direction());
-        if (fabs(denom) < 1e-8) return false; // parallel
+        real t, a, b;
+        if (!rectangle_hit(p0, u, v, n, uu, uv, vv, det, r, ray_t, t, a, b)) return false;
 
-        const double t = dot(p0 - r.origin(), n) / denom;
-        if (!ray_t.contains(t)) return false;
+        rec.t = t;
+        rec.u = a;
+        rec.v = b;
+        rec.surface = this;
+        return true;
+    }
 
-        const point3 p = r.at(t);
+    void finalize(const ray& r, hit_record& rec) const override
+    {
+        rec.p = r.at(rec.t);
+        rec.mat = mat_;
+        rec.set_face_normal(r, n);
+    }
 
-        const vec3 w = p - p0;
+    bool occluded(const ray& r, interval ray_t) const override
+    {
+        real t, a, b;
+        return rectangle_hit(p0, u, v, n, uu, uv, vv, det, r, ray_t, t, a, b);
+    }
 
-        if (fabs(det) < 1e-12) return false;
+    // Plane hit inside ray_t that lies within the rectangle p0 + a u + b v, a and b are its coordinates along u and v
+        // uu, uv, vv and det are the rectangle's Gram terms, static so compiled scenes can run it on their quad arrays
+    static bool rectangle_hit(const point3& p0, const vec3& u, const vec3& v, const vec3& n, real uu, real uv, real vv, real det,
+        const ray& r, const interval& ray_t, real& t, real& a, real& b)
+    {
+        const real denom = dot(n, r.direction());
+        if (std::fabs(denom) < tolerance<real>::parallel) return false;
 
-        const double wu = dot(w, u);
-        const double wv = dot(w, v);
+        t = dot(p0 - r.origin(), n) / denom;
+        if (!ray_t.contains(t)) return false;
 
-        const double a = (wu * vv - wv * uv) / det;
-        const double b = (wv * uu - wu * uv) / det;
+        const vec3 w = r.at(t) - p0;
 
-        if (a < 0.0 || a > 1.0 || b < 0.0 || b > 1.0) return false;
+        if (std::fabs(det) < tolerance<real>::degenerate) return false;
 
-        rec.t = t;
-        rec.p = p;
-        rec.mat = mat_;
-        rec.set_face_normal(r, n);
+        const real wu = dot(w, u);
+        const real wv = dot(w, v);
 
-        return true;
+        a = (wu * vv - wv * uv) / det;
+        b = (wv * uu - wu * uv) / det;
+
+        return !(a < 0.0 || a > 1.0 || b < 0.0 || b > 1.0);
+    }
+    aabb bounding_box() const override
+    {
+        aabb diagonal1(p0, p0 + u + v);
+        aabb diagonal2(p0 + u, p0 + v);
+        return aabb(diagonal1, diagonal2);
     }
 
 private:
+    friend class compiled_scene;
+
     point3 p0;
     vec3 u, v;
     vec3 n;
-    shared_ptr<material> mat_;
+    material_id mat_ = no_material;
+
+    real uu = 0.0, uv = 0.0, vv = 0.0, det = 0.0;
 
-    double uu = 0.0, uv = 0.0, vv = 0.0, det = 0.0;
 };
\ No newline at end of file
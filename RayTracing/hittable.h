@@ -1,20 +1,34 @@
 #pragma once
+#include <vector>
+
 #include "rtweekend.h"
+#include "aabb.h"
+#include "material_table.h"
+#include "ray_packet.h"
 
 // Declares the base interface for all renderable objects
     // hit_record structure used to store intersection details
+    // intersection runs in two phases: intersect() finds the closest t (and which primitive) for every candidate,
+    // finalize() then computes the hit point, normal, UV and material once for the winning hit
+
+class hittable;
 
-class material;
 struct hit_record 
 {
     point3 p;
     vec3 normal;
-    shared_ptr<material> mat;
-    double t{};
+    material_id mat = no_material; // index into the scene's material_table
+    real t{};
     bool front_face{};
 
-    double u = 0.0;   
-    double v = 0.0; 
+    real u = 0.0;   
+    real v = 0.0; 
+
+    int object_id = -1; // index of the hit object in the top level hittable_list (object ID output)
+
+    const hittable* surface = nullptr; // primitive whose finalize() completes this record
+    int part = 0;                      // which piece of a compound primitive was hit (cylinder cap, capsule end)
+    int primitive = -1;                // which primitive inside surface, for surfaces that hold many (compiled scenes)
 
     void set_face_normal(const ray& r, const vec3& outward_normal)
     {
@@ -27,5 +41,52 @@ class hittable
 {
 public:
     virtual ~hittable() = default;
-    virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
+
+    // Closest hit inside ray_t with the full surface interaction (point, normal, UV, material)
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const
+    {
+        if (!intersect(r, ray_t, rec)) return false;
+        rec.surface->finalize(r, rec);
+        return true;
+    }
+
+    // Closest hit inside ray_t, cheap phase: sets only t, surface and whatever the primitive needs to finish later
+        // (parametric coordinates in u/v, part), containers and acceleration structures also set object_id
+        // may write to rec even when it misses
+    virtual bool intersect(const ray& r, interval ray_t, hit_record& rec) const = 0;
+
+    // intersect() for every ray of a packet, recs[k] receives ray k's record and bit k of the result says whether it hit
+        // the default traces the rays one at a time, structures that can walk their tree once for the whole packet override it
+    virtual unsigned intersect_packet(const ray_packet& rays, interval ray_t, hit_record* recs) const
+    {
+        unsigned hits = 0;
+        for (int k = 0; k < rays.count; ++k)
+        {
+            if (intersect(rays.get(k), ray_t, recs[k])) hits |= 1u << k;
+        }
+        return hits;
+    }
+
+    // True when intersect_packet() walks the structure once per packet instead of looping over the rays
+        // the camera only builds packets for scenes where this holds, gathering them costs time the default never wins back
+    virtual bool traces_packets() const { return false; }
+
+    // Fills p, normal, front_face, u/v and mat for a record this primitive's intersect() produced
+    virtual void finalize(const ray&, hit_record&) const {}
+
+    // Any-hit query for shadow and visibility rays: true if the ray hits anything inside ray_t
+        // stops at the first intersection found and fills no hit_record, so it agrees with hit() returning true
+        // the default runs intersect() into a scratch record, shapes and acceleration structures override it with the cheaper test
+    virtual bool occluded(const ray& r, interval ray_t) const
+    {
+        hit_record rec;
+        return intersect(r, ray_t, rec);
+    }
+
+    // Objects this one is made of (a box's faces), nullptr for a single primitive
+        // a compiled scene flattens them into its own primitive arrays
+    virtual const std::vector<shared_ptr<hittable>>* parts() const { return nullptr; }
+
+    // Box enclosing every point hit() can return
+    virtual aabb bounding_box() const = 0;
 };
@@ -1,33 +1,97 @@
 #pragma once
 #include <vector>
 #include "hittable.h"
+#include "scene_accelerator.h"
 
 // Container for multiple hittable objects that tests a ray against all objects and returns the closest valid hit
+    // build_bvh() puts an acceleration structure over the objects, hit() then goes through it instead of the linear loop
+    // a list used as a scene owns the scene's materials, its objects refer to them by material_id
 class hittable_list : public hittable {
 public:
     std::vector<shared_ptr<hittable>> objects;
+    material_table materials;
 
     hittable_list() = default;
     explicit hittable_list(shared_ptr<hittable> object) { add(std::move(object)); }
 
-    void clear() { objects.clear(); }
-    void add(shared_ptr<hittable> object) { objects.push_back(std::move(object)); }
+    void clear()
+    {
+        objects.clear();
+        materials.clear();
+        bbox = aabb::empty;
+        accel.reset();
+        accel_info = accelerator_info();
+    }
+
+    // Adding an object drops the BVH, call build_bvh() again once the list is complete
+    void add(shared_ptr<hittable> object)
+    {
+        bbox = aabb(bbox, object->bounding_box());
+        objects.push_back(std::move(object));
+        accel.reset();
+        accel_info = accelerator_info();
+    }
+
+    // Build a SAH bounding volume hierarchy over the current objects (object IDs stay the list indices)
+        // unbounded objects are kept beside it, or clipped to the other objects' bounds (see unbounded_mode)
+    void build_bvh(accelerator kind = default_accelerator, unbounded_mode mode = unbounded_mode::separate)
+    {
+        accel.reset();
+        accel_info = accelerator_info();
+        if (objects.empty() || kind == accelerator::none) return;
+
+        accel = make_shared<scene_accelerator>(objects, kind, mode);
+        accel_info = accel->info();
+    }
 
-    bool hit(const ray& r, interval ray_t, hit_record& rec) const override 
+    bool has_bvh() const { return accel != nullptr; }
+    const accelerator_info& accelerator_details() const { return accel_info; }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override 
     {
+        if (accel) return accel->intersect(r, ray_t, rec);
+
         hit_record temp_rec;
         bool hit_anything = false;
-        double closest = ray_t.max;
+        real closest = ray_t.max;
 
-        for (const std::shared_ptr<hittable>& object : objects) 
+        for (size_t i = 0; i < objects.size(); ++i) 
         {
-            if (object->hit(r, interval(ray_t.min, closest), temp_rec)) 
+            if (objects[i]->intersect(r, interval(ray_t.min, closest), temp_rec)) 
             {
                 hit_anything = true;
                 closest = temp_rec.t;
                 rec = temp_rec;
+                rec.object_id = static_cast<int>(i);
             }
         }
         return hit_anything;
     }
+
+    unsigned intersect_packet(const ray_packet& rays, interval ray_t, hit_record* recs) const override
+    {
+        if (accel) return accel->intersect_packet(rays, ray_t, recs);
+        return hittable::intersect_packet(rays, ray_t, recs);
+    }
+
+    bool traces_packets() const override { return accel && accel->traces_packets(); }
+
+    // Any object hit inside ray_t, the first one found ends the loop
+    bool occluded(const ray& r, interval ray_t) const override
+    {
+        if (accel) return accel->occluded(r, ray_t);
+
+        for (const shared_ptr<hittable>& object : objects)
+        {
+            if (object->occluded(r, ray_t)) return true;
+        }
+        return false;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+private:
+    aabb bbox = aabb::empty;
+    shared_ptr<scene_accelerator> accel;
+    accelerator_info accel_info;
 };
@@ -20,7 +20,7 @@ public:
         if (data) stbi_image_free(data);
     }
 
-    color value(double u, double v, const point3&) const override {
+    color value(real u, real v, const point3&) const override {
         if (!data) return color(1, 0, 1); // magenta if missing
 
         u = (u < 0) ? 0 : (u > 1 ? 1 : u);
@@ -30,7 +30,7 @@ public:
         int j = static_cast<int>((1.0 - v) * (height - 1)); // flip v
 
         const unsigned char* pixel = data + j * bytes_per_scanline + i * 3;
-        const double scale = 1.0 / 255.0;
+        const real scale = 1.0 / 255.0;
 
         return color(pixel[0] * scale, pixel[1] * scale, pixel[2] * scale);
     }
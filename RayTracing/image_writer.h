@@ -0,0 +1,389 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "rtweekend.h"
+#include "thread_pool.h"
+#include "tile_scheduler.h"
+// Encodes linear framebuffers into PPM files
+    // tone-maps (gamma 2) and quantizes rows in parallel into one byte buffer
+    // then writes the whole file with a single write call
+    // or streams bands of rows to disk while the rest of the image is still rendering
+
+enum class image_format {
+    ppm_ascii,    // P3, 8-bit text (original output)
+    ppm_binary,   // P6, 8-bit
+    ppm_binary16  // P6, 16-bit big endian
+};
+
+// Gamma lookup table for 8-bit output
+    // entry b is the smallest linear value that maps to byte b under int(256 * clamp(sqrt(x), 0, 0.999)) from the old write_color
+    // that is (b / 256)^2 or a few ulps below it, where sqrt already rounds up to b / 256
+    // quantizing is a search through 255 thresholds instead of a sqrt per channel
+inline const std::array<double, 256>& gamma_lut()
+{
+    static const std::array<double, 256> table = []()
+        {
+            std::array<double, 256> t{};
+            for (int b = 0; b < 256; ++b)
+            {
+                const double g = static_cast<double>(b) / 256.0;
+                double x = g * g;
+                while (x > 0.0 && std::sqrt(std::nextafter(x, 0.0)) >= g) x = std::nextafter(x, 0.0);
+                t[static_cast<size_t>(b)] = x;
+            }
+            return t;
+        }();
+    return table;
+}
+
+inline uint8_t quantize8(double linear)
+{
+    // Zero, negatives and NaN all land on 0 (like quantize16), upper_bound alone would put NaN past the end of the table
+    if (!(linear > 0.0)) return 0;
+
+    const std::array<double, 256>& t = gamma_lut();
+    size_t b = static_cast<size_t>(std::upper_bound(t.begin() + 1, t.end(), linear) - t.begin()) - 1;
+    return static_cast<uint8_t>(b);
+}
+
+inline uint16_t quantize16(double linear)
+{
+    if (!(linear > 0.0)) return 0;
+
+    double g = std::sqrt(linear);
+    if (g >= 65535.0 / 65536.0) return 65535;
+    return static_cast<uint16_t>(65536.0 * g);
+}
+
+inline std::string image_header(image_format format, int width, int height)
+{
+    const char* magic = (format == image_format::ppm_ascii) ? "P3" : "P6";
+    const int maxval = (format == image_format::ppm_binary16) ? 65535 : 255;
+
+    return std::string(magic) + "\n" + std::to_string(width) + " " + std::to_string(height) + "\n" + std::to_string(maxval) + "\n";
+}
+
+// Encoded size of one row (ascii rows are variable length and encoded separately)
+inline size_t image_row_bytes(image_format format, int width)
+{
+    return static_cast<size_t>(width) * 3 * ((format == image_format::ppm_binary16) ? 2 : 1);
+}
+
+// Encode pixels [row * width, (row + 1) * width) into dst
+    // pixel(k) returns the final linear color of pixel k (already averaged)
+template <typename PixelFn>
+void encode_row(image_format format, int width, int row, const PixelFn& pixel, unsigned char* dst)
+{
+    const size_t base = static_cast<size_t>(row) * static_cast<size_t>(width);
+
+    for (int i = 0; i < width; ++i)
+    {
+        color c = pixel(base + static_cast<size_t>(i));
+
+        if (format == image_format::ppm_binary16)
+        {
+            for (int ch = 0; ch < 3; ++ch)
+            {
+                uint16_t q = quantize16(c[ch]);
+                *dst++ = static_cast<unsigned char>(q >> 8);
+                *dst++ = static_cast<unsigned char>(q & 0xFF);
+            }
+        }
+        else
+        {
+            *dst++ = quantize8(c.x());
+            *dst++ = quantize8(c.y());
+            *dst++ = quantize8(c.z());
+        }
+    }
+}
+
+template <typename PixelFn>
+std::string encode_row_ascii(int width, int row, const PixelFn& pixel)
+{
+    std::string text;
+    text.reserve(static_cast<size_t>(width) * 12);
+
+    const size_t base = static_cast<size_t>(row) * static_cast<size_t>(width);
+    for (int i = 0; i < width; ++i)
+    {
+        color c = pixel(base + static_cast<size_t>(i));
+        text += std::to_string(quantize8(c.x()));
+        text += ' ';
+        text += std::to_string(quantize8(c.y()));
+        text += ' ';
+        text += std::to_string(quantize8(c.z()));
+        text += '\n';
+    }
+    return text;
+}
+
+// Encode a whole image (header included), rows are split across the pool when one is given
+template <typename PixelFn>
+std::vector<unsigned char> encode_image(image_format format, int width, int height, const PixelFn& pixel, thread_pool* pool)
+{
+    const std::string header = image_header(format, width, height);
+    const int rows_per_task = 16;
+    const int task_count = (height + rows_per_task - 1) / rows_per_task;
+
+    auto for_each_block = [&](const std::function<void(int, int)>& fn)
+        {
+            if (pool && pool->size() > 1 && task_count > 1)
+            {
+                pool->submit_range(task_count, [&](int task, unsigned)
+                    {
+                        fn(task * rows_per_task, std::min(height, (task + 1) * rows_per_task));
+                    });
+                pool->wait();
+            }
+            else
+            {
+                fn(0, height);
+            }
+        };
+
+    std::vector<unsigned char> bytes;
+
+    if (format == image_format::ppm_ascii)
+    {
+        std::vector<std::string> rows(static_cast<size_t>(height));
+        for_each_block([&](int y0, int y1)
+            {
+                for (int j = y0; j < y1; ++j)
+                {
+                    rows[static_cast<size_t>(j)] = encode_row_ascii(width, j, pixel);
+                }
+            });
+
+        size_t total = header.size();
+        for (const std::string& r : rows) total += r.size();
+
+        bytes.reserve(total);
+        bytes.insert(bytes.end(), header.begin(), header.end());
+        for (const std::string& r : rows) bytes.insert(bytes.end(), r.begin(), r.end());
+        return bytes;
+    }
+
+    const size_t row_bytes = image_row_bytes(format, width);
+    bytes.resize(header.size() + row_bytes * static_cast<size_t>(height));
+    std::copy(header.begin(), header.end(), bytes.begin());
+
+    unsigned char* body = bytes.data() + header.size();
+    for_each_block([&](int y0, int y1)
+        {
+            for (int j = y0; j < y1; ++j)
+            {
+                encode_row(format, width, j, pixel, body + row_bytes * static_cast<size_t>(j));
+            }
+        });
+
+    return bytes;
+}
+
+// Encode and write an image with one write call
+    // written to a temporary file and renamed over the target so a valid image is on disk at all times
+template <typename PixelFn>
+bool write_image_file(const std::filesystem::path& outPath, image_format format, int width, int height, const PixelFn& pixel, thread_pool* pool)
+{
+    std::vector<unsigned char> bytes = encode_image(format, width, height, pixel, pool);
+
+    std::filesystem::path tmpPath = outPath;
+    tmpPath += ".tmp";
+
+    {
+        std::ofstream out(tmpPath, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!out)
+        {
+            std::cerr << "ERROR: Failed to open output file: " << tmpPath.string() << "\n";
+            return false;
+        }
+
+        out.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        if (!out)
+        {
+            std::cerr << "ERROR: Failed to write output file: " << tmpPath.string() << "\n";
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmpPath, outPath, ec);
+    if (ec)
+    {
+        std::cerr << "ERROR: Failed to replace output file: " << outPath.string() << " (" << ec.message() << ")\n";
+        return false;
+    }
+
+    return true;
+}
+
+// Streams an image to disk while it renders
+    // the image is split into bands of band_height rows, a band is ready once every tile covering it has finished
+    // the worker finishing a band encodes it into the reorder buffer
+    // flush() appends ready bands to the file in order, bands that finish early wait until the ones above them are written
+    // finish() writes whatever is left and renames the temporary file over the target
+class image_stream_writer {
+public:
+    using pixel_fn = std::function<color(size_t)>;
+
+    image_stream_writer(const std::filesystem::path& outPath, image_format format, int width, int height, int band_height, pixel_fn pixel)
+        : path(outPath), format(format), width(width), height(height), pixel(std::move(pixel))
+    {
+        rows_per_band = std::max(1, band_height);
+        band_count = (height + rows_per_band - 1) / rows_per_band;
+
+        pixels_left.resize(static_cast<size_t>(band_count));
+        for (int b = 0; b < band_count; ++b)
+        {
+            pixels_left[static_cast<size_t>(b)] = width * (std::min(height, (b + 1) * rows_per_band) - b * rows_per_band);
+        }
+
+        tmpPath = path;
+        tmpPath += ".tmp";
+
+        out.open(tmpPath, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!out)
+        {
+            std::cerr << "ERROR: Failed to open output file: " << tmpPath.string() << "\n";
+            return;
+        }
+
+        const std::string header = image_header(format, width, height);
+        out.write(header.data(), static_cast<std::streamsize>(header.size()));
+    }
+
+    image_stream_writer(const image_stream_writer&) = delete;
+    image_stream_writer& operator=(const image_stream_writer&) = delete;
+
+    // Called by a worker once every pixel of t is final, tiles must not straddle two bands
+    void tile_done(const tile& t)
+    {
+        const int band = t.y0 / rows_per_band;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pixels_left[static_cast<size_t>(band)] -= t.pixel_count();
+            if (pixels_left[static_cast<size_t>(band)] > 0) return;
+        }
+
+        std::vector<unsigned char> bytes = encode_band(band);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        ready.emplace(band, std::move(bytes));
+    }
+
+    // Write every band that is next in line, returns the number of bands written so far
+    int flush()
+    {
+        while (true)
+        {
+            std::vector<unsigned char> bytes;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                std::map<int, std::vector<unsigned char>>::iterator it = ready.find(next_band);
+                if (it == ready.end()) break;
+
+                bytes = std::move(it->second);
+                ready.erase(it);
+            }
+
+            if (out) out.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+            ++next_band;
+        }
+        return next_band;
+    }
+
+    // Write the remaining bands (encoding any that never reported in) and move the file into place
+    bool finish()
+    {
+        flush();
+
+        for (; next_band < band_count; ++next_band)
+        {
+            std::vector<unsigned char> bytes;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                std::map<int, std::vector<unsigned char>>::iterator it = ready.find(next_band);
+                if (it != ready.end()) bytes = std::move(it->second);
+            }
+            if (bytes.empty()) bytes = encode_band(next_band);
+
+            if (out) out.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        }
+
+        if (!out)
+        {
+            std::cerr << "ERROR: Failed to write output file: " << tmpPath.string() << "\n";
+            return false;
+        }
+        out.close();
+
+        std::error_code ec;
+        std::filesystem::rename(tmpPath, path, ec);
+        if (ec)
+        {
+            std::cerr << "ERROR: Failed to replace output file: " << path.string() << " (" << ec.message() << ")\n";
+            return false;
+        }
+
+        return true;
+    }
+
+    const std::filesystem::path& output_path() const { return path; }
+
+private:
+    std::filesystem::path path;
+    std::filesystem::path tmpPath;
+    image_format format;
+    int width = 0;
+    int height = 0;
+    pixel_fn pixel;
+
+    int rows_per_band = 16;
+    int band_count = 0;
+
+    std::ofstream out;     // only touched by the flushing thread
+    int next_band = 0;     // first band not yet on disk
+
+    std::mutex mutex;
+    std::vector<int> pixels_left;                         // per band, pixels still rendering
+    std::map<int, std::vector<unsigned char>> ready;      // reorder buffer, encoded bands waiting for their turn
+
+    std::vector<unsigned char> encode_band(int band) const
+    {
+        const int y0 = band * rows_per_band;
+        const int y1 = std::min(height, y0 + rows_per_band);
+
+        std::vector<unsigned char> bytes;
+
+        if (format == image_format::ppm_ascii)
+        {
+            for (int j = y0; j < y1; ++j)
+            {
+                std::string text = encode_row_ascii(width, j, pixel);
+                bytes.insert(bytes.end(), text.begin(), text.end());
+            }
+            return bytes;
+        }
+
+        const size_t row_bytes = image_row_bytes(format, width);
+        bytes.resize(row_bytes * static_cast<size_t>(y1 - y0));
+        for (int j = y0; j < y1; ++j)
+        {
+            encode_row(format, width, j, pixel, bytes.data() + row_bytes * static_cast<size_t>(j - y0));
+        }
+        return bytes;
+    }
+};
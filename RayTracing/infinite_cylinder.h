@@ -6,29 +6,63 @@ class infinite_cylinder : public hittable
 public:
 	point3 center;
 	vec3 dir;
-	double radius;
-	shared_ptr<material> mat;
+	real radius;
+	material_id mat;
 
-	infinite_cylinder() : center(), dir(), radius(1), mat(nullptr) {}
-	infinite_cylinder(point3 c, vec3 d, double r, shared_ptr<material> m) :
-		center(c), dir(unit_vector(d)), radius(r), mat(std::move(m)) {
+	infinite_cylinder() : center(), dir(), radius(1), mat(no_material) {}
+	infinite_cylinder(point3 c, vec3 d, real r, material_id m) :
+		center(c), dir(unit_vector(d)), radius(r), mat(m) {
 	}
 
-	bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+	bool intersect(const ray& r, interval ray_t, hit_record& rec) const override
 	{
-		//check the colision as if its 2d
-		point3 pointOnPlane = r.origin() - project(r.origin() - center, dir);
-		vec3 dirOnPlane = r.direction() - project(r.direction(), dir);
-		ray rayOnPlane(pointOnPlane, dirOnPlane);
-		sphere s(center, radius, mat);
+		if (!nearest_t(center, dir, radius, r, ray_t, rec.t)) return false;
+
+		rec.surface = this;
+		return true;
+	}
 
-		//this hits the infinite plane
-		if (s.hit(rayOnPlane, ray_t, rec))
+	void finalize(const ray& r, hit_record& rec) const override
+	{
+		finalize_side(center, dir, radius, mat, r, rec);
+	}
+
+	bool occluded(const ray& r, interval ray_t) const override
+	{
+		real t;
+		return nearest_t(center, dir, radius, r, ray_t, t);
+	}
+
+	// Check the colision as if its 2d: the ray projected onto the plane across the axis against the circle
+	static bool nearest_t(const point3& center, const vec3& dir, real radius, const ray& r, const interval& ray_t, real& t)
+	{
+		return sphere::nearest_root(center, radius, project_ray(center, dir, r), ray_t, t);
+	}
+
+	// Surface interaction of a side hit at rec.t (also used by the shapes built from the side)
+		// normal and UV come from the circle the projected ray hit, the point from the original ray
+	static void finalize_side(const point3& center, const vec3& dir, real radius, material_id mat, const ray& r, hit_record& rec)
+	{
+		sphere::finalize_hit(center, radius, mat, project_ray(center, dir, r), rec);
+		rec.p = r.origin() + r.direction() * rec.t;
+	}
+
+	// Unbounded along every axis the cylinder's direction has a component in
+	aabb bounding_box() const override
+	{
+		interval axes[3] = { interval::universe, interval::universe, interval::universe };
+		for (int k = 0; k < 3; ++k)
 		{
-			rec.p = r.origin() + r.direction() * rec.t;
-			return true;
+			if (dir[k] == 0.0) axes[k] = interval(center[k] - std::fabs(radius), center[k] + std::fabs(radius));
 		}
+		return aabb(axes[0], axes[1], axes[2]);
+	}
 
-		return false;
+private:
+	static ray project_ray(const point3& center, const vec3& dir, const ray& r)
+	{
+		point3 pointOnPlane = r.origin() - project(r.origin() - center, dir);
+		vec3 dirOnPlane = r.direction() - project(r.direction(), dir);
+		return ray(pointOnPlane, dirOnPlane);
 	}
 };
\ No newline at end of file
@@ -7,34 +7,61 @@ public:
 
     infinite_plane(const point3& point_on_plane,
         const vec3& normal,
-        shared_ptr<material> mat)
+        material_id mat)
         : p(point_on_plane),
         n(unit_vector(normal)),
-        mat_(std::move(mat))
+        mat_(mat)
     {
     }
 
-    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-        const double denom = dot(n, r.direction());
-        if (std::fabs(denom) < 1e-8) {
-            return false;
-        }
-
-        const double t = dot(p - r.origin(), n) / denom;
-        if (!ray_t.contains(t)) {
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        real t;
+        if (!crossing(p, n, r, ray_t, t)) {
             return false;
         }
 
         rec.t = t;
-        rec.p = r.at(t);
+        rec.surface = this;
+        return true;
+    }
+
+    void finalize(const ray& r, hit_record& rec) const override {
+        rec.p = r.at(rec.t);
         rec.mat = mat_;
         rec.set_face_normal(r, n);
+    }
 
-        return true;
+    bool occluded(const ray& r, interval ray_t) const override {
+        real t;
+        return crossing(p, n, r, ray_t, t);
+    }
+
+    // Where the ray crosses the plane through p with unit normal n, false if that is outside ray_t (or the ray runs parallel)
+    static bool crossing(const point3& p, const vec3& n, const ray& r, const interval& ray_t, real& t) {
+        const real denom = dot(n, r.direction());
+        if (std::fabs(denom) < tolerance<real>::parallel) {
+            return false;
+        }
+
+        t = dot(p - r.origin(), n) / denom;
+        return ray_t.contains(t);
+    }
+    // Only bounded along an axis the plane is perpendicular to
+    aabb bounding_box() const override
+    {
+        interval axes[3] = { interval::universe, interval::universe, interval::universe };
+        for (int k = 0; k < 3; ++k)
+        {
+            if (std::fabs(n[k]) == 1.0) axes[k] = interval(p[k], p[k]);
+        }
+        return aabb(axes[0], axes[1], axes[2]);
     }
 
 private:
+    friend class compiled_scene;
+
     point3 p;
     vec3 n;
-    shared_ptr<material> mat_;
+    material_id mat_ = no_material;
+
 };
\ No newline at end of file
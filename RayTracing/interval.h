@@ -1,23 +1,42 @@
 #pragma once
 #include <limits>
+
+#include "precision.h"
 // Defines a numeric interval (min, max) used for valid ray hit ranges, clamping, and avoiding invalid intersections
-class interval {
+    // a template on the scalar type like vec3_t, the renderer's interval is interval_t<real>
+template <typename T>
+class interval_t {
 public:
-    double min, max;
+    T min, max;
+
+    constexpr interval_t() : min(+std::numeric_limits<T>::infinity()),
+        max(-std::numeric_limits<T>::infinity()) {}
+
+    constexpr interval_t(T _min, T _max) : min(_min), max(_max) {}
 
-    interval() : min(+std::numeric_limits<double>::infinity()),
-        max(-std::numeric_limits<double>::infinity()) {}
+    // Tightest interval enclosing both
+    constexpr interval_t(const interval_t& a, const interval_t& b)
+        : min(a.min <= b.min ? a.min : b.min), max(a.max >= b.max ? a.max : b.max) {}
 
-    interval(double _min, double _max) : min(_min), max(_max) {}
+    T size() const { return max - min; }
 
-    bool contains(double x) const { return min <= x && x <= max; }
-    bool surrounds(double x) const { return min < x && x < max; }
+    bool contains(T x) const { return min <= x && x <= max; }
+    bool surrounds(T x) const { return min < x && x < max; }
 
-    static const interval empty, universe;
+    interval_t expand(T delta) const
+    {
+        T padding = delta / 2;
+        return interval_t(min - padding, max + padding);
+    }
+
+    static const interval_t empty, universe;
 };
 
-inline const interval interval::empty(+std::numeric_limits<double>::infinity(),
-    -std::numeric_limits<double>::infinity());
+// Constant initialized (constexpr constructors), so other statics such as aabb::empty can be built from them
+template <typename T>
+const interval_t<T> interval_t<T>::empty(+std::numeric_limits<T>::infinity(), -std::numeric_limits<T>::infinity());
+
+template <typename T>
+const interval_t<T> interval_t<T>::universe(-std::numeric_limits<T>::infinity(), +std::numeric_limits<T>::infinity());
 
-inline const interval interval::universe(-std::numeric_limits<double>::infinity(),
-    +std::numeric_limits<double>::infinity());
+using interval = interval_t<real>;
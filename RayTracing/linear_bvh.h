@@ -0,0 +1,239 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "hittable.h"
+#include "bvh_build.h"
+// Compiled (flattened) bounding volume hierarchy
+    // flattens the binary SAH tree from bvh_build::build_tree
+    // nodes are 32 bytes and stored depth first in one array, a node's first child is the next node
+    // interior nodes store the offset of their second child, leaves a range of the reordered primitive array
+    // primitives are plain pointers in leaf order (kept alive by the shared_ptrs in prim_owners)
+    // traversal is a loop with a small fixed stack that visits the nearer child first
+
+// Bounds are floats rounded outward so the box always contains the object in either precision
+struct alignas(32) linear_bvh_node {
+    float bounds_min[3];
+    float bounds_max[3];
+    int32_t offset;           // leaf: first primitive, interior: index of the second child
+    uint16_t primitive_count; // 0 for interior nodes
+    uint8_t axis;             // interior split axis, picks which child is nearer
+    uint8_t pad;
+};
+
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node must stay 32 bytes");
+
+class linear_bvh : public hittable {
+public:
+    static constexpr size_t max_leaf_size = 4;
+
+    // Build over every object, object IDs are the objects' indices in this vector
+    explicit linear_bvh(const std::vector<shared_ptr<hittable>>& objects)
+    {
+        if (objects.empty()) return;
+
+        std::vector<bvh_build::item> items = bvh_build::make_items(objects);
+        std::unique_ptr<bvh_build::tree_node> root = bvh_build::build_tree(items, max_leaf_size, &tree_info.threads);
+
+        nodes.reserve(2 * items.size());
+        prims.reserve(items.size());
+        prim_ids.reserve(items.size());
+        prim_owners.reserve(items.size());
+
+        flatten(items, *root, 1);
+        bbox = root->box;
+        tree_info.finish(bvh_build::bounded_bounds(items));
+    }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        if (nodes.empty()) return false;
+
+        const real orig[3] = { r.orig[0], r.orig[1], r.orig[2] };
+        const real inv_dir[3] = { 1 / r.dir[0], 1 / r.dir[1], 1 / r.dir[2] };
+        const int dir_is_neg[3] = { inv_dir[0] < 0.0, inv_dir[1] < 0.0, inv_dir[2] < 0.0 };
+
+        int stack[bvh_build::max_depth];
+        int stack_size = 0;
+        int current = 0;
+
+        hit_record temp_rec;
+        bool hit_anything = false;
+        real closest = ray_t.max;
+
+        while (true)
+        {
+            const linear_bvh_node& node = nodes[static_cast<size_t>(current)];
+
+            if (box_hit(node, orig, inv_dir, dir_is_neg, ray_t.min, closest))
+            {
+                if (node.primitive_count > 0)
+                {
+                    const int end = node.offset + node.primitive_count;
+                    for (int i = node.offset; i < end; ++i)
+                    {
+                        if (prims[static_cast<size_t>(i)]->intersect(r, interval(ray_t.min, closest), temp_rec))
+                        {
+                            hit_anything = true;
+                            closest = temp_rec.t;
+                            rec = temp_rec;
+                            rec.object_id = prim_ids[static_cast<size_t>(i)];
+                        }
+                    }
+
+                    if (stack_size == 0) break;
+                    current = stack[--stack_size];
+                }
+                else if (dir_is_neg[node.axis])
+                {
+                    // Ray runs toward -axis, the second (upper) child is nearer
+                    stack[stack_size++] = current + 1;
+                    current = node.offset;
+                }
+                else
+                {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                }
+            }
+            else
+            {
+                if (stack_size == 0) break;
+                current = stack[--stack_size];
+            }
+        }
+
+        return hit_anything;
+    }
+
+    // Same walk as intersect() without a closest hit to shrink the interval, returns at the first primitive hit
+    bool occluded(const ray& r, interval ray_t) const override
+    {
+        if (nodes.empty()) return false;
+
+        const real orig[3] = { r.orig[0], r.orig[1], r.orig[2] };
+        const real inv_dir[3] = { 1 / r.dir[0], 1 / r.dir[1], 1 / r.dir[2] };
+        const int dir_is_neg[3] = { inv_dir[0] < 0.0, inv_dir[1] < 0.0, inv_dir[2] < 0.0 };
+
+        int stack[bvh_build::max_depth];
+        int stack_size = 0;
+        int current = 0;
+
+        while (true)
+        {
+            const linear_bvh_node& node = nodes[static_cast<size_t>(current)];
+
+            if (box_hit(node, orig, inv_dir, dir_is_neg, ray_t.min, ray_t.max))
+            {
+                if (node.primitive_count > 0)
+                {
+                    const int end = node.offset + node.primitive_count;
+                    for (int i = node.offset; i < end; ++i)
+                    {
+                        if (prims[static_cast<size_t>(i)]->occluded(r, ray_t)) return true;
+                    }
+
+                    if (stack_size == 0) break;
+                    current = stack[--stack_size];
+                }
+                else if (dir_is_neg[node.axis])
+                {
+                    stack[stack_size++] = current + 1;
+                    current = node.offset;
+                }
+                else
+                {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                }
+            }
+            else
+            {
+                if (stack_size == 0) break;
+                current = stack[--stack_size];
+            }
+        }
+
+        return false;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    size_t node_count() const { return nodes.size(); }
+    size_t primitive_count() const { return prims.size(); }
+    const bvh_build::tree_stats& stats() const { return tree_info; }
+
+    // Slab test against a node's float bounds, the near/far planes come from the ray's direction signs
+        // 0 * inf (ray origin on an infinite slab plane) is NaN and leaves the interval unchanged
+    static bool box_hit(const linear_bvh_node& node, const real* orig, const real* inv_dir, const int* dir_is_neg,
+        real t_min, real t_max)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const real near_plane = dir_is_neg[axis] ? node.bounds_max[axis] : node.bounds_min[axis];
+            const real far_plane = dir_is_neg[axis] ? node.bounds_min[axis] : node.bounds_max[axis];
+
+            const real t0 = (near_plane - orig[axis]) * inv_dir[axis];
+            const real t1 = (far_plane - orig[axis]) * inv_dir[axis] * tolerance<real>::slab_scale;
+
+            if (t0 > t_min) t_min = t0;
+            if (t1 < t_max) t_max = t1;
+            if (t_max < t_min) return false;
+        }
+        return true;
+    }
+
+private:
+    std::vector<linear_bvh_node> nodes;
+    std::vector<const hittable*> prims;
+    std::vector<int> prim_ids;
+    std::vector<shared_ptr<hittable>> prim_owners;
+    aabb bbox = aabb::empty;
+    bvh_build::tree_stats tree_info;
+
+    // Emit the subtree below node depth first, returns the index of its root node
+    int flatten(const std::vector<bvh_build::item>& items, const bvh_build::tree_node& tree, int depth)
+    {
+        const int index = static_cast<int>(nodes.size());
+        nodes.push_back(linear_bvh_node{});
+        tree_info.add_node(tree.box, depth);
+
+        {
+            linear_bvh_node& node = nodes.back();
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                node.bounds_min[axis] = bvh_build::float_below(tree.box.axis_interval(axis).min);
+                node.bounds_max[axis] = bvh_build::float_above(tree.box.axis_interval(axis).max);
+            }
+        }
+
+        if (tree.is_leaf())
+        {
+            linear_bvh_node& node = nodes[static_cast<size_t>(index)];
+            node.offset = static_cast<int32_t>(prims.size());
+            node.primitive_count = static_cast<uint16_t>(tree.end - tree.begin);
+            tree_info.add_leaf(tree.box, tree.end - tree.begin);
+
+            for (size_t i = tree.begin; i < tree.end; ++i)
+            {
+                prims.push_back(items[i].object.get());
+                prim_ids.push_back(items[i].id);
+                prim_owners.push_back(items[i].object);
+            }
+            return index;
+        }
+
+        flatten(items, *tree.child[0], depth + 1);
+        const int second = flatten(items, *tree.child[1], depth + 1);
+
+        linear_bvh_node& node = nodes[static_cast<size_t>(index)];
+        node.offset = second;
+        node.primitive_count = 0;
+        node.axis = static_cast<uint8_t>(bvh_build::split_axis(tree.child[0]->box, tree.child[1]->box));
+        return index;
+    }
+};
@@ -1,4 +1,6 @@
 #include <iostream>
+#include <string>
+#include <vector>
 
 #include "rtweekend.h"
 #include "camera.h"
@@ -9,11 +11,19 @@
 #include "image_texture.h"
 #include "finite_plane.h"
 #include "scenes.h"
+#include "accelerator_benchmark.h"
+#include "ray_color_benchmark.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
-int main()
+// Command line
+    // --shard rows:B:E     render rows [B, E) into Outputs/<tag>_<W>x<H>_rows<B>-<E>.part
+    // --shard samples:B:E  render samples [B, E) of every pixel into Outputs/<tag>_<W>x<H>_samples<B>-<E>.part
+    // --merge a.part b.part ...  combine parts into the final images
+    // --bench-accel [N]     time the BVH against the grids on every scene with N camera rays each (default 200000)
+    // --bench-ray-color [N] time N full paths through ray_color on the lit scenes (default 100000), for comparing vec3 builds
+int main(int argc, char* argv[])
 {
     // Target Scene
     //hittable_list world = cornell_room_basic();
@@ -21,10 +31,37 @@ int main()
     camera cam;
 
     // Image settings
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 1080;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 10;
+    RenderConfig config;
+    config.aspect_ratio = 16.0 / 9.0;
+    config.image_width = 1080;
+    config.samples_per_pixel = 100;
+    config.max_depth = 10;
+
+    // Adaptive sampling (samples_per_pixel becomes the per-pixel maximum)
+    config.adaptive_sampling = false;
+    config.min_samples_per_pixel = 16;
+    config.adaptive_threshold = 0.01;
+
+    // Progressive passes until a time budget (seconds) or noise target is met (0 = off)
+    config.progressive = false;
+    config.progressive_pass_spp = 4;
+    config.time_budget_seconds = 0.0;
+    config.target_noise = 0.0;
+
+    // Output encoding (ppm_ascii = P3 text, ppm_binary = P6 8-bit, ppm_binary16 = P6 16-bit), stream_output writes rows during the render
+    config.output_format = image_format::ppm_binary;
+    config.stream_output = true;
+
+    // Checkpoint/resume (empty path = off, resume adds samples to a matching checkpoint up to samples_per_pixel)
+    config.checkpoint_path = "";
+    config.checkpoint_interval_seconds = 60.0;
+    config.resume = false;
+
+    // Threading (thread_count 0 = all hardware threads, benchmark_both = 1 thread vs N threads)
+    config.multithreaded = true;
+    config.thread_count = 0;
+    config.benchmark_both = false;
+    config.tag = "cornell";
 
     // Camera placement for cornell box
     cam.vfov = 40.0;
@@ -42,6 +79,50 @@ int main()
     cam.defocus_angle = 0.0;
     cam.focus_dist = 6;
 
-    cam.render(world);
+    std::vector<std::string> merge_parts;
+    for (int a = 1; a < argc; ++a)
+    {
+        std::string arg = argv[a];
+        if (arg == "--shard" && a + 1 < argc)
+        {
+            if (!parse_shard(argv[++a], config.shard))
+            {
+                std::cerr << "ERROR: Bad shard \"" << argv[a] << "\", expected rows:B:E or samples:B:E\n";
+                return 1;
+            }
+        }
+        else if (arg == "--bench-accel")
+        {
+            size_t camera_rays = 200000;
+            if (a + 1 < argc) camera_rays = static_cast<size_t>(std::stoul(argv[++a]));
+            benchmark_accelerators(camera_rays);
+            return 0;
+        }
+        else if (arg == "--bench-ray-color")
+        {
+            size_t paths = 100000;
+            if (a + 1 < argc) paths = static_cast<size_t>(std::stoul(argv[++a]));
+            benchmark_ray_color(paths);
+            return 0;
+        }
+        else if (arg == "--merge")
+        {
+            while (a + 1 < argc) merge_parts.push_back(argv[++a]);
+        }
+        else
+        {
+            std::cerr << "ERROR: Unknown argument \"" << arg << "\"\n";
+            return 1;
+        }
+    }
+
+    if (!merge_parts.empty()) {
+        return cam.merge_shards(merge_parts, config) ? 0 : 1;
+    }
+
+    cam.render(world, config);
+
+    // Beauty plus normal, depth, albedo and object ID outputs from the same pass
+    //cam.render_aovs<aov_all>(world, config);
     return 0;
 }
\ No newline at end of file
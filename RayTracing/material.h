@@ -9,6 +9,9 @@ public:
     virtual ~material() = default;
     virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const = 0;
     virtual color emitted() const { return color(0, 0, 0); }
+
+    // Surface color without lighting (albedo output)
+    virtual color base_color(const hit_record&) const { return color(0, 0, 0); }
 };
 class diffuse_light : public material {
 public:
@@ -22,6 +25,10 @@ public:
         return emit;
     }
 
+    color base_color(const hit_record&) const override {
+        return emit;
+    }
+
 private:
     color emit;
 };
@@ -48,6 +55,10 @@ public:
         return true;
     }
 
+    color base_color(const hit_record& rec) const override {
+        return albedo->value(rec.u, rec.v, rec.p);
+    }
+
 private:
     shared_ptr<texture> albedo;
 };
@@ -56,9 +67,9 @@ class metal : public material
 {
 public:
     color albedo;
-    double fuzz;
+    real fuzz;
 
-    metal(const color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
+    metal(const color& a, real f) : albedo(a), fuzz(f < 1 ? f : 1) {}
 
     bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override 
     {
@@ -67,19 +78,24 @@ public:
         attenuation = albedo;
         return (dot(scattered.direction(), rec.normal) > 0);
     }
+
+    color base_color(const hit_record&) const override 
+    {
+        return albedo;
+    }
 };
 
 class dielectric : public material 
 {
 public:
-    double ir; // index of refraction
+    real ir; // index of refraction
 
-    explicit dielectric(double index_of_refraction) : ir(index_of_refraction) {}
+    explicit dielectric(real index_of_refraction) : ir(index_of_refraction) {}
 
-    static double reflectance(double cosine, double ref_idx) 
+    static real reflectance(real cosine, real ref_idx) 
     {
         // schlick approx
-        double r0 = (1 - ref_idx) / (1 + ref_idx);
+        real r0 = (1 - ref_idx) / (1 + ref_idx);
         r0 = r0 * r0;
         return r0 + (1 - r0) * std::pow((1 - cosine), 5);
     }
@@ -87,11 +103,11 @@ public:
     bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override 
     {
         attenuation = color(1.0, 1.0, 1.0);
-        double refraction_ratio = rec.front_face ? (1.0 / ir) : ir;
+        real refraction_ratio = rec.front_face ? (1.0 / ir) : ir;
 
         vec3 unit_dir = unit_vector(r_in.direction());
-        double cos_theta = std::fmin(dot(-unit_dir, rec.normal), 1.0);
-        double sin_theta = std::sqrt(1.0 - cos_theta * cos_theta);
+        real cos_theta = std::fmin(dot(-unit_dir, rec.normal), 1.0);
+        real sin_theta = std::sqrt(1.0 - cos_theta * cos_theta);
 
         bool cannot_refract = refraction_ratio * sin_theta > 1.0;
         vec3 direction;
@@ -104,4 +120,9 @@ public:
         scattered = ray(rec.p, direction);
         return true;
     }
+
+    color base_color(const hit_record&) const override 
+    {
+        return color(1.0, 1.0, 1.0);
+    }
 };
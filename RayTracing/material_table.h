@@ -0,0 +1,49 @@
+#pragma once
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "rtweekend.h"
+// Materials of a scene, referred to by index
+    // the scene (hittable_list) owns the table, primitives and hit records only store a material_id
+    // so a hit copies a 32-bit index instead of a shared_ptr and tracing does no atomic refcount traffic
+
+class material;
+
+using material_id = uint32_t;
+constexpr material_id no_material = 0xFFFFFFFFu;
+
+class material_table {
+public:
+    // Index of mat, added on first use (adding the same material again returns the same index)
+    material_id add(shared_ptr<material> mat)
+    {
+        if (!mat) return no_material;
+
+        const auto found = index.find(mat.get());
+        if (found != index.end()) return found->second;
+
+        const material_id id = static_cast<material_id>(materials.size());
+        index.emplace(mat.get(), id);
+        materials.push_back(std::move(mat));
+        return id;
+    }
+
+    // nullptr for no_material (and any index the table doesn't have)
+    const material* get(material_id id) const
+    {
+        return id < materials.size() ? materials[id].get() : nullptr;
+    }
+
+    size_t size() const { return materials.size(); }
+
+    void clear()
+    {
+        materials.clear();
+        index.clear();
+    }
+
+private:
+    std::vector<shared_ptr<material>> materials;
+    std::unordered_map<const material*, material_id> index;
+};
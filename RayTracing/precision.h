@@ -0,0 +1,40 @@
+#pragma once
+#include <limits>
+
+// Floating point type of the math core and every primitive, picked at compile time
+    // double by default, define RT_SINGLE_PRECISION (compiler flag or project preprocessor definition) for a float build
+    // vec3_t, ray_t and interval_t are templates on the scalar, the renderer uses them through real (vec3, ray, interval)
+    // accumulated pixels, timings and build statistics stay double in both builds
+    // tolerance<T> holds the epsilons of the intersection code, scaled to the scalar's precision
+
+#if defined(RT_SINGLE_PRECISION)
+using real = float;
+#define RT_REAL_IS_DOUBLE 0
+#else
+using real = double;
+#define RT_REAL_IS_DOUBLE 1
+#endif
+
+template <typename T>
+struct tolerance;
+
+template <>
+struct tolerance<double> {
+    static constexpr double ray_offset = 0.001; // scattered rays start this far along so they don't hit the surface they leave
+    static constexpr double parallel = 1e-8;    // |dot(n, d)| under which a ray counts as parallel to a plane
+    static constexpr double degenerate = 1e-12; // rectangle Gram determinant under which it has no area
+    static constexpr double near_zero = 1e-8;   // vec3::near_zero per component
+    static constexpr double box_padding = 0.0001;
+    static constexpr double slab_scale = 1.0;   // far slab distances are scaled up by this, the box tests' rounding margin
+};
+
+// Float keeps about 7 digits: offsets grow with the scene scale (a few ulps at ~1000 units), the squared terms get the square of it
+template <>
+struct tolerance<float> {
+    static constexpr float ray_offset = 0.002f;
+    static constexpr float parallel = 1e-6f;
+    static constexpr float degenerate = 1e-10f;
+    static constexpr float near_zero = 1e-6f;
+    static constexpr float box_padding = 0.0005f;
+    static constexpr float slab_scale = 1.0f + 4 * std::numeric_limits<float>::epsilon();
+};
@@ -1,17 +1,21 @@
 #pragma once
 #include "vec3.h"
 // Defines a ray (origin + direction) and helper functions
-class ray 
+    // a template on the scalar type like vec3_t, the renderer's ray is ray_t<real>
+template <typename T>
+class ray_t
 {
 public:
-    point3 orig;
-    vec3 dir;
+    vec3_t<T> orig;
+    vec3_t<T> dir;
 
-    ray() = default;
-    ray(const point3& origin, const vec3& direction) : orig(origin), dir(direction) {}
+    ray_t() = default;
+    ray_t(const vec3_t<T>& origin, const vec3_t<T>& direction) : orig(origin), dir(direction) {}
 
-    point3 origin() const { return orig; }
-    vec3 direction() const { return dir; }
+    vec3_t<T> origin() const { return orig; }
+    vec3_t<T> direction() const { return dir; }
 
-    point3 at(double t) const { return orig + t * dir; }
+    vec3_t<T> at(T t) const { return orig + t * dir; }
 };
+
+using ray = ray_t<real>;
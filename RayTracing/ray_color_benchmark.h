@@ -0,0 +1,59 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "rtweekend.h"
+#include "camera.h"
+#include "scenes.h"
+#include "accelerator_benchmark.h"
+// ray_color benchmark (main.cpp --bench-ray-color)
+    // full paths (max_depth bounces, materials and all) from camera rays through random pixels of the lit scenes
+    // the other scenes have no emitters and a black background, every path there returns black and the checksum says nothing
+    // every pass reseeds the generator, so the paths and the radiance checksum are the same each time
+    // the vector code is a compile time choice: build with and without RT_SIMD_VEC3 (and RT_SINGLE_PRECISION) and compare the runs,
+    // the checksums of two builds with the same precision must match
+
+inline void benchmark_ray_color(size_t paths)
+{
+    constexpr int depth = 10;
+    constexpr int passes = 5;
+    static const char* const lit_scenes[] = { "cornell_room_basic", "cornell_with_earth" };
+
+    std::cerr << "========== ray_color Benchmark =========\n";
+    std::cerr << "vec3: " << (RT_VEC3_SSE ? "SSE, 4 lanes, 16-byte aligned" : "scalar") << " | " << sizeof(vec3) << " bytes | "
+        << (RT_REAL_IS_DOUBLE ? "double" : "float") << "\n";
+    std::cerr << "Paths per scene: " << paths << ", max depth " << depth << ", best of " << passes << " passes\n\n";
+
+    for (const scene_entry& scene : all_scenes)
+    {
+        if (std::none_of(std::begin(lit_scenes), std::end(lit_scenes), [&](const char* name) { return std::string(name) == scene.name; })) continue;
+
+        seed_random(12345);
+        const hittable_list world = scene.build(default_accelerator);
+        const std::vector<ray> rays = benchmark_camera_rays(scene, paths);
+
+        camera cam;
+        double best_ms = 0.0;
+        color_sum sum;
+        for (int pass = 0; pass < passes; ++pass)
+        {
+            seed_random(777);
+            const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            sum = cam.trace_paths(world, rays, depth);
+            const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            best_ms = (pass == 0) ? ms : std::min(best_ms, ms);
+        }
+
+        std::cerr << "  " << std::left << std::setw(20) << scene.name << std::right << std::fixed << std::setprecision(1)
+            << std::setw(9) << best_ms << " ms | " << std::setw(7) << best_ms * 1e6 / static_cast<double>(paths) << " ns/path | checksum "
+            << std::setprecision(6) << (sum.x() + sum.y() + sum.z()) << "\n";
+    }
+
+    std::cerr.unsetf(std::ios::floatfield);
+    std::cerr << std::setprecision(6);
+}
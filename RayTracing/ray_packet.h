@@ -0,0 +1,31 @@
+#pragma once
+#include "ray.h"
+// Bundle of up to 16 rays traced through the scene together (coherent camera rays)
+    // structure of arrays: one array per origin and direction component, lane k of every array is ray k
+    // bit k of a lane mask stands for ray k, traversal carries the mask of rays still inside the current box
+    // only the first hit is traced as a packet, each ray continues on its own after it
+
+struct alignas(32) ray_packet {
+    static constexpr int max_size = 16;
+
+    // Unused lanes stay zero so SIMD code can load whole groups of lanes
+    real ox[max_size] = {}, oy[max_size] = {}, oz[max_size] = {};
+    real dx[max_size] = {}, dy[max_size] = {}, dz[max_size] = {};
+    int count = 0;
+
+    void add(const ray& r)
+    {
+        ox[count] = r.orig[0];
+        oy[count] = r.orig[1];
+        oz[count] = r.orig[2];
+        dx[count] = r.dir[0];
+        dy[count] = r.dir[1];
+        dz[count] = r.dir[2];
+        ++count;
+    }
+
+    ray get(int k) const { return ray(point3(ox[k], oy[k], oz[k]), vec3(dx[k], dy[k], dz[k])); }
+
+    // Mask with a bit for every ray in the packet
+    unsigned lanes() const { return (1u << count) - 1u; }
+};
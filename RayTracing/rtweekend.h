@@ -1,9 +1,9 @@
 #pragma once
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <limits>
 #include <memory>
-#include <random>
 
 #include "interval.h"
 #include "ray.h"
@@ -18,11 +18,67 @@ inline double degrees_to_radians(double degrees)
     return degrees * 3.1415926535897932385 / 180.0;
 }
 
+// PCG32 (XSH RR) generator, small state so reseeding per sample costs next to nothing
+class pcg32 {
+public:
+    using result_type = uint32_t;
+
+    explicit pcg32(uint64_t seed_value = 0x853C49E6748FEA9Bull) { seed(seed_value); }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return 0xFFFFFFFFu; }
+
+    void seed(uint64_t seed_value)
+    {
+        state = 0;
+        (*this)();
+        state += seed_value;
+        (*this)();
+    }
+
+    result_type operator()()
+    {
+        uint64_t old = state;
+        state = old * 6364136223846793005ull + 1442695040888963407ull;
+        uint32_t xorshifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+        uint32_t rot = static_cast<uint32_t>(old >> 59);
+        return (xorshifted >> rot) | (xorshifted << ((32u - rot) & 31u));
+    }
+
+private:
+    uint64_t state = 0;
+};
+
+// Per-thread generator behind every random_* helper
+    // starts from the same fixed seed on every thread and every run, so scene generation is reproducible too
+    // the camera reseeds it from sample_seed(pixel, sample) before every sample, draw d of a sample is then output d of that stream
+    // (the sample's d-th dimension), which makes an image independent of thread count and tile order
+inline pcg32& random_engine()
+{
+    static thread_local pcg32 gen;
+    return gen;
+}
+
+// One 32-bit draw scaled into [0, 1) (steps of 2^-32), no distribution object and half the draws of generate_canonical
 inline double random_double() 
 {
-    static thread_local std::mt19937 gen(std::random_device{}());
-    static thread_local std::uniform_real_distribution<double> dist(0.0, 1.0);
-    return dist(gen);
+    return static_cast<double>(random_engine()()) * 0x1p-32;
+}
+
+// Reseed this thread's generator, everything drawn afterwards depends only on the seed
+inline void seed_random(uint64_t seed)
+{
+    random_engine().seed(seed);
+}
+
+// Seed for one camera sample (splitmix64 of the pixel and the sample's global index)
+    // seeding every sample with this makes a pixel's samples the same no matter which thread or process takes them
+inline uint64_t sample_seed(uint64_t pixel_index, uint64_t sample_index)
+{
+    uint64_t z = pixel_index * 0x9E3779B97F4A7C15ull + sample_index + 0x632BE59BD9B4E019ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
 }
 
 inline double random_double(double min, double max) 
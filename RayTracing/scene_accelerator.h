@@ -0,0 +1,261 @@
+#pragma once
+#include <chrono>
+#include <string>
+#include <vector>
+#include "hittable.h"
+#include "bvh.h"
+#include "linear_bvh.h"
+#include "wide_bvh.h"
+#include "uniform_grid.h"
+#include "clipped_hittable.h"
+#include "compiled_scene.h"
+// Acceleration layer over a set of objects
+    // make_accelerator builds one of the BVH variants or a grid over objects that all have finite bounds
+    // scene_accelerator splits a scene into bounded objects (in the BVH or grid) and unbounded ones (infinite planes and cylinders),
+    // which are either tested on every ray beside it or clipped to the bounded objects' box and put in it
+
+// Acceleration structure a hittable_list can build over its objects
+enum class accelerator {
+    none,       // linear loop over every object
+    bvh,        // pointer based bvh_node tree
+    linear_bvh, // flattened depth first node array
+    bvh4,       // 4 children per node, SSE box tests
+    bvh8,       // 8 children per node, AVX2 box tests
+    wide_bvh,   // BVH8 when the CPU has AVX2, BVH4 otherwise (default)
+    grid,       // uniform grid sized from the object density, 3D-DDA traversal
+    grid2,      // two-level grid, crowded cells get a finer grid of their own
+    compiled    // linear BVH over per-type primitive arrays, no virtual calls for the built-in shapes
+};
+
+constexpr accelerator default_accelerator = accelerator::wide_bvh;
+
+// What was built over a list, shown in the render settings
+    // stats are filled in for the compiled trees (linear and wide), the pointer tree only reports its build time (in stats.build_ms)
+    // grid is filled in for the grids
+    // unbounded counts the objects kept out of the tree, clipped whether they were clipped into it instead
+struct accelerator_info {
+    std::string name = "None";
+    bool has_tree_stats = false;
+    bvh_build::tree_stats stats;
+    bool has_grid_stats = false;
+    grid_stats grid;
+    size_t unbounded = 0;
+    bool clipped = false;
+};
+
+// Build the chosen structure over objects (nullptr for none), info receives what was built, e.g. "BVH8 (AVX2)"
+inline shared_ptr<hittable> make_accelerator(accelerator kind, const std::vector<shared_ptr<hittable>>& objects, accelerator_info& info)
+{
+    if (kind == accelerator::wide_bvh) {
+        kind = (detect_simd_isa() >= simd_isa::avx2) ? accelerator::bvh8 : accelerator::bvh4;
+    }
+
+    info = accelerator_info();
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    shared_ptr<hittable> accel;
+    switch (kind)
+    {
+    case accelerator::bvh:
+        info.name = "BVH (pointer tree)";
+        accel = make_shared<bvh_node>(objects);
+        break;
+    case accelerator::linear_bvh:
+    {
+        shared_ptr<linear_bvh> tree = make_shared<linear_bvh>(objects);
+        info.name = "BVH (linear)";
+        info.stats = tree->stats();
+        info.has_tree_stats = true;
+        accel = tree;
+        break;
+    }
+    case accelerator::bvh4:
+    {
+        shared_ptr<wide_bvh<4>> tree = make_shared<wide_bvh<4>>(objects);
+        info.name = tree->name();
+        info.stats = tree->stats();
+        info.has_tree_stats = true;
+        accel = tree;
+        break;
+    }
+    case accelerator::bvh8:
+    {
+        shared_ptr<wide_bvh<8>> tree = make_shared<wide_bvh<8>>(objects);
+        info.name = tree->name();
+        info.stats = tree->stats();
+        info.has_tree_stats = true;
+        accel = tree;
+        break;
+    }
+    case accelerator::grid:
+    case accelerator::grid2:
+    {
+        shared_ptr<uniform_grid> cells = make_shared<uniform_grid>(objects, kind == accelerator::grid2);
+        info.name = (kind == accelerator::grid2) ? "Grid (two-level)" : "Grid (uniform)";
+        info.grid = cells->stats();
+        info.has_grid_stats = true;
+        accel = cells;
+        break;
+    }
+    case accelerator::compiled:
+    {
+        shared_ptr<compiled_scene> scene = make_shared<compiled_scene>(objects);
+        info.name = "Compiled (SoA)";
+        info.stats = scene->stats();
+        info.has_tree_stats = true;
+        accel = scene;
+        break;
+    }
+    default:
+        return nullptr;
+    }
+
+    info.stats.build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return accel;
+}
+
+// What happens to objects without finite bounds
+enum class unbounded_mode {
+    separate, // tested on every ray next to the BVH (default, the image is unchanged)
+    clip      // clipped to the box around the bounded objects and put in the BVH (anything outside the box disappears)
+};
+
+// BVH over the bounded objects plus a list of the unbounded ones
+    // hit records carry the objects' indices in the vector the accelerator was built from
+class scene_accelerator : public hittable {
+public:
+    scene_accelerator(const std::vector<shared_ptr<hittable>>& objects, accelerator kind, unbounded_mode mode = unbounded_mode::separate)
+    {
+        std::vector<shared_ptr<hittable>> bounded;
+        aabb bounded_box = aabb::empty;
+
+        for (size_t i = 0; i < objects.size(); ++i)
+        {
+            const aabb box = objects[i]->bounding_box();
+            bbox = aabb(bbox, box);
+
+            // Without a tree every object is tested in order, like a plain list
+            if (kind == accelerator::none || box.is_unbounded())
+            {
+                unbounded.push_back(objects[i]);
+                unbounded_ids.push_back(static_cast<int>(i));
+                unbounded_boxes.push_back(box);
+                continue;
+            }
+
+            bounded.push_back(objects[i]);
+            bounded_ids.push_back(static_cast<int>(i));
+            bounded_box = aabb(bounded_box, box);
+        }
+
+        // Clipped copies join the BVH, the ones that miss the box entirely can never be seen inside it and are dropped
+        size_t clipped = 0;
+        if (kind != accelerator::none && mode == unbounded_mode::clip && !unbounded.empty() && !bounded_box.is_empty())
+        {
+            for (size_t k = 0; k < unbounded.size(); ++k)
+            {
+                shared_ptr<hittable> part = make_shared<clipped_hittable>(unbounded[k], bounded_box);
+                if (part->bounding_box().is_empty()) continue;
+
+                bounded.push_back(part);
+                bounded_ids.push_back(unbounded_ids[k]);
+            }
+            clipped = unbounded.size();
+            unbounded.clear();
+            unbounded_ids.clear();
+            unbounded_boxes.clear();
+        }
+
+        if (!bounded.empty()) tree = make_accelerator(kind, bounded, details);
+        details.unbounded = (kind == accelerator::none) ? 0 : (clipped > 0 ? clipped : unbounded.size());
+        details.clipped = clipped > 0;
+    }
+
+    // The tree goes first (the trees only write rec when they hit), its closest hit then culls the unbounded objects
+        // most unbounded objects are still bounded along some axes (a vertical cylinder in x and z), so each keeps its box
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        bool hit_anything = false;
+        real closest = ray_t.max;
+
+        if (tree && tree->intersect(r, ray_t, rec))
+        {
+            hit_anything = true;
+            closest = rec.t;
+            rec.object_id = bounded_ids[static_cast<size_t>(rec.object_id)];
+        }
+
+        if (intersect_unbounded(r, ray_t.min, closest, rec)) hit_anything = true;
+        return hit_anything;
+    }
+
+    // The packet goes through the tree together, then every ray checks the unbounded objects on its own
+    unsigned intersect_packet(const ray_packet& rays, interval ray_t, hit_record* recs) const override
+    {
+        unsigned hits = tree ? tree->intersect_packet(rays, ray_t, recs) : 0;
+
+        for (int k = 0; k < rays.count; ++k)
+        {
+            real closest = ray_t.max;
+            if ((hits >> k) & 1u)
+            {
+                closest = recs[k].t;
+                recs[k].object_id = bounded_ids[static_cast<size_t>(recs[k].object_id)];
+            }
+
+            if (intersect_unbounded(rays.get(k), ray_t.min, closest, recs[k])) hits |= 1u << k;
+        }
+        return hits;
+    }
+
+    bool traces_packets() const override { return tree && tree->traces_packets(); }
+
+    bool occluded(const ray& r, interval ray_t) const override
+    {
+        if (tree && tree->occluded(r, ray_t)) return true;
+
+        const vec3 inv_dir(1.0 / r.dir[0], 1.0 / r.dir[1], 1.0 / r.dir[2]);
+        for (size_t k = 0; k < unbounded.size(); ++k)
+        {
+            if (unbounded_boxes[k].hit(r.orig, inv_dir, ray_t) && unbounded[k]->occluded(r, ray_t)) return true;
+        }
+        return false;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    const accelerator_info& info() const { return details; }
+
+private:
+    // Closest unbounded object in (t_min, closest), closest and rec are updated when one is nearer
+    bool intersect_unbounded(const ray& r, real t_min, real& closest, hit_record& rec) const
+    {
+        if (unbounded.empty()) return false;
+
+        bool hit_anything = false;
+        hit_record temp_rec;
+        const vec3 inv_dir(1.0 / r.dir[0], 1.0 / r.dir[1], 1.0 / r.dir[2]);
+
+        for (size_t k = 0; k < unbounded.size(); ++k)
+        {
+            if (!unbounded_boxes[k].hit(r.orig, inv_dir, interval(t_min, closest))) continue;
+
+            if (unbounded[k]->intersect(r, interval(t_min, closest), temp_rec))
+            {
+                hit_anything = true;
+                closest = temp_rec.t;
+                rec = std::move(temp_rec);
+                rec.object_id = unbounded_ids[k];
+            }
+        }
+        return hit_anything;
+    }
+
+    shared_ptr<hittable> tree;
+    std::vector<int> bounded_ids; // tree object ID -> index in the source objects
+    std::vector<shared_ptr<hittable>> unbounded;
+    std::vector<int> unbounded_ids;
+    std::vector<aabb> unbounded_boxes;
+    aabb bbox = aabb::empty;
+    accelerator_info details;
+};
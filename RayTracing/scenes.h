@@ -1,3 +1,4 @@
+#pragma once
 #include <iostream>
 
 #include "rtweekend.h"
@@ -12,13 +13,20 @@
 #include "cylinder.h"
 #include "capsule.h"
 
+// Every scene builds an acceleration structure over its objects before returning it
+    // accel picks which one (accelerator::none leaves the list unaccelerated), the defaults are the fastest measured per scene
+    // materials go into world.materials, primitives take the material_id it returns
+
+// Scenes with a handful of objects, where the compiled per-type arrays measured faster than the wide BVH (main.cpp --bench-accel)
+constexpr accelerator small_scene_accelerator = accelerator::compiled;
+
 // Ray Tracing in One Weekend Tutorial scene (with minor tweaks)
-static hittable_list random_scene()
+static hittable_list random_scene(accelerator accel = default_accelerator)
 {
     hittable_list world;
 
-    std::shared_ptr<material> ground_material =
-        std::make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    material_id ground_material = world.materials.add(
+        std::make_shared<lambertian>(color(0.5, 0.5, 0.5)));
 
     world.add(std::make_shared<sphere>(
         point3(0.0, -1000.0, 0.0),
@@ -60,31 +68,33 @@ static hittable_list random_scene()
                     sphere_material = std::make_shared<dielectric>(1.5);
                 }
 
-                world.add(std::make_shared<sphere>(center, 0.2, sphere_material));
+                world.add(std::make_shared<sphere>(center, 0.2, world.materials.add(sphere_material)));
             }
         }
     }
 
-    std::shared_ptr<material> material1 = std::make_shared<dielectric>(1.5);
+    material_id material1 = world.materials.add(std::make_shared<dielectric>(1.5));
     world.add(std::make_shared<sphere>(point3(0.0, 1.0, 0.0), 1.0, material1));
 
-    std::shared_ptr<material> material2 =
-        std::make_shared<lambertian>(color(0.4, 0.2, 0.1));
+    material_id material2 = world.materials.add(
+        std::make_shared<lambertian>(color(0.4, 0.2, 0.1)));
     world.add(std::make_shared<sphere>(point3(-4.0, 1.0, 0.0), 1.0, material2));
 
-    std::shared_ptr<material> material3 =
-        std::make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
+    material_id material3 = world.materials.add(
+        std::make_shared<metal>(color(0.7, 0.6, 0.5), 0.0));
     world.add(std::make_shared<sphere>(point3(4.0, 1.0, 0.0), 1.0, material3));
 
+    world.build_bvh(accel);
     return world;
 }
 
-static hittable_list random_shapes_scene()
+// Cylinders and capsules on the same lattice, the two-level grid measured faster than the BVH here (main.cpp --bench-accel)
+static hittable_list random_shapes_scene(accelerator accel = accelerator::grid2)
 {
     hittable_list world;
 
-    std::shared_ptr<material> ground_material =
-        std::make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    material_id ground_material = world.materials.add(
+        std::make_shared<lambertian>(color(0.5, 0.5, 0.5)));
 
     world.add(std::make_shared<sphere>(
         point3(0.0, -1000.0, 0.0),
@@ -129,44 +139,45 @@ static hittable_list random_shapes_scene()
                 }
 
                 if(a % 2 == 0)
-                    world.add(std::make_shared<cylinder>(center, dir, 0.1, 0.2, cylinder_material));
+                    world.add(std::make_shared<cylinder>(center, dir, 0.1, 0.2, world.materials.add(cylinder_material)));
                 else
-                    world.add(std::make_shared<capsule>(center, dir, 0.1, 0.2, cylinder_material));
+                    world.add(std::make_shared<capsule>(center, dir, 0.1, 0.2, world.materials.add(cylinder_material)));
             }
         }
     }
 
-    std::shared_ptr<material> material1 = std::make_shared<dielectric>(1.5);
+    material_id material1 = world.materials.add(std::make_shared<dielectric>(1.5));
     world.add(std::make_shared<infinite_cylinder>(
         point3(0.0, 1.0, 0.0), vec3(0, 1, 0), 1, material1
     ));
 
-    std::shared_ptr<material> material2 =
-        std::make_shared<lambertian>(color(0.4, 0.2, 0.1));
+    material_id material2 = world.materials.add(
+        std::make_shared<lambertian>(color(0.4, 0.2, 0.1)));
     world.add(std::make_shared<infinite_cylinder>(
         point3(-4.0, 1.0, 0.0),vec3(0, 1, 0), 1, material2
     ));
 
-    std::shared_ptr<material> material3 =
-        std::make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
+    material_id material3 = world.materials.add(
+        std::make_shared<metal>(color(0.7, 0.6, 0.5), 0.0));
     world.add(std::make_shared<infinite_cylinder>(
         point3(4.0, 1.0, 0.0), vec3(0, 1, 0), 1, material3
     ));
 
+    world.build_bvh(accel);
     return world;
 }
 
 // Cornell box test
-static hittable_list cornell_room_basic()
+static hittable_list cornell_room_basic(accelerator accel = small_scene_accelerator)
 {
     hittable_list world;
 
-    std::shared_ptr<material> red = std::make_shared<lambertian>(color(0.65, 0.05, 0.05));
-    std::shared_ptr<material> green = std::make_shared<lambertian>(color(0.12, 0.45, 0.15));
-    std::shared_ptr<material> white = std::make_shared<lambertian>(color(0.73, 0.73, 0.73));
+    material_id red = world.materials.add(std::make_shared<lambertian>(color(0.65, 0.05, 0.05)));
+    material_id green = world.materials.add(std::make_shared<lambertian>(color(0.12, 0.45, 0.15)));
+    material_id white = world.materials.add(std::make_shared<lambertian>(color(0.73, 0.73, 0.73)));
 
-    std::shared_ptr<material> metal_mat = std::make_shared<metal>(color(0.9, 0.9, 0.9), 0.05);
-    std::shared_ptr<material> glass = std::make_shared<dielectric>(1.5);
+    material_id metal_mat = world.materials.add(std::make_shared<metal>(color(0.9, 0.9, 0.9), 0.05));
+    material_id glass = world.materials.add(std::make_shared<dielectric>(1.5));
 
     // Room bounds
     const double x0 = -1.0;
@@ -216,7 +227,7 @@ static hittable_list cornell_room_basic()
         white
     ));
 
-    std::shared_ptr<material> light = std::make_shared<diffuse_light>(color(6.0, 6.0, 6.0));
+    material_id light = world.materials.add(std::make_shared<diffuse_light>(color(6.0, 6.0, 6.0)));
 
     world.add(std::make_shared<finite_plane>(
         point3(-0.3, y1 - 1e-4, -0.3),
@@ -238,14 +249,15 @@ static hittable_list cornell_room_basic()
     world.add(std::make_shared<cylinder>(c + vec3(0.5, 0, 0), random_in_unit_sphere(), 0.2, 0.3, red));
     world.add(std::make_shared<capsule>(c + vec3(-0.5, 0, 0), random_in_unit_sphere(), 0.2, 0.3, red));
 
+    world.build_bvh(accel);
     return world;
 }
 // Box test
-static hittable_list test_box_scene()
+static hittable_list test_box_scene(accelerator accel = small_scene_accelerator)
 {
     hittable_list world;
 
-    std::shared_ptr<material> white = std::make_shared<lambertian>(color(0.73, 0.73, 0.73));
+    material_id white = world.materials.add(std::make_shared<lambertian>(color(0.73, 0.73, 0.73)));
     world.add(std::make_shared<box>(
         point3(-1.0, 0.0, -1.0),
         point3(1.0, 2.0, 1.0),
@@ -253,15 +265,16 @@ static hittable_list test_box_scene()
         true
     ));
 
+    world.build_bvh(accel);
     return world;
 }
 
 // Infinite Cylindar test
-static hittable_list test_inf_cylinder()
+static hittable_list test_inf_cylinder(accelerator accel = default_accelerator)
 {
     hittable_list world;
 
-    std::shared_ptr<material> white = std::make_shared<lambertian>(color(0.73, 0.73, 0.73));
+    material_id white = world.materials.add(std::make_shared<lambertian>(color(0.73, 0.73, 0.73)));
     world.add(std::make_shared<infinite_cylinder>(
         point3(-1.0, 0.0, -1.0),
         unit_vector(vec3(1.0, 0.0, 1.0)),
@@ -269,15 +282,16 @@ static hittable_list test_inf_cylinder()
         white
     ));
 
+    world.build_bvh(accel);
     return world;
 }
 
 // Cylindar test
-static hittable_list test_cylinder()
+static hittable_list test_cylinder(accelerator accel = small_scene_accelerator)
 {
     hittable_list world;
 
-    std::shared_ptr<material> white = std::make_shared<lambertian>(color(0.73, 0.73, 0.73));
+    material_id white = world.materials.add(std::make_shared<lambertian>(color(0.73, 0.73, 0.73)));
     world.add(std::make_shared<cylinder>(
         point3(-1.0, 0.0, -1.0),
         unit_vector(vec3(1.0, 0.0, 1.0)),
@@ -286,14 +300,15 @@ static hittable_list test_cylinder()
         white
     ));
 
+    world.build_bvh(accel);
     return world;
 }
 
-static hittable_list test_capsule()
+static hittable_list test_capsule(accelerator accel = small_scene_accelerator)
 {
     hittable_list world;
 
-    std::shared_ptr<material> white = std::make_shared<lambertian>(color(0.73, 0.73, 0.73));
+    material_id white = world.materials.add(std::make_shared<lambertian>(color(0.73, 0.73, 0.73)));
     world.add(std::make_shared<capsule>(
         point3(-1.0, 0.0, -1.0),
         unit_vector(vec3(3.0, 0.0, 1.0)),
@@ -302,51 +317,51 @@ static hittable_list test_capsule()
         white
     ));
 
+    world.build_bvh(accel);
     return world;
 }
 
 // Sphere test
-static hittable_list testSphere()
+static hittable_list testSphere(accelerator accel = small_scene_accelerator)
 {
     hittable_list world;
 
-    std::shared_ptr<material> white = std::make_shared<lambertian>(color(0.73, 0.73, 0.73));
+    material_id white = world.materials.add(std::make_shared<lambertian>(color(0.73, 0.73, 0.73)));
     world.add(std::make_shared<sphere>(
         point3(-1.0, 0.0, -1.0),
         1.0,
         white
     ));
 
+    world.build_bvh(accel);
     return world;
 }
 
 // Texture-mapping test
-static hittable_list earth_scene()
+static hittable_list earth_scene(accelerator accel = small_scene_accelerator)
 {
     hittable_list world;
 
     std::shared_ptr<texture> earth_tex = std::make_shared<image_texture>("Textures/earth.jpg");
-    std::shared_ptr<material> earth_mat = std::make_shared<lambertian>(earth_tex);
+    material_id earth_mat = world.materials.add(std::make_shared<lambertian>(earth_tex));
 
     std::shared_ptr<texture> moon_tex = std::make_shared<image_texture>("Textures/moon.jpg");
-    std::shared_ptr<material> moon_mat = std::make_shared<lambertian>(moon_tex);
+    material_id moon_mat = world.materials.add(std::make_shared<lambertian>(moon_tex));
 
     world.add(std::make_shared<sphere>(point3(0.0, 0.0, 0.0), 1.0, earth_mat));
     world.add(std::make_shared<sphere>(point3(4.0, 0.0, 7.0), 0.25, moon_mat));
 
+    world.build_bvh(accel);
     return world;
 }
 // Earth and moon texture mapping with cornell box
-static hittable_list cornell_with_earth()
+static hittable_list cornell_with_earth(accelerator accel = small_scene_accelerator)
 {
     hittable_list world;
 
-    std::shared_ptr<material> red = std::make_shared<lambertian>(color(0.65, 0.05, 0.05));
-    std::shared_ptr<material> green = std::make_shared<lambertian>(color(0.12, 0.45, 0.15));
-    std::shared_ptr<material> white = std::make_shared<lambertian>(color(0.73, 0.73, 0.73));
-
-    std::shared_ptr<material> metal_mat = std::make_shared<metal>(color(0.9, 0.9, 0.9), 0.05);
-    std::shared_ptr<material> glass = std::make_shared<dielectric>(1.5);
+    material_id red = world.materials.add(std::make_shared<lambertian>(color(0.65, 0.05, 0.05)));
+    material_id green = world.materials.add(std::make_shared<lambertian>(color(0.12, 0.45, 0.15)));
+    material_id white = world.materials.add(std::make_shared<lambertian>(color(0.73, 0.73, 0.73)));
 
     // Room bounds
     const double x0 = -1.0;
@@ -396,7 +411,7 @@ static hittable_list cornell_with_earth()
         white
     ));
 
-    std::shared_ptr<material> light = std::make_shared<diffuse_light>(color(6.0, 6.0, 6.0));
+    material_id light = world.materials.add(std::make_shared<diffuse_light>(color(6.0, 6.0, 6.0)));
 
     world.add(std::make_shared<finite_plane>(
         point3(-0.3, y1 - 1e-4, -0.3),
@@ -414,13 +429,35 @@ static hittable_list cornell_with_earth()
 
 
     std::shared_ptr<texture> earth_tex = std::make_shared<image_texture>("Textures/earth.jpg");
-    std::shared_ptr<material> earth_mat = std::make_shared<lambertian>(earth_tex);
+    material_id earth_mat = world.materials.add(std::make_shared<lambertian>(earth_tex));
 
     std::shared_ptr<texture> moon_tex = std::make_shared<image_texture>("Textures/moon.jpg");
-    std::shared_ptr<material> moon_mat = std::make_shared<lambertian>(moon_tex);
+    material_id moon_mat = world.materials.add(std::make_shared<lambertian>(moon_tex));
 
     world.add(std::make_shared<sphere>(point3(0.0, 1.0, 0.0), 0.5, earth_mat));
     world.add(std::make_shared<sphere>(point3(0.75, 1.5, 0.5), 0.1, moon_mat));
 
+    world.build_bvh(accel);
     return world;
-}
\ No newline at end of file
+}
+// Every scene with a camera placement that frames it, for the accelerator benchmark
+struct scene_entry {
+    const char* name;
+    hittable_list (*build)(accelerator accel);
+    point3 lookfrom;
+    point3 lookat;
+    double vfov;
+};
+
+static const scene_entry all_scenes[] = {
+    { "random_scene", random_scene, point3(13.0, 2.0, 3.0), point3(0.0, 0.0, 0.0), 20.0 },
+    { "random_shapes_scene", random_shapes_scene, point3(13.0, 2.0, 3.0), point3(0.0, 0.0, 0.0), 20.0 },
+    { "cornell_room_basic", cornell_room_basic, point3(0.0, 1.0, -4.0), point3(0.0, 1.0, 0.0), 40.0 },
+    { "test_box_scene", test_box_scene, point3(0.0, 3.0, 5.0), point3(0.0, 1.0, 0.0), 40.0 },
+    { "test_inf_cylinder", test_inf_cylinder, point3(0.0, 3.0, 5.0), point3(0.0, 1.0, 0.0), 40.0 },
+    { "test_cylinder", test_cylinder, point3(0.0, 3.0, 5.0), point3(0.0, 1.0, 0.0), 40.0 },
+    { "test_capsule", test_capsule, point3(0.0, 3.0, 5.0), point3(0.0, 1.0, 0.0), 40.0 },
+    { "testSphere", testSphere, point3(0.0, 3.0, 5.0), point3(0.0, 1.0, 0.0), 40.0 },
+    { "earth_scene", earth_scene, point3(0.0, 0.0, 12.0), point3(0.0, 0.0, 0.0), 40.0 },
+    { "cornell_with_earth", cornell_with_earth, point3(0.0, 1.0, -4.0), point3(0.0, 1.0, 0.0), 40.0 },
+};
@@ -1,51 +1,84 @@
 #pragma once
 #include "hittable.h"
-// Implements ray-sphere intersection and stores sphere material data
+// Implements ray-sphere intersection and stores the sphere's material index
     // computes surface normals (and UVs if enabled) for shading/texture lookup
 class sphere : public hittable 
 {
 public:
     point3 center;
-    double radius;
-    shared_ptr<material> mat;
+    real radius;
+    material_id mat;
 
-    sphere() : center(), radius(1), mat(nullptr) {}
-    sphere(point3 c, double r, shared_ptr<material> m) : center(c), radius(r), mat(std::move(m)) {}
-    static void get_sphere_uv(const vec3& p, double& u, double& v) {
+    sphere() : center(), radius(1), mat(no_material) {}
+    sphere(point3 c, real r, material_id m) : center(c), radius(r), mat(m) {}
+    static void get_sphere_uv(const vec3& p, real& u, real& v) {
 
-        const double pi = 3.1415926535897932385;
+        const real pi = 3.1415926535897932385;
 
-        double theta = acos(-p.y());
-        double phi = atan2(-p.z(), p.x()) + pi;
+        real theta = acos(-p.y());
+        real phi = atan2(-p.z(), p.x()) + pi;
 
         u = phi / (2 * pi);
         v = theta / pi;
     }
-    bool hit(const ray& r, interval ray_t, hit_record& rec) const override 
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override 
+    {
+        real root;
+        if (!nearest_root(center, radius, r, ray_t, root)) return false;
+
+        rec.t = root;
+        rec.surface = this;
+        return true;
+    }
+
+    // The normal and the UV (acos/atan2) only for the closest hit
+    void finalize(const ray& r, hit_record& rec) const override
+    {
+        finalize_hit(center, radius, mat, r, rec);
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override
+    {
+        real root;
+        return nearest_root(center, radius, r, ray_t, root);
+    }
+
+    // Nearest t inside ray_t where the ray meets the sphere (also used by the shapes built from spheres)
+    static bool nearest_root(const point3& center, real radius, const ray& r, const interval& ray_t, real& root)
     {
         vec3 oc = r.origin() - center;
-        double a = r.direction().length_squared();
-        double half_b = dot(oc, r.direction());
-        double c = oc.length_squared() - radius * radius;
+        real a = r.direction().length_squared();
+        real half_b = dot(oc, r.direction());
+        real c = oc.length_squared() - radius * radius;
 
-        double discriminant = half_b * half_b - a * c;
+        real discriminant = half_b * half_b - a * c;
         if (discriminant < 0) return false;
-        double sqrtd = std::sqrt(discriminant);
+        real sqrtd = std::sqrt(discriminant);
 
-        double root = (-half_b - sqrtd) / a;
+        root = (-half_b - sqrtd) / a;
         if (!ray_t.surrounds(root)) 
         {
             root = (-half_b + sqrtd) / a;
             if (!ray_t.surrounds(root)) return false;
         }
+        return true;
+    }
 
-        rec.t = root;
+    // Surface interaction of a hit at rec.t (also used by the shapes built from spheres and compiled scenes)
+    static void finalize_hit(const point3& center, real radius, material_id mat, const ray& r, hit_record& rec)
+    {
         rec.p = r.at(rec.t);
         vec3 outward_normal = (rec.p - center) / radius;
         rec.set_face_normal(r, outward_normal);
 
         get_sphere_uv(outward_normal, rec.u, rec.v);
         rec.mat = mat;
-        return true;
+    }
+
+    aabb bounding_box() const override
+    {
+        // Negative radii (hollow glass shells) still cover |radius|
+        vec3 rvec(std::fabs(radius), std::fabs(radius), std::fabs(radius));
+        return aabb(center - rvec, center + rvec);
     }
 };
@@ -0,0 +1,413 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "hittable.h"
+#include "sphere.h"
+#include "cpu_features.h"
+#include "ray_packet.h"
+// Many spheres in structure of arrays form, intersected several at a time with SIMD
+    // centers and radii are kept as separate x, y, z and radius arrays so one load fills a register with 2 (SSE), 4 (AVX2) or 8 (AVX-512) spheres
+    // nearest() returns the closest root in a range and the index of its sphere, any() whether there is one (shadow rays)
+    // nearest_packet() is the same search for a packet of rays, with the rays in the SIMD lanes instead of the spheres
+    // the kernels work in the renderer's precision and never fuse multiply/add, so they pick the same sphere and t as sphere::nearest_root in a loop
+    // a float build has one kernel, AVX2 with 8 spheres per vector, the SSE, AVX-512 and packet kernels are double only
+    // ranges can start anywhere (compiled_scene hands in the spheres of one BVH leaf), the last partial vector is masked
+    // as a hittable it tests every sphere it holds, rec.primitive is the index of the one hit
+
+class sphere_batch : public hittable {
+public:
+    explicit sphere_batch(simd_isa requested = detect_simd_isa())
+    {
+        isa = simd_isa::scalar;
+#if RT_X86
+        isa = requested;
+#else
+        (void)requested;
+#endif
+    }
+
+    void add(const point3& center, real radius, material_id mat)
+    {
+        cx.push_back(center.x());
+        cy.push_back(center.y());
+        cz.push_back(center.z());
+        rad.push_back(radius);
+        mats.push_back(mat);
+
+        const vec3 rvec(std::fabs(radius), std::fabs(radius), std::fabs(radius));
+        bbox = aabb(bbox, aabb(center - rvec, center + rvec));
+    }
+
+    size_t size() const { return rad.size(); }
+    point3 center(size_t i) const { return point3(cx[i], cy[i], cz[i]); }
+    real radius(size_t i) const { return rad[i]; }
+    material_id material(size_t i) const { return mats[i]; }
+    simd_isa kernel() const { return isa; }
+
+    // Closest root inside (t_min, t_max) over spheres [begin, end), t_max and index receive it
+        // ties go to the lowest index, like testing the spheres in order with a shrinking interval
+    bool nearest(const ray& r, size_t begin, size_t end, real t_min, real& t_max, uint32_t& index) const
+    {
+        // One or two spheres are cheaper one at a time than setting up a vector
+        if (end - begin <= 2) return nearest_scalar(r, begin, end, t_min, t_max, index);
+
+#if RT_X86 && RT_REAL_IS_DOUBLE
+        // A range that fits in one AVX2 vector doesn't need the wider registers
+        if (isa == simd_isa::avx512 && end - begin > 4) return nearest_avx512(r, begin, end, t_min, t_max, index);
+        if (isa >= simd_isa::avx2) return nearest_avx2(r, begin, end, t_min, t_max, index);
+        if (isa == simd_isa::sse) return nearest_sse(r, begin, end, t_min, t_max, index);
+#elif RT_X86
+        if (isa >= simd_isa::avx2) return nearest_avx2_float(r, begin, end, t_min, t_max, index);
+#endif
+        return nearest_scalar(r, begin, end, t_min, t_max, index);
+    }
+
+    // Any sphere of [begin, end) with a root inside ray_t
+    bool any(const ray& r, size_t begin, size_t end, const interval& ray_t) const
+    {
+        real t_max = ray_t.max;
+        uint32_t index;
+        return nearest(r, begin, end, ray_t.min, t_max, index);
+    }
+
+    // nearest() for every ray of a packet in mask, closest[k] and index[k] are ray k's closest root so far and its sphere
+        // the SIMD kernel runs over the rays (4 per AVX2 vector) one sphere at a time, each ray sees the spheres in order
+        // returns the rays whose closest root is now one of these spheres
+    unsigned nearest_packet(const ray_packet& rays, unsigned mask, size_t begin, size_t end, real t_min, real* closest, uint32_t* index) const
+    {
+#if RT_X86 && RT_REAL_IS_DOUBLE
+        if (isa >= simd_isa::avx2) return nearest_packet_avx2(rays, mask, begin, end, t_min, closest, index);
+#endif
+        unsigned found = 0;
+        for (int k = 0; k < rays.count; ++k)
+        {
+            if (((mask >> k) & 1u) && nearest_scalar(rays.get(k), begin, end, t_min, closest[k], index[k])) found |= 1u << k;
+        }
+        return found;
+    }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        real t = ray_t.max;
+        uint32_t index;
+        if (!nearest(r, 0, size(), ray_t.min, t, index)) return false;
+
+        rec.t = t;
+        rec.primitive = static_cast<int>(index);
+        rec.surface = this;
+        return true;
+    }
+
+    void finalize(const ray& r, hit_record& rec) const override
+    {
+        const size_t i = static_cast<size_t>(rec.primitive);
+        sphere::finalize_hit(center(i), rad[i], mats[i], r, rec);
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override
+    {
+        return any(r, 0, size(), ray_t);
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+private:
+    std::vector<real> cx, cy, cz, rad;
+    std::vector<material_id> mats;
+    aabb bbox = aabb::empty;
+    simd_isa isa = simd_isa::scalar;
+
+    bool nearest_scalar(const ray& r, size_t begin, size_t end, real t_min, real& t_max, uint32_t& index) const
+    {
+        bool found = false;
+        for (size_t i = begin; i < end; ++i)
+        {
+            real t;
+            if (sphere::nearest_root(center(i), rad[i], r, interval(t_min, t_max), t))
+            {
+                t_max = t;
+                index = static_cast<uint32_t>(i);
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    // Lane roots are checked against the interval at the start of the vector, the smallest one then wins:
+        // a root the scalar loop would have rejected against a closer hit from the same vector is larger than that hit anyway
+        // most vectors miss with every lane, those skip the square roots and divisions after the discriminant test
+#if RT_X86 && RT_REAL_IS_DOUBLE
+    bool nearest_sse(const ray& r, size_t begin, size_t end, real t_min, real& t_max, uint32_t& index) const
+    {
+        const real a_s = r.direction().length_squared();
+        const __m128d ox = _mm_set1_pd(r.orig[0]), oy = _mm_set1_pd(r.orig[1]), oz = _mm_set1_pd(r.orig[2]);
+        const __m128d dx = _mm_set1_pd(r.dir[0]), dy = _mm_set1_pd(r.dir[1]), dz = _mm_set1_pd(r.dir[2]);
+        const __m128d a = _mm_set1_pd(a_s);
+        const __m128d lo = _mm_set1_pd(t_min);
+        const __m128d sign = _mm_set1_pd(-0.0);
+        bool found = false;
+
+        size_t i = begin;
+        for (; i + 2 <= end; i += 2)
+        {
+            const __m128d ocx = _mm_sub_pd(ox, _mm_loadu_pd(&cx[i]));
+            const __m128d ocy = _mm_sub_pd(oy, _mm_loadu_pd(&cy[i]));
+            const __m128d ocz = _mm_sub_pd(oz, _mm_loadu_pd(&cz[i]));
+            const __m128d rr = _mm_loadu_pd(&rad[i]);
+
+            const __m128d half_b = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, dx), _mm_mul_pd(ocy, dy)), _mm_mul_pd(ocz, dz));
+            const __m128d oc2 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, ocx), _mm_mul_pd(ocy, ocy)), _mm_mul_pd(ocz, ocz));
+            const __m128d c = _mm_sub_pd(oc2, _mm_mul_pd(rr, rr));
+            const __m128d disc = _mm_sub_pd(_mm_mul_pd(half_b, half_b), _mm_mul_pd(a, c));
+            if (!_mm_movemask_pd(_mm_cmpge_pd(disc, _mm_setzero_pd()))) continue;
+
+            const __m128d sqrtd = _mm_sqrt_pd(disc); // NaN for a lane that misses, which fails every comparison below
+            const __m128d neg_b = _mm_xor_pd(half_b, sign);
+            const __m128d hi = _mm_set1_pd(t_max);
+
+            const __m128d near_root = _mm_div_pd(_mm_sub_pd(neg_b, sqrtd), a);
+            const __m128d far_root = _mm_div_pd(_mm_add_pd(neg_b, sqrtd), a);
+            const __m128d near_ok = _mm_and_pd(_mm_cmplt_pd(lo, near_root), _mm_cmplt_pd(near_root, hi));
+            const __m128d far_ok = _mm_and_pd(_mm_cmplt_pd(lo, far_root), _mm_cmplt_pd(far_root, hi));
+
+            alignas(16) real roots[2];
+            _mm_store_pd(roots, _mm_or_pd(_mm_and_pd(near_ok, near_root), _mm_andnot_pd(near_ok, far_root)));
+            const int hits = _mm_movemask_pd(_mm_or_pd(near_ok, far_ok));
+            if (hits) found |= pick_lane(roots, hits, 2, i, t_max, index);
+        }
+
+        if (i < end) found |= nearest_scalar(r, i, end, t_min, t_max, index);
+        return found;
+    }
+
+    RT_TARGET_AVX2_EXACT bool nearest_avx2(const ray& r, size_t begin, size_t end, real t_min, real& t_max, uint32_t& index) const
+    {
+        const real a_s = r.direction().length_squared();
+        const __m256d ox = _mm256_set1_pd(r.orig[0]), oy = _mm256_set1_pd(r.orig[1]), oz = _mm256_set1_pd(r.orig[2]);
+        const __m256d dx = _mm256_set1_pd(r.dir[0]), dy = _mm256_set1_pd(r.dir[1]), dz = _mm256_set1_pd(r.dir[2]);
+        const __m256d a = _mm256_set1_pd(a_s);
+        const __m256d lo = _mm256_set1_pd(t_min);
+        const __m256d sign = _mm256_set1_pd(-0.0);
+        const __m256i lane = _mm256_set_epi64x(3, 2, 1, 0);
+        bool found = false;
+
+        for (size_t i = begin; i < end; i += 4)
+        {
+            // Lanes past end load nothing (maskload reads zeros) and are masked out of the result
+            const long long left = static_cast<long long>(end - i);
+            const __m256i load = _mm256_cmpgt_epi64(_mm256_set1_epi64x(left), lane);
+
+            const __m256d ocx = _mm256_sub_pd(ox, _mm256_maskload_pd(&cx[i], load));
+            const __m256d ocy = _mm256_sub_pd(oy, _mm256_maskload_pd(&cy[i], load));
+            const __m256d ocz = _mm256_sub_pd(oz, _mm256_maskload_pd(&cz[i], load));
+            const __m256d rr = _mm256_maskload_pd(&rad[i], load);
+
+            const __m256d half_b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, dx), _mm256_mul_pd(ocy, dy)), _mm256_mul_pd(ocz, dz));
+            const __m256d oc2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)), _mm256_mul_pd(ocz, ocz));
+            const __m256d c = _mm256_sub_pd(oc2, _mm256_mul_pd(rr, rr));
+            const __m256d disc = _mm256_sub_pd(_mm256_mul_pd(half_b, half_b), _mm256_mul_pd(a, c));
+            if (!_mm256_movemask_pd(_mm256_and_pd(_mm256_cmp_pd(disc, _mm256_setzero_pd(), _CMP_GE_OQ), _mm256_castsi256_pd(load)))) continue;
+
+            const __m256d sqrtd = _mm256_sqrt_pd(disc);
+            const __m256d neg_b = _mm256_xor_pd(half_b, sign);
+            const __m256d hi = _mm256_set1_pd(t_max);
+
+            const __m256d near_root = _mm256_div_pd(_mm256_sub_pd(neg_b, sqrtd), a);
+            const __m256d far_root = _mm256_div_pd(_mm256_add_pd(neg_b, sqrtd), a);
+            const __m256d near_ok = _mm256_and_pd(_mm256_cmp_pd(lo, near_root, _CMP_LT_OQ), _mm256_cmp_pd(near_root, hi, _CMP_LT_OQ));
+            const __m256d far_ok = _mm256_and_pd(_mm256_cmp_pd(lo, far_root, _CMP_LT_OQ), _mm256_cmp_pd(far_root, hi, _CMP_LT_OQ));
+
+            alignas(32) real roots[4];
+            _mm256_store_pd(roots, _mm256_blendv_pd(far_root, near_root, near_ok));
+            const int hits = _mm256_movemask_pd(_mm256_and_pd(_mm256_or_pd(near_ok, far_ok), _mm256_castsi256_pd(load)));
+            if (hits) found |= pick_lane(roots, hits, 4, i, t_max, index);
+        }
+        return found;
+    }
+
+    RT_TARGET_AVX512_EXACT bool nearest_avx512(const ray& r, size_t begin, size_t end, real t_min, real& t_max, uint32_t& index) const
+    {
+        const real a_s = r.direction().length_squared();
+        const __m512d ox = _mm512_set1_pd(r.orig[0]), oy = _mm512_set1_pd(r.orig[1]), oz = _mm512_set1_pd(r.orig[2]);
+        const __m512d dx = _mm512_set1_pd(r.dir[0]), dy = _mm512_set1_pd(r.dir[1]), dz = _mm512_set1_pd(r.dir[2]);
+        const __m512d a = _mm512_set1_pd(a_s);
+        const __m512d lo = _mm512_set1_pd(t_min);
+        const __m512i sign = _mm512_set1_epi64(static_cast<long long>(0x8000000000000000ull));
+        bool found = false;
+
+        for (size_t i = begin; i < end; i += 8)
+        {
+            const size_t left = end - i;
+            const __mmask8 load = (left >= 8) ? static_cast<__mmask8>(0xFF) : static_cast<__mmask8>((1u << left) - 1u);
+
+            const __m512d ocx = _mm512_sub_pd(ox, _mm512_maskz_loadu_pd(load, &cx[i]));
+            const __m512d ocy = _mm512_sub_pd(oy, _mm512_maskz_loadu_pd(load, &cy[i]));
+            const __m512d ocz = _mm512_sub_pd(oz, _mm512_maskz_loadu_pd(load, &cz[i]));
+            const __m512d rr = _mm512_maskz_loadu_pd(load, &rad[i]);
+
+            const __m512d half_b = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ocx, dx), _mm512_mul_pd(ocy, dy)), _mm512_mul_pd(ocz, dz));
+            const __m512d oc2 = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ocx, ocx), _mm512_mul_pd(ocy, ocy)), _mm512_mul_pd(ocz, ocz));
+            const __m512d c = _mm512_sub_pd(oc2, _mm512_mul_pd(rr, rr));
+            const __m512d disc = _mm512_sub_pd(_mm512_mul_pd(half_b, half_b), _mm512_mul_pd(a, c));
+            const __mmask8 solvable = _mm512_mask_cmp_pd_mask(load, disc, _mm512_setzero_pd(), _CMP_GE_OQ);
+            if (!solvable) continue;
+
+            const __m512d sqrtd = _mm512_maskz_sqrt_pd(solvable, disc);
+            const __m512d neg_b = _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(half_b), sign));
+            const __m512d hi = _mm512_set1_pd(t_max);
+
+            const __m512d near_root = _mm512_div_pd(_mm512_sub_pd(neg_b, sqrtd), a);
+            const __m512d far_root = _mm512_div_pd(_mm512_add_pd(neg_b, sqrtd), a);
+            const __mmask8 near_ok = _mm512_mask_cmp_pd_mask(_mm512_cmp_pd_mask(lo, near_root, _CMP_LT_OQ), near_root, hi, _CMP_LT_OQ);
+            const __mmask8 far_ok = _mm512_mask_cmp_pd_mask(_mm512_cmp_pd_mask(lo, far_root, _CMP_LT_OQ), far_root, hi, _CMP_LT_OQ);
+
+            const int hits = static_cast<int>((near_ok | far_ok) & solvable);
+            if (!hits) continue;
+
+            alignas(64) real roots[8];
+            _mm512_store_pd(roots, _mm512_mask_blend_pd(near_ok, far_root, near_root));
+            found |= pick_lane(roots, hits, 8, i, t_max, index);
+        }
+        return found;
+    }
+
+    // Lanes are rays here: sphere::nearest_root for four rays at once, the near root first and the far one if it is outside the interval
+    RT_TARGET_AVX2_EXACT unsigned nearest_packet_avx2(const ray_packet& rays, unsigned mask, size_t begin, size_t end, real t_min,
+        real* closest, uint32_t* index) const
+    {
+        const __m256d lo = _mm256_set1_pd(t_min);
+        const __m256d sign = _mm256_set1_pd(-0.0);
+        const __m256i lane_bit = _mm256_set_epi64x(8, 4, 2, 1);
+        unsigned found = 0;
+
+        for (int g = 0; g < rays.count; g += 4)
+        {
+            const unsigned group = (mask >> g) & 0xFu;
+            if (!group) continue;
+
+            const __m256d active = _mm256_castsi256_pd(_mm256_cmpeq_epi64(
+                _mm256_and_si256(_mm256_set1_epi64x(static_cast<long long>(group)), lane_bit), lane_bit));
+            const __m256d ox = _mm256_loadu_pd(rays.ox + g), oy = _mm256_loadu_pd(rays.oy + g), oz = _mm256_loadu_pd(rays.oz + g);
+            const __m256d dx = _mm256_loadu_pd(rays.dx + g), dy = _mm256_loadu_pd(rays.dy + g), dz = _mm256_loadu_pd(rays.dz + g);
+            const __m256d a = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz));
+
+            __m256d hi = _mm256_loadu_pd(closest + g);
+            __m256i best = _mm256_setzero_si256();
+            __m256d updated = _mm256_setzero_pd();
+
+            for (size_t i = begin; i < end; ++i)
+            {
+                const __m256d ocx = _mm256_sub_pd(ox, _mm256_set1_pd(cx[i]));
+                const __m256d ocy = _mm256_sub_pd(oy, _mm256_set1_pd(cy[i]));
+                const __m256d ocz = _mm256_sub_pd(oz, _mm256_set1_pd(cz[i]));
+                const __m256d rr = _mm256_set1_pd(rad[i]);
+
+                const __m256d half_b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, dx), _mm256_mul_pd(ocy, dy)), _mm256_mul_pd(ocz, dz));
+                const __m256d oc2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)), _mm256_mul_pd(ocz, ocz));
+                const __m256d c = _mm256_sub_pd(oc2, _mm256_mul_pd(rr, rr));
+                const __m256d disc = _mm256_sub_pd(_mm256_mul_pd(half_b, half_b), _mm256_mul_pd(a, c));
+                const __m256d solvable = _mm256_and_pd(_mm256_cmp_pd(disc, _mm256_setzero_pd(), _CMP_GE_OQ), active);
+                if (!_mm256_movemask_pd(solvable)) continue;
+
+                const __m256d sqrtd = _mm256_sqrt_pd(disc);
+                const __m256d neg_b = _mm256_xor_pd(half_b, sign);
+
+                const __m256d near_root = _mm256_div_pd(_mm256_sub_pd(neg_b, sqrtd), a);
+                const __m256d far_root = _mm256_div_pd(_mm256_add_pd(neg_b, sqrtd), a);
+                const __m256d near_ok = _mm256_and_pd(_mm256_cmp_pd(lo, near_root, _CMP_LT_OQ), _mm256_cmp_pd(near_root, hi, _CMP_LT_OQ));
+                const __m256d far_ok = _mm256_and_pd(_mm256_cmp_pd(lo, far_root, _CMP_LT_OQ), _mm256_cmp_pd(far_root, hi, _CMP_LT_OQ));
+                const __m256d hit = _mm256_and_pd(_mm256_or_pd(near_ok, far_ok), solvable);
+
+                hi = _mm256_blendv_pd(hi, _mm256_blendv_pd(far_root, near_root, near_ok), hit);
+                best = _mm256_castpd_si256(_mm256_blendv_pd(_mm256_castsi256_pd(best),
+                    _mm256_castsi256_pd(_mm256_set1_epi64x(static_cast<long long>(i))), hit));
+                updated = _mm256_or_pd(updated, hit);
+            }
+
+            const unsigned lanes = static_cast<unsigned>(_mm256_movemask_pd(updated));
+            if (!lanes) continue;
+
+            alignas(32) real roots[4];
+            alignas(32) long long spheres[4];
+            _mm256_store_pd(roots, hi);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(spheres), best);
+            for (int k = 0; k < 4; ++k)
+            {
+                if (!((lanes >> k) & 1u)) continue;
+                closest[g + k] = roots[k];
+                index[g + k] = static_cast<uint32_t>(spheres[k]);
+            }
+            found |= lanes << g;
+        }
+        return found;
+    }
+#elif RT_X86
+    // nearest_avx2 on float storage, a vector holds 8 spheres
+    RT_TARGET_AVX2_EXACT bool nearest_avx2_float(const ray& r, size_t begin, size_t end, float t_min, float& t_max, uint32_t& index) const
+    {
+        const float a_s = r.direction().length_squared();
+        const __m256 ox = _mm256_set1_ps(r.orig[0]), oy = _mm256_set1_ps(r.orig[1]), oz = _mm256_set1_ps(r.orig[2]);
+        const __m256 dx = _mm256_set1_ps(r.dir[0]), dy = _mm256_set1_ps(r.dir[1]), dz = _mm256_set1_ps(r.dir[2]);
+        const __m256 a = _mm256_set1_ps(a_s);
+        const __m256 lo = _mm256_set1_ps(t_min);
+        const __m256 sign = _mm256_set1_ps(-0.0f);
+        const __m256i lane = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+        bool found = false;
+
+        for (size_t i = begin; i < end; i += 8)
+        {
+            const int left = static_cast<int>(std::min<size_t>(end - i, 8));
+            const __m256i load = _mm256_cmpgt_epi32(_mm256_set1_epi32(left), lane);
+
+            const __m256 ocx = _mm256_sub_ps(ox, _mm256_maskload_ps(&cx[i], load));
+            const __m256 ocy = _mm256_sub_ps(oy, _mm256_maskload_ps(&cy[i], load));
+            const __m256 ocz = _mm256_sub_ps(oz, _mm256_maskload_ps(&cz[i], load));
+            const __m256 rr = _mm256_maskload_ps(&rad[i], load);
+
+            const __m256 half_b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, dx), _mm256_mul_ps(ocy, dy)), _mm256_mul_ps(ocz, dz));
+            const __m256 oc2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)), _mm256_mul_ps(ocz, ocz));
+            const __m256 c = _mm256_sub_ps(oc2, _mm256_mul_ps(rr, rr));
+            const __m256 disc = _mm256_sub_ps(_mm256_mul_ps(half_b, half_b), _mm256_mul_ps(a, c));
+            if (!_mm256_movemask_ps(_mm256_and_ps(_mm256_cmp_ps(disc, _mm256_setzero_ps(), _CMP_GE_OQ), _mm256_castsi256_ps(load)))) continue;
+
+            const __m256 sqrtd = _mm256_sqrt_ps(disc);
+            const __m256 neg_b = _mm256_xor_ps(half_b, sign);
+            const __m256 hi = _mm256_set1_ps(t_max);
+
+            const __m256 near_root = _mm256_div_ps(_mm256_sub_ps(neg_b, sqrtd), a);
+            const __m256 far_root = _mm256_div_ps(_mm256_add_ps(neg_b, sqrtd), a);
+            const __m256 near_ok = _mm256_and_ps(_mm256_cmp_ps(lo, near_root, _CMP_LT_OQ), _mm256_cmp_ps(near_root, hi, _CMP_LT_OQ));
+            const __m256 far_ok = _mm256_and_ps(_mm256_cmp_ps(lo, far_root, _CMP_LT_OQ), _mm256_cmp_ps(far_root, hi, _CMP_LT_OQ));
+
+            alignas(32) float roots[8];
+            _mm256_store_ps(roots, _mm256_blendv_ps(far_root, near_root, near_ok));
+            const int hits = _mm256_movemask_ps(_mm256_and_ps(_mm256_or_ps(near_ok, far_ok), _mm256_castsi256_ps(load)));
+            if (hits) found |= pick_lane(roots, hits, 8, i, t_max, index);
+        }
+        return found;
+    }
+#endif
+
+    // Smallest root among the lanes set in hits (lowest lane on ties), taken if it beats t_max
+    static RT_FORCE_INLINE bool pick_lane(const real* roots, int hits, int lanes, size_t first, real& t_max, uint32_t& index)
+    {
+        int best = -1;
+        for (int k = 0; k < lanes; ++k)
+        {
+            if ((hits >> k) & 1)
+            {
+                if (best < 0 || roots[k] < roots[best]) best = k;
+            }
+        }
+        if (best < 0 || !(roots[best] < t_max)) return false;
+
+        t_max = roots[best];
+        index = static_cast<uint32_t>(first + static_cast<size_t>(best));
+        return true;
+    }
+};
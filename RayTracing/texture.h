@@ -4,7 +4,7 @@
 class texture {
 public:
     virtual ~texture() = default;
-    virtual color value(double u, double v, const point3& p) const = 0;
+    virtual color value(real u, real v, const point3& p) const = 0;
 };
 
 class solid_color : public texture {
@@ -12,7 +12,7 @@ public:
     solid_color() = default;
     explicit solid_color(const color& c) : color_value(c) {}
 
-    color value(double, double, const point3&) const override {
+    color value(real, real, const point3&) const override {
         return color_value;
     }
 
@@ -0,0 +1,236 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+// Long lived work-stealing thread pool shared by every render the camera runs
+    // each worker owns a deque, pops its own work from the front and steals from the back of random victims
+    // threads (and their caches) stay warm between renders, modes and frames
+
+class thread_pool {
+public:
+    // Tasks receive the index of the worker running them so callers can keep per-worker scratch data
+    using task = std::function<void(unsigned)>;
+
+    explicit thread_pool(unsigned thread_count = 0)
+    {
+        if (thread_count == 0) {
+            thread_count = std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        worker_count = thread_count;
+
+        queues.reserve(thread_count);
+        for (unsigned i = 0; i < thread_count; ++i)
+        {
+            queues.push_back(std::make_unique<worker_queue>());
+        }
+
+        workers.reserve(thread_count);
+        for (unsigned i = 0; i < thread_count; ++i)
+        {
+            workers.emplace_back([this, i]() { worker_loop(i); });
+        }
+    }
+
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+
+        for (std::thread& th : workers)
+        {
+            th.join();
+        }
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    unsigned size() const { return worker_count; }
+
+    // Queue a single task on the given worker's deque
+    void submit(task t, unsigned worker_hint = 0)
+    {
+        pending.fetch_add(1);
+        push(worker_hint % size(), std::move(t));
+        notify_workers();
+    }
+
+    // Queue fn(index, worker) for every index in [0, count)
+        // indices are split into contiguous blocks, one per worker, so each worker starts on neighbouring work
+        // idle workers steal from the far end of other blocks
+        // fn is copied once and kept until wait() sees the pool idle, tasks only carry a pointer to it and their index
+    void submit_range(int count, const std::function<void(int, unsigned)>& fn)
+    {
+        if (count <= 0) return;
+
+        const range_fn* shared = nullptr;
+        {
+            // Counted under the lock that wait() frees ranges under, so a range is never freed before its tasks ran
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            ranges.push_back(std::make_unique<range_fn>(fn));
+            shared = ranges.back().get();
+            pending.fetch_add(count);
+        }
+
+        const unsigned n = size();
+        for (unsigned w = 0; w < n; ++w)
+        {
+            int begin = static_cast<int>((static_cast<long long>(count) * w) / n);
+            int end = static_cast<int>((static_cast<long long>(count) * (w + 1)) / n);
+
+            for (int index = begin; index < end; ++index)
+            {
+                push(w, [shared, index](unsigned worker) { (*shared)(index, worker); });
+            }
+        }
+
+        notify_workers();
+    }
+
+    // Block until every submitted task has finished, then rethrow the first exception a task threw (if any)
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        idle.wait(lock, [this]() { return pending.load() == 0; });
+        ranges.clear();
+
+        if (failure)
+        {
+            std::exception_ptr e = failure;
+            failure = nullptr;
+            std::rethrow_exception(e);
+        }
+    }
+
+private:
+    using range_fn = std::function<void(int, unsigned)>;
+
+    struct worker_queue {
+        std::mutex mutex;
+        std::deque<task> tasks;
+    };
+
+    std::vector<std::unique_ptr<worker_queue>> queues;
+    std::vector<std::thread> workers;
+    unsigned worker_count = 0; // set before workers start so they can read it without locking
+
+    std::atomic<int> pending{ 0 }; // submitted but not yet finished
+    std::atomic<int> queued{ 0 };  // still sitting in a deque
+
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    bool stopping = false;
+
+    std::vector<std::unique_ptr<range_fn>> ranges; // functions of submit_range calls, guarded by sleep_mutex
+    std::exception_ptr failure;                     // first exception a task threw since the last wait(), guarded by sleep_mutex
+
+    void push(unsigned worker, task t)
+    {
+        worker_queue& q = *queues[worker];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.tasks.push_back(std::move(t));
+        queued.fetch_add(1);
+    }
+
+    void notify_workers()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+        }
+        wake.notify_all();
+    }
+
+    // Owner takes work in submission order from the front of its own deque
+    bool pop_local(unsigned worker, task& out)
+    {
+        worker_queue& q = *queues[worker];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.tasks.empty()) return false;
+
+        out = std::move(q.tasks.front());
+        q.tasks.pop_front();
+        queued.fetch_sub(1);
+        return true;
+    }
+
+    // Thieves take from the back of a random victim, which is the work furthest from what the owner is doing
+    bool steal(unsigned thief, task& out, std::minstd_rand& rng)
+    {
+        const unsigned n = size();
+        if (n < 2) return false;
+
+        const unsigned start = static_cast<unsigned>(rng() % n);
+        for (unsigned k = 0; k < n; ++k)
+        {
+            unsigned victim = (start + k) % n;
+            if (victim == thief) continue;
+
+            worker_queue& q = *queues[victim];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (q.tasks.empty()) continue;
+
+            out = std::move(q.tasks.back());
+            q.tasks.pop_back();
+            queued.fetch_sub(1);
+            return true;
+        }
+        return false;
+    }
+
+    void task_finished()
+    {
+        if (pending.fetch_sub(1) == 1)
+        {
+            {
+                std::lock_guard<std::mutex> lock(sleep_mutex);
+            }
+            idle.notify_all();
+        }
+    }
+
+    void worker_loop(unsigned index)
+    {
+        std::minstd_rand rng(index + 1);
+
+        while (true)
+        {
+            task t;
+            if (pop_local(index, t) || steal(index, t, rng))
+            {
+                // Counts the task as finished even when it throws, so wait() cannot hang on it
+                struct finished {
+                    thread_pool& pool;
+                    ~finished() { pool.task_finished(); }
+                } guard{ *this };
+
+                try
+                {
+                    t(index);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(sleep_mutex);
+                    if (!failure) failure = std::current_exception();
+                }
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            wake.wait(lock, [this]() { return stopping || queued.load() > 0; });
+            if (stopping && queued.load() == 0) return;
+        }
+    }
+};
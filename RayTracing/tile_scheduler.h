@@ -0,0 +1,129 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+// Splits the image into square tiles and orders them for the render workers
+    // tiles are issued along a space filling curve so neighbouring work stays close together in the scene
+    // small tiles also balance uneven scenes better than whole scanlines
+
+// Order tiles are issued in
+enum class tile_order {
+    scanline,
+    morton,
+    hilbert
+};
+
+// Pixel rectangle [x0, x1) x [y0, y1)
+struct tile {
+    int x0 = 0, y0 = 0;
+    int x1 = 0, y1 = 0;
+
+    int width() const { return x1 - x0; }
+    int height() const { return y1 - y0; }
+    int pixel_count() const { return width() * height(); }
+};
+
+class tile_scheduler {
+public:
+    // Rows [row_begin, row_end) are covered (row_end < 0 means the full height), tiles start at row_begin
+    tile_scheduler(int image_width, int image_height, int tile_size, tile_order order = tile_order::morton,
+        int row_begin = 0, int row_end = -1)
+    {
+        if (row_end < 0 || row_end > image_height) row_end = image_height;
+        row_begin = std::max(0, std::min(row_begin, row_end));
+
+        size = std::max(1, tile_size);
+        tiles_x = (image_width + size - 1) / size;
+        tiles_y = (row_end - row_begin + size - 1) / size;
+
+        // Key every tile by its position on the curve, then sort to get the issue order
+        std::vector<std::pair<uint64_t, tile>> keyed;
+        keyed.reserve(static_cast<size_t>(tiles_x * tiles_y));
+
+        int side = 1;
+        while (side < tiles_x || side < tiles_y) side <<= 1;
+
+        for (int ty = 0; ty < tiles_y; ++ty)
+        {
+            for (int tx = 0; tx < tiles_x; ++tx)
+            {
+                tile t;
+                t.x0 = tx * size;
+                t.y0 = row_begin + ty * size;
+                t.x1 = std::min(t.x0 + size, image_width);
+                t.y1 = std::min(t.y0 + size, row_end);
+
+                uint64_t key = 0;
+                switch (order)
+                {
+                case tile_order::scanline: key = static_cast<uint64_t>(ty) * tiles_x + tx; break;
+                case tile_order::morton:   key = morton_code(tx, ty); break;
+                case tile_order::hilbert:  key = hilbert_index(side, tx, ty); break;
+                }
+
+                keyed.emplace_back(key, t);
+            }
+        }
+
+        std::sort(keyed.begin(), keyed.end(),
+            [](const std::pair<uint64_t, tile>& a, const std::pair<uint64_t, tile>& b) { return a.first < b.first; });
+
+        tiles.reserve(keyed.size());
+        for (const std::pair<uint64_t, tile>& k : keyed)
+        {
+            tiles.push_back(k.second);
+        }
+    }
+
+    int tile_count() const { return static_cast<int>(tiles.size()); }
+    int tile_size() const { return size; }
+    const tile& operator[](int index) const { return tiles[static_cast<size_t>(index)]; }
+
+    // Interleave the bits of x and y (Z-order curve)
+    static uint64_t morton_code(uint32_t x, uint32_t y)
+    {
+        return spread_bits(x) | (spread_bits(y) << 1);
+    }
+
+    // Distance of (x, y) along a Hilbert curve covering a side x side grid (side is a power of two)
+    static uint64_t hilbert_index(int side, int x, int y)
+    {
+        uint64_t d = 0;
+        for (int s = side / 2; s > 0; s /= 2)
+        {
+            int rx = (x & s) > 0 ? 1 : 0;
+            int ry = (y & s) > 0 ? 1 : 0;
+            d += static_cast<uint64_t>(s) * static_cast<uint64_t>(s) * static_cast<uint64_t>((3 * rx) ^ ry);
+
+            // Rotate the quadrant so the curve stays continuous
+            if (ry == 0)
+            {
+                if (rx == 1)
+                {
+                    x = side - 1 - x;
+                    y = side - 1 - y;
+                }
+                std::swap(x, y);
+            }
+        }
+        return d;
+    }
+
+private:
+    int size = 16;
+    int tiles_x = 0;
+    int tiles_y = 0;
+    std::vector<tile> tiles;
+
+    static uint64_t spread_bits(uint32_t v)
+    {
+        uint64_t x = v;
+        x = (x | (x << 16)) & 0x0000FFFF0000FFFFull;
+        x = (x | (x << 8)) & 0x00FF00FF00FF00FFull;
+        x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0Full;
+        x = (x | (x << 2)) & 0x3333333333333333ull;
+        x = (x | (x << 1)) & 0x5555555555555555ull;
+        return x;
+    }
+};
@@ -0,0 +1,410 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "hittable.h"
+// Uniform grid acceleration structure, optionally two-level
+    // cells are sized from the object density (about `density` cells per object), each cell lists the objects whose box overlaps it
+    // traversal walks the cells the ray passes through in order (3D-DDA) and stops once the closest hit lies before the next cell
+    // objects that cover most of the scene (a ground sphere) would sit in every cell and stretch the grid over empty space,
+    // so they are kept in a short list tested before the walk instead
+    // two-level: a cell holding many objects gets its own finer grid over the cell's box
+    // each primitive is tested with the full ray interval, a small per-ray mailbox skips the ones already tested in an earlier cell
+
+// Cell counts and occupancy, shown in the render settings
+struct grid_stats {
+    int resolution[3] = { 0, 0, 0 };
+    size_t cells = 0;
+    size_t empty_cells = 0;
+    size_t references = 0; // object entries over every cell (an object is listed once per cell it overlaps)
+    size_t objects = 0;    // objects in the grid
+    size_t large = 0;      // objects kept out of the grid and tested on every ray
+    size_t subgrids = 0;
+};
+
+class uniform_grid : public hittable {
+public:
+    static constexpr double default_density = 2.0;
+    static constexpr int max_resolution = 128;   // cells per axis
+    static constexpr size_t subgrid_min_objects = 8; // a cell with more objects than this gets a subgrid (two-level only)
+
+    // Build over every object (all with finite bounds), object IDs are the objects' indices in this vector
+    explicit uniform_grid(const std::vector<shared_ptr<hittable>>& objects, bool two_level = false, double density = default_density)
+    {
+        if (objects.empty()) return;
+
+        for (const shared_ptr<hittable>& object : objects)
+        {
+            bbox = aabb(bbox, object->bounding_box());
+        }
+
+        std::vector<uint32_t> gridded;
+        aabb grid_box = aabb::empty;
+        for (size_t i = 0; i < objects.size(); ++i)
+        {
+            const aabb box = objects[i]->bounding_box();
+            if (covers_most_of(box, bbox))
+            {
+                large.push_back(static_cast<uint32_t>(i));
+                large_boxes.push_back(box);
+            }
+            else
+            {
+                gridded.push_back(static_cast<uint32_t>(i));
+                grid_box = aabb(grid_box, box);
+            }
+
+            prims.push_back(objects[i].get());
+            prim_boxes.push_back(box);
+            prim_owners.push_back(objects[i]);
+        }
+
+        info.objects = gridded.size();
+        info.large = large.size();
+        if (gridded.empty()) return;
+
+        build_level(root, gridded, grid_box, density);
+        info.resolution[0] = root.res[0];
+        info.resolution[1] = root.res[1];
+        info.resolution[2] = root.res[2];
+
+        if (two_level) build_subgrids(density);
+
+        count_cells(root);
+        for (const grid_level& sub : subgrids)
+        {
+            count_cells(sub);
+        }
+        info.subgrids = subgrids.size();
+    }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        hit_record closest_rec, temp_rec;
+        if (!trace<false>(r, ray_t, &closest_rec, &temp_rec)) return false;
+
+        rec = std::move(closest_rec);
+        return true;
+    }
+
+    // Same walk, the first primitive hit ends it
+    bool occluded(const ray& r, interval ray_t) const override
+    {
+        return trace<true>(r, ray_t, nullptr, nullptr);
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    const grid_stats& stats() const { return info; }
+
+private:
+    // One grid: cell c lists refs[cell_first[c] .. cell_first[c + 1]), or walks subgrids[child[c]] when that is set
+    struct grid_level {
+        aabb box = aabb::empty;
+        int res[3] = { 1, 1, 1 };
+        double cell_size[3] = { 0.0, 0.0, 0.0 };
+        double inv_cell_size[3] = { 0.0, 0.0, 0.0 };
+        std::vector<uint32_t> cell_first;
+        std::vector<uint32_t> refs;     // indices into prims
+        std::vector<int32_t> child;     // -1 when the cell has no subgrid (empty for one-level grids)
+
+        size_t cell_count() const { return static_cast<size_t>(res[0]) * res[1] * res[2]; }
+        size_t cell_index(const int* c) const { return (static_cast<size_t>(c[2]) * res[1] + c[1]) * res[0] + c[0]; }
+    };
+
+    // Closest hit so far and the mailbox of recently tested primitives (direct mapped by primitive index)
+        // any-hit queries leave the records null
+    struct ray_state {
+        static constexpr uint32_t mailbox_size = 16;
+        uint32_t mailbox[mailbox_size];
+        vec3 inv_dir;
+        double closest = 0.0;
+        bool found = false;
+        hit_record* rec = nullptr;
+        hit_record* temp_rec = nullptr;
+    };
+
+    std::vector<const hittable*> prims; // same order as the source objects, the index is the object ID
+    std::vector<aabb> prim_boxes;
+    std::vector<shared_ptr<hittable>> prim_owners;
+    std::vector<uint32_t> large; // indices into prims
+    std::vector<aabb> large_boxes;
+    grid_level root;
+    std::vector<grid_level> subgrids;
+    aabb bbox = aabb::empty;
+    grid_stats info;
+
+    // At least half the scene's extent on every axis
+    static bool covers_most_of(const aabb& box, const aabb& scene)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            if (box.axis_interval(axis).size() < 0.5 * scene.axis_interval(axis).size()) return false;
+        }
+        return true;
+    }
+
+    // Cells per axis for count objects in box: density * count cells in total, as close to cubes as the box allows
+        // flat boxes measure their thin axes as at least one cell of the longest axis so the volume can't collapse to 0
+    static void auto_resolution(const aabb& box, size_t count, double density, int* res)
+    {
+        double extent[3];
+        double longest = 0.0;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            extent[axis] = box.axis_interval(axis).size();
+            longest = std::max(longest, extent[axis]);
+        }
+
+        const double min_extent = longest / max_resolution;
+        const double volume = std::max(extent[0], min_extent) * std::max(extent[1], min_extent) * std::max(extent[2], min_extent);
+        const double cells_per_unit = std::cbrt(density * static_cast<double>(count) / volume);
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const double cells = std::round(extent[axis] * cells_per_unit);
+            res[axis] = static_cast<int>(std::clamp(cells, 1.0, static_cast<double>(max_resolution)));
+        }
+    }
+
+    // Range of cells an object box overlaps on one axis, the box is widened a little so hits on a cell face are listed on both sides
+    static void cell_range(const grid_level& g, const aabb& box, int axis, int& lo, int& hi)
+    {
+        const interval& ax = box.axis_interval(axis);
+        const double origin = g.box.axis_interval(axis).min;
+        const double slack = 1e-6 * g.cell_size[axis];
+
+        lo = static_cast<int>(std::floor((ax.min - slack - origin) * g.inv_cell_size[axis]));
+        hi = static_cast<int>(std::floor((ax.max + slack - origin) * g.inv_cell_size[axis]));
+        lo = std::clamp(lo, 0, g.res[axis] - 1);
+        hi = std::clamp(hi, 0, g.res[axis] - 1);
+    }
+
+    // Size a grid over box and list the objects (prims indices) in every cell they overlap, counted first then filled
+    void build_level(grid_level& g, const std::vector<uint32_t>& objects, const aabb& box, double density)
+    {
+        g.box = box;
+        auto_resolution(box, objects.size(), density, g.res);
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            g.cell_size[axis] = box.axis_interval(axis).size() / g.res[axis];
+            g.inv_cell_size[axis] = 1.0 / g.cell_size[axis];
+        }
+
+        g.cell_first.assign(g.cell_count() + 1, 0);
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            for (uint32_t object : objects)
+            {
+                int lo[3], hi[3];
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    cell_range(g, prim_boxes[object], axis, lo[axis], hi[axis]);
+                }
+
+                int c[3];
+                for (c[2] = lo[2]; c[2] <= hi[2]; ++c[2])
+                {
+                    for (c[1] = lo[1]; c[1] <= hi[1]; ++c[1])
+                    {
+                        for (c[0] = lo[0]; c[0] <= hi[0]; ++c[0])
+                        {
+                            const size_t cell = g.cell_index(c);
+                            if (pass == 0) ++g.cell_first[cell + 1];
+                            else g.refs[g.cell_first[cell]++] = object;
+                        }
+                    }
+                }
+            }
+
+            if (pass == 0)
+            {
+                // Counts -> start offsets
+                for (size_t cell = 1; cell < g.cell_first.size(); ++cell)
+                {
+                    g.cell_first[cell] += g.cell_first[cell - 1];
+                }
+                g.refs.resize(g.cell_first.back());
+            }
+            else
+            {
+                // The fill advanced every start to the next cell's start, shift them back
+                for (size_t cell = g.cell_first.size() - 1; cell > 0; --cell)
+                {
+                    g.cell_first[cell] = g.cell_first[cell - 1];
+                }
+                g.cell_first[0] = 0;
+            }
+        }
+    }
+
+    // Second level: a finer grid over each crowded cell of the root, sized from the objects in that cell
+    void build_subgrids(double density)
+    {
+        root.child.assign(root.cell_count(), -1);
+
+        int c[3];
+        for (c[2] = 0; c[2] < root.res[2]; ++c[2])
+        {
+            for (c[1] = 0; c[1] < root.res[1]; ++c[1])
+            {
+                for (c[0] = 0; c[0] < root.res[0]; ++c[0])
+                {
+                    const size_t cell = root.cell_index(c);
+                    const uint32_t begin = root.cell_first[cell];
+                    const uint32_t end = root.cell_first[cell + 1];
+                    if (end - begin <= subgrid_min_objects) continue;
+
+                    interval axes[3];
+                    for (int axis = 0; axis < 3; ++axis)
+                    {
+                        const double lo = root.box.axis_interval(axis).min + c[axis] * root.cell_size[axis];
+                        axes[axis] = interval(lo, lo + root.cell_size[axis]);
+                    }
+
+                    const std::vector<uint32_t> objects(root.refs.begin() + begin, root.refs.begin() + end);
+                    grid_level sub;
+                    build_level(sub, objects, aabb(axes[0], axes[1], axes[2]), density);
+
+                    // A subgrid that can't separate the objects only adds a level of walking
+                    if (sub.refs.size() >= objects.size() * sub.cell_count()) continue;
+
+                    root.child[cell] = static_cast<int32_t>(subgrids.size());
+                    subgrids.push_back(std::move(sub));
+                }
+            }
+        }
+    }
+
+    void count_cells(const grid_level& g)
+    {
+        info.cells += g.cell_count();
+        info.references += g.refs.size();
+        for (size_t cell = 0; cell < g.cell_count(); ++cell)
+        {
+            const bool has_child = !g.child.empty() && g.child[cell] >= 0;
+            if (g.cell_first[cell] == g.cell_first[cell + 1] && !has_child) ++info.empty_cells;
+        }
+    }
+
+    // Large objects, then the grid walk, true if anything was hit (the closest hit ends up in *rec)
+    template <bool AnyHit>
+    bool trace(const ray& r, const interval& ray_t, hit_record* rec, hit_record* temp_rec) const
+    {
+        ray_state state;
+        state.inv_dir = vec3(1.0 / r.dir[0], 1.0 / r.dir[1], 1.0 / r.dir[2]);
+        state.closest = ray_t.max;
+        state.rec = rec;
+        state.temp_rec = temp_rec;
+        std::fill(std::begin(state.mailbox), std::end(state.mailbox), std::numeric_limits<uint32_t>::max());
+
+        // Large objects first, their hit (usually the ground) lets the walk stop early
+        for (size_t k = 0; k < large.size(); ++k)
+        {
+            if (!large_boxes[k].hit(r.orig, state.inv_dir, interval(ray_t.min, state.closest))) continue;
+            test<AnyHit>(r, ray_t.min, large[k], state);
+            if (AnyHit && state.found) return true;
+        }
+
+        if (!root.cell_first.empty()) walk<AnyHit>(root, r, ray_t.min, state);
+        return state.found;
+    }
+
+    // Test one primitive unless the mailbox says this ray already has, keeps the closest hit
+    template <bool AnyHit>
+    void test(const ray& r, double t_min, uint32_t prim, ray_state& state) const
+    {
+        uint32_t& slot = state.mailbox[prim % ray_state::mailbox_size];
+        if (slot == prim) return;
+        slot = prim;
+
+        if (!prim_boxes[prim].hit(r.orig, state.inv_dir, interval(t_min, state.closest))) return;
+
+        if constexpr (AnyHit)
+        {
+            state.found = prims[prim]->occluded(r, interval(t_min, state.closest));
+        }
+        else if (prims[prim]->intersect(r, interval(t_min, state.closest), *state.temp_rec))
+        {
+            state.found = true;
+            state.closest = state.temp_rec->t;
+            std::swap(*state.rec, *state.temp_rec);
+            state.rec->object_id = static_cast<int>(prim);
+        }
+    }
+
+    // 3D-DDA through one grid level, from where the ray enters its box until the closest hit lies before the next cell
+    template <bool AnyHit>
+    void walk(const grid_level& g, const ray& r, double t_min, ray_state& state) const
+    {
+        const vec3& inv_dir = state.inv_dir;
+
+        interval span(t_min, state.closest);
+        if (!g.box.clip(r.orig, inv_dir, span)) return;
+
+        int cell[3], step[3], out[3];
+        double t_next[3], t_delta[3];
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const double origin = g.box.axis_interval(axis).min;
+            const double entry = r.orig[axis] + span.min * r.dir[axis];
+            cell[axis] = std::clamp(static_cast<int>(std::floor((entry - origin) * g.inv_cell_size[axis])), 0, g.res[axis] - 1);
+
+            if (r.dir[axis] > 0.0)
+            {
+                step[axis] = 1;
+                out[axis] = g.res[axis];
+                t_next[axis] = (origin + (cell[axis] + 1) * g.cell_size[axis] - r.orig[axis]) * inv_dir[axis];
+                t_delta[axis] = g.cell_size[axis] * inv_dir[axis];
+            }
+            else if (r.dir[axis] < 0.0)
+            {
+                step[axis] = -1;
+                out[axis] = -1;
+                t_next[axis] = (origin + cell[axis] * g.cell_size[axis] - r.orig[axis]) * inv_dir[axis];
+                t_delta[axis] = -g.cell_size[axis] * inv_dir[axis];
+            }
+            else
+            {
+                step[axis] = 0;
+                out[axis] = -1;
+                t_next[axis] = std::numeric_limits<double>::infinity();
+                t_delta[axis] = 0.0;
+            }
+        }
+
+        while (true)
+        {
+            const size_t index = g.cell_index(cell);
+            if (!g.child.empty() && g.child[index] >= 0)
+            {
+                walk<AnyHit>(subgrids[static_cast<size_t>(g.child[index])], r, t_min, state);
+                if (AnyHit && state.found) return;
+            }
+            else
+            {
+                for (uint32_t k = g.cell_first[index]; k < g.cell_first[index + 1]; ++k)
+                {
+                    test<AnyHit>(r, t_min, g.refs[k], state);
+                    if (AnyHit && state.found) return;
+                }
+            }
+
+            // Next cell is across the nearest face, anything closer than that face has been found
+            int axis = (t_next[0] < t_next[1]) ? 0 : 1;
+            if (t_next[2] < t_next[axis]) axis = 2;
+            if (state.closest <= t_next[axis] || t_next[axis] > span.max) break;
+
+            cell[axis] += step[axis];
+            if (cell[axis] == out[axis]) break;
+            t_next[axis] += t_delta[axis];
+        }
+    }
+};
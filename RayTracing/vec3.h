@@ -2,62 +2,266 @@
 #include <cmath>
 #include <iostream>
 
+#include "precision.h"
+#include "cpu_features.h"
+
+// SSE storage for vec3_t<float> and vec3_t<double>, define RT_SIMD_VEC3 to turn it on (needs SSE2, every x64 target has it)
+    // off by default: ray_color measured no faster with it for double and 10-30% slower for float (main.cpp --bench-ray-color), a 3-vector leaves half
+    // the lanes idle, dot and cross spend what they save on shuffles, and padding makes rays and hit records larger
+#if RT_X86 && defined(RT_SIMD_VEC3) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define RT_VEC3_SSE 1
+#else
+#define RT_VEC3_SSE 0
+#endif
+
+// Lanes a vec3_t<T> stores, 4 means padded SSE storage (16-byte aligned, the fourth lane is never read)
+template <typename T>
+struct vec3_layout {
+    static constexpr int lanes = 3;
+};
+
+#if RT_VEC3_SSE
+template <>
+struct vec3_layout<float> {
+    static constexpr int lanes = 4;
+};
+
+template <>
+struct vec3_layout<double> {
+    static constexpr int lanes = 4;
+};
+#endif
+
 // 3D vector class used for math throughout the renderer
-class vec3 
+    // a template on the scalar type, the renderer works with vec3 = vec3_t<real>
+    // scalar arguments of the operators take the vector's own type, so double literals work in a float build too
+    // with RT_SIMD_VEC3 float and double vectors are padded to 4 lanes and use SSE for the arithmetic (vec3_sse below)
+    // every lane rounds like the scalar code and dot sums x, y, z in the same order, so both layouts give the same results
+template <typename T>
+class alignas(vec3_layout<T>::lanes == 4 ? 16 : alignof(T)) vec3_t
 {
 public:
-    double e[3]{};
+    using scalar = T;
+    static constexpr bool padded = vec3_layout<T>::lanes == 4;
 
-    vec3() = default;
-    vec3(double e0, double e1, double e2) { e[0] = e0; e[1] = e1; e[2] = e2; }
+    T e[vec3_layout<T>::lanes]{};
 
-    double x() const { return e[0]; }
-    double y() const { return e[1]; }
-    double z() const { return e[2]; }
+    vec3_t() = default;
+    vec3_t(T e0, T e1, T e2) { e[0] = e0; e[1] = e1; e[2] = e2; }
 
-    vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-    double operator[](int i) const { return e[i]; }
-    double& operator[](int i) { return e[i]; }
+    // Changing precision is always spelled out
+    template <typename U>
+    explicit vec3_t(const vec3_t<U>& v) { e[0] = static_cast<T>(v.e[0]); e[1] = static_cast<T>(v.e[1]); e[2] = static_cast<T>(v.e[2]); }
 
-    vec3& operator+=(const vec3& v) { e[0] += v.e[0]; e[1] += v.e[1]; e[2] += v.e[2]; return *this; }
-    vec3& operator*=(double t) { e[0] *= t; e[1] *= t; e[2] *= t; return *this; }
-    vec3& operator/=(double t) { return *this *= 1 / t; }
+    T x() const { return e[0]; }
+    T y() const { return e[1]; }
+    T z() const { return e[2]; }
 
-    double length() const { return std::sqrt(length_squared()); }
-    double length_squared() const { return e[0] * e[0] + e[1] * e[1] + e[2] * e[2]; }
+    vec3_t operator-() const;
+    T operator[](int i) const { return e[i]; }
+    T& operator[](int i) { return e[i]; }
 
-    bool near_zero() const 
+    vec3_t& operator+=(const vec3_t& v);
+    vec3_t& operator*=(T t);
+    vec3_t& operator/=(T t) { return *this *= 1 / t; }
+
+    T length() const { return std::sqrt(length_squared()); }
+    T length_squared() const;
+
+    bool near_zero() const
     {
-        const double s = 1e-8;
+        const T s = tolerance<T>::near_zero;
         return (std::fabs(e[0]) < s) && (std::fabs(e[1]) < s) && (std::fabs(e[2]) < s);
     }
 };
 
+using vec3 = vec3_t<real>;
 using point3 = vec3;   // 3D point
 using color = vec3;   // RGB color
 
-inline std::ostream& operator<<(std::ostream& out, const vec3& v) 
+#if RT_VEC3_SSE
+// SSE2 kernels behind the padded vectors: float in one register, double in two (x, y) and (z, pad)
+    // lane-wise operations plus the shuffles dot and cross need, dot adds its products in the scalar order, so nothing rounds differently
+namespace vec3_sse {
+    struct double4 {
+        __m128d xy, zw;
+    };
+
+    inline __m128 load(const vec3_t<float>& v) { return _mm_load_ps(v.e); }
+    inline double4 load(const vec3_t<double>& v) { return { _mm_load_pd(v.e), _mm_load_pd(v.e + 2) }; }
+
+    inline void store(vec3_t<float>& v, __m128 a) { _mm_store_ps(v.e, a); }
+    inline void store(vec3_t<double>& v, const double4& a) { _mm_store_pd(v.e, a.xy); _mm_store_pd(v.e + 2, a.zw); }
+
+    inline __m128 broadcast(float t) { return _mm_set1_ps(t); }
+    inline double4 broadcast(double t) { const __m128d s = _mm_set1_pd(t); return { s, s }; }
+
+    inline __m128 add(__m128 a, __m128 b) { return _mm_add_ps(a, b); }
+    inline __m128 sub(__m128 a, __m128 b) { return _mm_sub_ps(a, b); }
+    inline __m128 mul(__m128 a, __m128 b) { return _mm_mul_ps(a, b); }
+    inline double4 add(const double4& a, const double4& b) { return { _mm_add_pd(a.xy, b.xy), _mm_add_pd(a.zw, b.zw) }; }
+    inline double4 sub(const double4& a, const double4& b) { return { _mm_sub_pd(a.xy, b.xy), _mm_sub_pd(a.zw, b.zw) }; }
+    inline double4 mul(const double4& a, const double4& b) { return { _mm_mul_pd(a.xy, b.xy), _mm_mul_pd(a.zw, b.zw) }; }
+
+    // Sign flip, not 0 - a: -(+0) has to stay -0 (reciprocal directions and their signs depend on it)
+    inline __m128 neg(__m128 a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+    inline double4 neg(const double4& a) { const __m128d s = _mm_set1_pd(-0.0); return { _mm_xor_pd(a.xy, s), _mm_xor_pd(a.zw, s) }; }
+
+    // (x * x' + y * y') + z * z'
+    inline float dot(__m128 a, __m128 b)
+    {
+        const __m128 p = _mm_mul_ps(a, b);
+        const __m128 sum = _mm_add_ss(_mm_add_ss(p, _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1))), _mm_movehl_ps(p, p));
+        return _mm_cvtss_f32(sum);
+    }
+
+    inline double dot(const double4& a, const double4& b)
+    {
+        const __m128d xy = _mm_mul_pd(a.xy, b.xy);
+        const __m128d z = _mm_mul_sd(a.zw, b.zw);
+        return _mm_cvtsd_f64(_mm_add_sd(_mm_add_sd(xy, _mm_unpackhi_pd(xy, xy)), z));
+    }
+
+    // a.yzx * b.zxy - a.zxy * b.yzx
+    inline __m128 cross(__m128 a, __m128 b)
+    {
+        const __m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+        const __m128 b_zxy = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 1, 0, 2));
+        const __m128 a_zxy = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 1, 0, 2));
+        const __m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+        return _mm_sub_ps(_mm_mul_ps(a_yzx, b_zxy), _mm_mul_ps(a_zxy, b_yzx));
+    }
+
+    inline double4 cross(const double4& a, const double4& b)
+    {
+        const __m128d a_yz = _mm_shuffle_pd(a.xy, a.zw, 1);
+        const __m128d b_zx = _mm_shuffle_pd(b.zw, b.xy, 0);
+        const __m128d a_zx = _mm_shuffle_pd(a.zw, a.xy, 0);
+        const __m128d b_yz = _mm_shuffle_pd(b.xy, b.zw, 1);
+        const __m128d p = _mm_mul_pd(a.xy, _mm_shuffle_pd(b.xy, b.xy, 1)); // (x * y', y * x')
+        return { _mm_sub_pd(_mm_mul_pd(a_yz, b_zx), _mm_mul_pd(a_zx, b_yz)), _mm_sub_sd(p, _mm_unpackhi_pd(p, p)) };
+    }
+
+    template <typename T, typename Op>
+    inline vec3_t<T> apply(const vec3_t<T>& u, const vec3_t<T>& v, Op op)
+    {
+        vec3_t<T> r;
+        store(r, op(load(u), load(v)));
+        return r;
+    }
+}
+#endif
+
+template <typename T>
+inline vec3_t<T> vec3_t<T>::operator-() const
+{
+#if RT_VEC3_SSE
+    if constexpr (padded) { vec3_t r; vec3_sse::store(r, vec3_sse::neg(vec3_sse::load(*this))); return r; }
+#endif
+    return vec3_t(-e[0], -e[1], -e[2]);
+}
+
+template <typename T>
+inline vec3_t<T>& vec3_t<T>::operator+=(const vec3_t& v)
+{
+#if RT_VEC3_SSE
+    if constexpr (padded) { vec3_sse::store(*this, vec3_sse::add(vec3_sse::load(*this), vec3_sse::load(v))); return *this; }
+#endif
+    e[0] += v.e[0]; e[1] += v.e[1]; e[2] += v.e[2];
+    return *this;
+}
+
+template <typename T>
+inline vec3_t<T>& vec3_t<T>::operator*=(T t)
+{
+#if RT_VEC3_SSE
+    if constexpr (padded) { vec3_sse::store(*this, vec3_sse::mul(vec3_sse::load(*this), vec3_sse::broadcast(t))); return *this; }
+#endif
+    e[0] *= t; e[1] *= t; e[2] *= t;
+    return *this;
+}
+
+template <typename T>
+inline T vec3_t<T>::length_squared() const
+{
+#if RT_VEC3_SSE
+    if constexpr (padded) { const auto a = vec3_sse::load(*this); return vec3_sse::dot(a, a); }
+#endif
+    return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
+}
+
+template <typename T>
+inline std::ostream& operator<<(std::ostream& out, const vec3_t<T>& v)
 {
     return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
 }
 
-inline vec3 operator+(const vec3& u, const vec3& v) { return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]); }
-inline vec3 operator-(const vec3& u, const vec3& v) { return vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]); }
-inline vec3 operator*(const vec3& u, const vec3& v) { return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]); }
-inline vec3 operator*(double t, const vec3& v) { return vec3(t * v.e[0], t * v.e[1], t * v.e[2]); }
-inline vec3 operator*(const vec3& v, double t) { return t * v; }
-inline vec3 operator/(vec3 v, double t) { return (1 / t) * v; }
+template <typename T>
+inline vec3_t<T> operator+(const vec3_t<T>& u, const vec3_t<T>& v)
+{
+#if RT_VEC3_SSE
+    if constexpr (vec3_t<T>::padded) return vec3_sse::apply(u, v, [](auto a, auto b) { return vec3_sse::add(a, b); });
+#endif
+    return vec3_t<T>(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+}
+
+template <typename T>
+inline vec3_t<T> operator-(const vec3_t<T>& u, const vec3_t<T>& v)
+{
+#if RT_VEC3_SSE
+    if constexpr (vec3_t<T>::padded) return vec3_sse::apply(u, v, [](auto a, auto b) { return vec3_sse::sub(a, b); });
+#endif
+    return vec3_t<T>(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+}
+
+template <typename T>
+inline vec3_t<T> operator*(const vec3_t<T>& u, const vec3_t<T>& v)
+{
+#if RT_VEC3_SSE
+    if constexpr (vec3_t<T>::padded) return vec3_sse::apply(u, v, [](auto a, auto b) { return vec3_sse::mul(a, b); });
+#endif
+    return vec3_t<T>(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+}
+
+template <typename T>
+inline vec3_t<T> operator*(typename vec3_t<T>::scalar t, const vec3_t<T>& v)
+{
+#if RT_VEC3_SSE
+    if constexpr (vec3_t<T>::padded)
+    {
+        vec3_t<T> r;
+        vec3_sse::store(r, vec3_sse::mul(vec3_sse::broadcast(t), vec3_sse::load(v)));
+        return r;
+    }
+#endif
+    return vec3_t<T>(t * v.e[0], t * v.e[1], t * v.e[2]);
+}
+
+template <typename T> inline vec3_t<T> operator*(const vec3_t<T>& v, typename vec3_t<T>::scalar t) { return t * v; }
+template <typename T> inline vec3_t<T> operator/(vec3_t<T> v, typename vec3_t<T>::scalar t) { return (1 / t) * v; }
+
+template <typename T>
+inline T dot(const vec3_t<T>& u, const vec3_t<T>& v)
+{
+#if RT_VEC3_SSE
+    if constexpr (vec3_t<T>::padded) return vec3_sse::dot(vec3_sse::load(u), vec3_sse::load(v));
+#endif
+    return u.e[0] * v.e[0] + u.e[1] * v.e[1] + u.e[2] * v.e[2];
+}
 
-inline double dot(const vec3& u, const vec3& v) { return u.e[0] * v.e[0] + u.e[1] * v.e[1] + u.e[2] * v.e[2]; }
-inline vec3 cross(const vec3& u, const vec3& v) 
+template <typename T>
+inline vec3_t<T> cross(const vec3_t<T>& u, const vec3_t<T>& v)
 {
-    return vec3(
+#if RT_VEC3_SSE
+    if constexpr (vec3_t<T>::padded) return vec3_sse::apply(u, v, [](auto a, auto b) { return vec3_sse::cross(a, b); });
+#endif
+    return vec3_t<T>(
         u.e[1] * v.e[2] - u.e[2] * v.e[1],
         u.e[2] * v.e[0] - u.e[0] * v.e[2],
         u.e[0] * v.e[1] - u.e[1] * v.e[0]
     );
 }
 
-inline vec3 project(const vec3& u, const vec3& v) { return v * (dot(u, v) / dot(v, v)); }
+template <typename T> inline vec3_t<T> project(const vec3_t<T>& u, const vec3_t<T>& v) { return v * (dot(u, v) / dot(v, v)); }
 
-inline vec3 unit_vector(vec3 v) { return v / v.length(); }
+template <typename T> inline vec3_t<T> unit_vector(vec3_t<T> v) { return v / v.length(); }
@@ -0,0 +1,441 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "hittable.h"
+#include "bvh_build.h"
+#include "cpu_features.h"
+// Wide (4 or 8 children per node) bounding volume hierarchy
+    // the binary SAH tree from bvh_build::build_tree is collapsed top down: a node keeps opening its largest splittable child until it has Width children
+    // child bounds are stored SoA (all min x, then all min y, ...) so one SIMD kernel tests a ray against every child
+    // BVH4 uses SSE, BVH8 uses AVX2, the instruction set is checked at runtime and falls back to a scalar kernel
+    // primitives are reordered into leaf order like linear_bvh
+
+// Node with Width child slots, unused slots have empty (inverted) bounds and never hit
+template <int Width>
+struct alignas(32) wide_bvh_node {
+    float lo[3][Width];
+    float hi[3][Width];
+    int32_t child[Width];  // interior child: node index, leaf child: ~first primitive
+    uint16_t count[Width]; // primitives in a leaf child, 0 for interior children
+};
+
+static_assert(sizeof(wide_bvh_node<4>) == 128, "wide_bvh_node<4> should fill two cache lines");
+static_assert(sizeof(wide_bvh_node<8>) == 256, "wide_bvh_node<8> should fill four cache lines");
+
+// Ray converted once per traversal for the float box tests
+    // the origin is nudged by its float rounding error, towards the box for the near planes and away for the far planes,
+    // so the float test never rejects a box the double precision ray passes through
+struct wide_ray {
+    float org_near[3];
+    float org_far[3];
+    float inv_dir[3];
+    int near_hi[3]; // ray runs toward -axis, the near plane is the upper bound
+};
+
+inline wide_ray make_wide_ray(const ray& r)
+{
+    wide_ray wr;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const double o = r.orig[axis];
+        const float of = static_cast<float>(o);
+        const float err = bvh_build::float_above(std::abs(o - static_cast<double>(of))) + std::abs(of) * 0x1p-22f;
+
+        wr.inv_dir[axis] = static_cast<float>(1.0 / r.dir[axis]);
+        wr.near_hi[axis] = std::signbit(wr.inv_dir[axis]) ? 1 : 0;
+        wr.org_near[axis] = wr.near_hi[axis] ? of - err : of + err;
+        wr.org_far[axis] = wr.near_hi[axis] ? of + err : of - err;
+    }
+    return wr;
+}
+
+// Slab tests widen every interval by a few float ulps for the rounding of the subtract and multiply
+constexpr float wide_t_shrink = 1.0f - 0x1p-20f;
+constexpr float wide_t_grow = 1.0f + 0x1p-20f;
+
+// Box kernels: test the ray against every child of a node, return the hit lanes as a bit mask and each lane's entry t
+    // NaN slab distances (origin on the plane of a slab the ray runs parallel to) are ignored by the comparisons
+struct scalar_box_test {
+    template <int Width>
+    static unsigned test(const wide_bvh_node<Width>& node, const wide_ray& wr, float t_min, float t_max, float* t_near)
+    {
+        unsigned mask = 0;
+        for (int lane = 0; lane < Width; ++lane)
+        {
+            float tn = t_min;
+            float tf = t_max;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                const float near_plane = wr.near_hi[axis] ? node.hi[axis][lane] : node.lo[axis][lane];
+                const float far_plane = wr.near_hi[axis] ? node.lo[axis][lane] : node.hi[axis][lane];
+
+                const float t0 = (near_plane - wr.org_near[axis]) * wr.inv_dir[axis] * wide_t_shrink;
+                const float t1 = (far_plane - wr.org_far[axis]) * wr.inv_dir[axis] * wide_t_grow;
+                if (t0 > tn) tn = t0;
+                if (t1 < tf) tf = t1;
+            }
+            t_near[lane] = tn;
+            if (tn <= tf) mask |= 1u << lane;
+        }
+        return mask;
+    }
+};
+
+#if RT_X86
+// 4 children per instruction, SSE is part of the x64 baseline
+struct sse_box_test {
+    static RT_FORCE_INLINE unsigned test(const wide_bvh_node<4>& node, const wide_ray& wr, float t_min, float t_max, float* t_near)
+    {
+        __m128 tn = _mm_set1_ps(t_min);
+        __m128 tf = _mm_set1_ps(t_max);
+        const __m128 shrink = _mm_set1_ps(wide_t_shrink);
+        const __m128 grow = _mm_set1_ps(wide_t_grow);
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const __m128 near_plane = _mm_load_ps(wr.near_hi[axis] ? node.hi[axis] : node.lo[axis]);
+            const __m128 far_plane = _mm_load_ps(wr.near_hi[axis] ? node.lo[axis] : node.hi[axis]);
+            const __m128 inv = _mm_set1_ps(wr.inv_dir[axis]);
+
+            const __m128 t0 = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(near_plane, _mm_set1_ps(wr.org_near[axis])), inv), shrink);
+            const __m128 t1 = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(far_plane, _mm_set1_ps(wr.org_far[axis])), inv), grow);
+
+            // max/min return the second operand when either is NaN
+            tn = _mm_max_ps(t0, tn);
+            tf = _mm_min_ps(t1, tf);
+        }
+
+        _mm_store_ps(t_near, tn);
+        return static_cast<unsigned>(_mm_movemask_ps(_mm_cmple_ps(tn, tf)));
+    }
+};
+
+// 8 children per instruction, only called from functions compiled for AVX2
+struct avx2_box_test {
+    static RT_TARGET_AVX2 inline unsigned test(const wide_bvh_node<8>& node, const wide_ray& wr, float t_min, float t_max, float* t_near)
+    {
+        __m256 tn = _mm256_set1_ps(t_min);
+        __m256 tf = _mm256_set1_ps(t_max);
+        const __m256 shrink = _mm256_set1_ps(wide_t_shrink);
+        const __m256 grow = _mm256_set1_ps(wide_t_grow);
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const __m256 near_plane = _mm256_load_ps(wr.near_hi[axis] ? node.hi[axis] : node.lo[axis]);
+            const __m256 far_plane = _mm256_load_ps(wr.near_hi[axis] ? node.lo[axis] : node.hi[axis]);
+            const __m256 inv = _mm256_set1_ps(wr.inv_dir[axis]);
+
+            const __m256 t0 = _mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(near_plane, _mm256_set1_ps(wr.org_near[axis])), inv), shrink);
+            const __m256 t1 = _mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(far_plane, _mm256_set1_ps(wr.org_far[axis])), inv), grow);
+
+            tn = _mm256_max_ps(t0, tn);
+            tf = _mm256_min_ps(t1, tf);
+        }
+
+        _mm256_store_ps(t_near, tn);
+        return static_cast<unsigned>(_mm256_movemask_ps(_mm256_cmp_ps(tn, tf, _CMP_LE_OQ)));
+    }
+};
+#endif
+
+template <int Width>
+class wide_bvh : public hittable {
+public:
+    static_assert(Width == 4 || Width == 8, "wide_bvh supports 4 and 8 children per node");
+
+    static constexpr size_t max_leaf_size = 4;
+
+    // Build over every object, object IDs are the objects' indices in this vector
+        // isa picks the box kernel, a width the CPU can't run in SIMD uses the scalar kernel
+    explicit wide_bvh(const std::vector<shared_ptr<hittable>>& objects, simd_isa requested = detect_simd_isa())
+    {
+        isa = simd_isa::scalar;
+#if RT_X86
+        if (Width == 4 && requested != simd_isa::scalar) isa = simd_isa::sse;
+        if (Width == 8 && requested >= simd_isa::avx2) isa = simd_isa::avx2;
+#else
+        (void)requested;
+#endif
+        if (objects.empty()) return;
+
+        std::vector<bvh_build::item> items = bvh_build::make_items(objects);
+
+        prims.reserve(items.size());
+        prim_ids.reserve(items.size());
+        prim_owners.reserve(items.size());
+
+        std::unique_ptr<bvh_build::tree_node> root = bvh_build::build_tree(items, max_leaf_size, &tree_info.threads);
+
+        collapse(items, *root, 1);
+        bbox = root->box;
+        tree_info.finish(bvh_build::bounded_bounds(items));
+    }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        if (nodes.empty()) return false;
+
+#if RT_X86
+        if constexpr (Width == 8)
+        {
+            if (isa == simd_isa::avx2) return hit_avx2(r, ray_t, rec);
+        }
+        else
+        {
+            if (isa == simd_isa::sse) return traverse<sse_box_test>(r, ray_t, rec);
+        }
+#endif
+        return traverse<scalar_box_test>(r, ray_t, rec);
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override
+    {
+        if (nodes.empty()) return false;
+
+#if RT_X86
+        if constexpr (Width == 8)
+        {
+            if (isa == simd_isa::avx2) return occluded_avx2(r, ray_t);
+        }
+        else
+        {
+            if (isa == simd_isa::sse) return traverse_any<sse_box_test>(r, ray_t);
+        }
+#endif
+        return traverse_any<scalar_box_test>(r, ray_t);
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    // e.g. "BVH8 (AVX2)"
+    std::string name() const
+    {
+        return "BVH" + std::to_string(Width) + " (" + simd_isa_name(isa) + ")";
+    }
+
+    size_t node_count() const { return nodes.size(); }
+    const bvh_build::tree_stats& stats() const { return tree_info; }
+
+private:
+    // Each wide level is at least one binary level, so the stack never holds more than this
+    static constexpr int stack_capacity = bvh_build::max_depth * (Width - 1) + 1;
+
+    std::vector<wide_bvh_node<Width>> nodes;
+    std::vector<const hittable*> prims;
+    std::vector<int> prim_ids;
+    std::vector<shared_ptr<hittable>> prim_owners;
+    aabb bbox = aabb::empty;
+    bvh_build::tree_stats tree_info;
+    simd_isa isa = simd_isa::scalar;
+
+    // Stack entry: a child slot copied out of its node, with the t at which the ray enters it
+    struct stack_entry {
+        int32_t child;
+        uint32_t count;
+        float t;
+    };
+
+#if RT_X86
+    RT_TARGET_AVX2 bool hit_avx2(const ray& r, interval ray_t, hit_record& rec) const
+    {
+        return traverse<avx2_box_test>(r, ray_t, rec);
+    }
+
+    RT_TARGET_AVX2 bool occluded_avx2(const ray& r, interval ray_t) const
+    {
+        return traverse_any<avx2_box_test>(r, ray_t);
+    }
+#endif
+
+    // Children a ray enters are pushed farthest first, so the nearest one is visited next
+        // entries the ray enters beyond the closest hit found so far are dropped when popped
+    template <typename BoxTest>
+    RT_FORCE_INLINE bool traverse(const ray& r, interval ray_t, hit_record& rec) const
+    {
+        const wide_ray wr = make_wide_ray(r);
+
+        stack_entry stack[stack_capacity];
+        int stack_size = 0;
+        stack[stack_size++] = stack_entry{ 0, 0, -std::numeric_limits<float>::infinity() };
+
+        alignas(32) float t_near[Width];
+        hit_record temp_rec;
+        bool hit_anything = false;
+        double closest = ray_t.max;
+        const float t_min = bvh_build::float_below(ray_t.min);
+        float t_max = bvh_build::float_above(closest);
+
+        while (stack_size > 0)
+        {
+            const stack_entry entry = stack[--stack_size];
+            if (entry.t > t_max) continue;
+
+            if (entry.count > 0)
+            {
+                const int first = ~entry.child;
+                const int end = first + static_cast<int>(entry.count);
+                for (int i = first; i < end; ++i)
+                {
+                    if (prims[static_cast<size_t>(i)]->intersect(r, interval(ray_t.min, closest), temp_rec))
+                    {
+                        hit_anything = true;
+                        closest = temp_rec.t;
+                        rec = temp_rec;
+                        rec.object_id = prim_ids[static_cast<size_t>(i)];
+                    }
+                }
+                t_max = bvh_build::float_above(closest);
+                continue;
+            }
+
+            const wide_bvh_node<Width>& node = nodes[static_cast<size_t>(entry.child)];
+            const unsigned mask = BoxTest::test(node, wr, t_min, t_max, t_near);
+            if (mask == 0) continue;
+
+            // Insertion sort of the entered children by descending t straight onto the stack
+            const int base = stack_size;
+            for (int lane = 0; lane < Width; ++lane)
+            {
+                if ((mask & (1u << lane)) == 0) continue;
+
+                const stack_entry child{ node.child[lane], node.count[lane], t_near[lane] };
+                int pos = stack_size++;
+                while (pos > base && stack[pos - 1].t < child.t)
+                {
+                    stack[pos] = stack[pos - 1];
+                    --pos;
+                }
+                stack[pos] = child;
+            }
+        }
+
+        return hit_anything;
+    }
+
+    // Any-hit walk: the interval never shrinks, so children are pushed in lane order and the first primitive hit ends it
+    template <typename BoxTest>
+    RT_FORCE_INLINE bool traverse_any(const ray& r, interval ray_t) const
+    {
+        const wide_ray wr = make_wide_ray(r);
+
+        stack_entry stack[stack_capacity];
+        int stack_size = 0;
+        stack[stack_size++] = stack_entry{ 0, 0, 0.0f };
+
+        alignas(32) float t_near[Width];
+        const float t_min = bvh_build::float_below(ray_t.min);
+        const float t_max = bvh_build::float_above(ray_t.max);
+
+        while (stack_size > 0)
+        {
+            const stack_entry entry = stack[--stack_size];
+
+            if (entry.count > 0)
+            {
+                const int first = ~entry.child;
+                const int end = first + static_cast<int>(entry.count);
+                for (int i = first; i < end; ++i)
+                {
+                    if (prims[static_cast<size_t>(i)]->occluded(r, ray_t)) return true;
+                }
+                continue;
+            }
+
+            const wide_bvh_node<Width>& node = nodes[static_cast<size_t>(entry.child)];
+            unsigned mask = BoxTest::test(node, wr, t_min, t_max, t_near);
+            for (int lane = 0; mask != 0; ++lane, mask >>= 1)
+            {
+                if (mask & 1u) stack[stack_size++] = stack_entry{ node.child[lane], node.count[lane], 0.0f };
+            }
+        }
+
+        return false;
+    }
+
+    // Emit the wide node for an interior tree node (or a single leaf at the root) and everything below it, returns its index
+        // interior children are opened largest surface area first, like descending the binary tree breadth first
+    int collapse(const std::vector<bvh_build::item>& items, const bvh_build::tree_node& tree, int depth)
+    {
+        std::vector<const bvh_build::tree_node*> children;
+        if (tree.is_leaf()) children.push_back(&tree);
+        else children = { tree.child[0].get(), tree.child[1].get() };
+
+        while (children.size() < static_cast<size_t>(Width))
+        {
+            int open = -1;
+            for (size_t i = 0; i < children.size(); ++i)
+            {
+                if (children[i]->is_leaf()) continue;
+                if (open < 0 || children[i]->box.surface_area() > children[static_cast<size_t>(open)]->box.surface_area()) {
+                    open = static_cast<int>(i);
+                }
+            }
+            if (open < 0) break;
+
+            const bvh_build::tree_node* parent = children[static_cast<size_t>(open)];
+            children[static_cast<size_t>(open)] = parent->child[0].get();
+            children.push_back(parent->child[1].get());
+        }
+
+        const int index = static_cast<int>(nodes.size());
+        nodes.push_back(empty_node());
+        tree_info.add_node(tree.box, depth);
+
+        for (size_t lane = 0; lane < children.size(); ++lane)
+        {
+            const bvh_build::tree_node& c = *children[lane];
+
+            int32_t child = 0;
+            uint16_t count = 0;
+            if (c.is_leaf())
+            {
+                child = ~static_cast<int32_t>(prims.size());
+                count = static_cast<uint16_t>(c.end - c.begin);
+                tree_info.add_leaf(c.box, c.end - c.begin);
+
+                for (size_t i = c.begin; i < c.end; ++i)
+                {
+                    prims.push_back(items[i].object.get());
+                    prim_ids.push_back(items[i].id);
+                    prim_owners.push_back(items[i].object);
+                }
+            }
+            else
+            {
+                child = collapse(items, c, depth + 1);
+            }
+
+            // Recursion grows nodes, so the slot is written through the index afterwards
+            wide_bvh_node<Width>& node = nodes[static_cast<size_t>(index)];
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                node.lo[axis][lane] = bvh_build::float_below(c.box.axis_interval(axis).min);
+                node.hi[axis][lane] = bvh_build::float_above(c.box.axis_interval(axis).max);
+            }
+            node.child[lane] = child;
+            node.count[lane] = count;
+        }
+        return index;
+    }
+
+    static wide_bvh_node<Width> empty_node()
+    {
+        wide_bvh_node<Width> node{};
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            for (int lane = 0; lane < Width; ++lane)
+            {
+                node.lo[axis][lane] = std::numeric_limits<float>::infinity();
+                node.hi[axis][lane] = -std::numeric_limits<float>::infinity();
+            }
+        }
+        return node;
+    }
+};